@@ -18,6 +18,13 @@ android {
     }
 
     buildTypes {
+        debug {
+            externalNativeBuild {
+                cmake {
+                    arguments += "-DFILESERVER_TRACING=ON"
+                }
+            }
+        }
         release {
             isMinifyEnabled = false
             proguardFiles(
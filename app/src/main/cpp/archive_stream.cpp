@@ -0,0 +1,373 @@
+#include "archive_stream.h"
+#include "file_manager.h"
+
+#include <zlib.h>
+#include <cstdio>
+#include <cstring>
+#include <algorithm>
+#include <unordered_set>
+
+namespace {
+
+constexpr uint32_t ZIP_LOCAL_HEADER_SIG = 0x04034b50;
+constexpr uint32_t ZIP_DESCRIPTOR_SIG = 0x08074b50;
+constexpr uint32_t ZIP_CENTRAL_HEADER_SIG = 0x02014b50;
+constexpr uint32_t ZIP64_END_SIG = 0x06064b50;
+constexpr uint32_t ZIP64_LOCATOR_SIG = 0x07064b50;
+constexpr uint32_t ZIP_END_SIG = 0x06054b50;
+constexpr uint16_t ZIP64_EXTRA_TAG = 0x0001;
+// Bit 3: sizes and CRC follow the data; bit 11: names are UTF-8
+constexpr uint16_t ZIP_FLAGS = 0x0808;
+constexpr uint16_t ZIP_VERSION = 20;
+constexpr uint16_t ZIP64_VERSION = 45;
+constexpr uint16_t ZIP_MADE_BY_UNIX = 3 << 8;
+constexpr uint32_t ZIP32_LIMIT = 0xffffffff;
+constexpr uint16_t ZIP16_LIMIT = 0xffff;
+
+constexpr uint64_t TAR_BLOCK = 512;
+constexpr uint64_t TAR_MAX_OCTAL_SIZE = 077777777777ULL;
+constexpr size_t TAR_NAME_FIELD = 100;
+
+void put16(std::string& out, uint16_t v) {
+    out.push_back(static_cast<char>(v));
+    out.push_back(static_cast<char>(v >> 8));
+}
+
+void put32(std::string& out, uint32_t v) {
+    put16(out, static_cast<uint16_t>(v));
+    put16(out, static_cast<uint16_t>(v >> 16));
+}
+
+void put64(std::string& out, uint64_t v) {
+    put32(out, static_cast<uint32_t>(v));
+    put32(out, static_cast<uint32_t>(v >> 32));
+}
+
+uint32_t clamp32(uint64_t v) {
+    return v >= ZIP32_LIMIT ? ZIP32_LIMIT : static_cast<uint32_t>(v);
+}
+
+uint64_t tarPadding(uint64_t size) {
+    return (TAR_BLOCK - size % TAR_BLOCK) % TAR_BLOCK;
+}
+
+// MS-DOS date and time as ZIP stores them; clamped to the 1980 epoch
+void dosDateTime(time_t t, uint16_t& date, uint16_t& time) {
+    struct tm tm;
+    localtime_r(&t, &tm);
+    if (tm.tm_year < 80) {
+        date = (1 << 5) | 1;
+        time = 0;
+        return;
+    }
+    date = static_cast<uint16_t>(((tm.tm_year - 80) << 9) | ((tm.tm_mon + 1) << 5) | tm.tm_mday);
+    time = static_cast<uint16_t>((tm.tm_hour << 11) | (tm.tm_min << 5) | (tm.tm_sec / 2));
+}
+
+bool isAscii(const std::string& s) {
+    for (unsigned char c : s) {
+        if (c >= 0x80) return false;
+    }
+    return true;
+}
+
+// "<len> key=value\n", where len counts the whole record including itself
+std::string paxRecord(const std::string& key, const std::string& value) {
+    size_t base = key.size() + value.size() + 3;
+    size_t length = base + std::to_string(base).size();
+    if (std::to_string(length).size() != std::to_string(base).size()) {
+        length = base + std::to_string(length).size();
+    }
+    return std::to_string(length) + " " + key + "=" + value + "\n";
+}
+
+std::string paxRecords(const std::string& name, uint64_t size) {
+    std::string records;
+    if (name.size() >= TAR_NAME_FIELD || !isAscii(name)) {
+        records += paxRecord("path", name);
+    }
+    if (size > TAR_MAX_OCTAL_SIZE) {
+        records += paxRecord("size", std::to_string(size));
+    }
+    return records;
+}
+
+// One 512-byte ustar header block
+void appendUstarHeader(std::string& out, const std::string& name, uint64_t size,
+                       time_t mtime, char type) {
+    char block[TAR_BLOCK] = {};
+    // Plain-ASCII stand-in; the PAX record carries the real name when it differs
+    size_t nameLength = std::min(name.size(), TAR_NAME_FIELD - 1);
+    for (size_t i = 0; i < nameLength; i++) {
+        unsigned char c = name[i];
+        block[i] = c < 0x80 ? static_cast<char>(c) : '_';
+    }
+    snprintf(block + 100, 8, "%07o", 0644);
+    snprintf(block + 108, 8, "%07o", 0);
+    snprintf(block + 116, 8, "%07o", 0);
+    snprintf(block + 124, 12, "%011llo",
+             static_cast<unsigned long long>(size > TAR_MAX_OCTAL_SIZE ? 0 : size));
+    unsigned long long modified = mtime > 0 ? static_cast<unsigned long long>(mtime) : 0;
+    snprintf(block + 136, 12, "%011llo", std::min<unsigned long long>(modified, TAR_MAX_OCTAL_SIZE));
+    memset(block + 148, ' ', 8);
+    block[156] = type;
+    memcpy(block + 257, "ustar", 6);
+    memcpy(block + 263, "00", 2);
+    
+    unsigned checksum = 0;
+    for (unsigned char c : block) {
+        checksum += c;
+    }
+    snprintf(block + 148, 8, "%06o", checksum);
+    block[155] = ' ';
+    out.append(block, sizeof(block));
+}
+
+} // namespace
+
+ArchiveStream::ArchiveStream(Format format, std::vector<std::shared_ptr<const SharedFile>> files)
+    : format_(format) {
+    std::unordered_set<std::string> names;
+    entries_.reserve(files.size());
+    for (auto& file : files) {
+        // Entry names are flat: no directories, no duplicates
+        std::string name = file->displayName;
+        for (char& c : name) {
+            if (c == '/' || c == '\\') c = '_';
+        }
+        if (name.empty()) {
+            name = "file";
+        }
+        std::string unique = name;
+        for (int n = 1; !names.insert(unique).second; n++) {
+            size_t dot = name.rfind('.');
+            unique = dot == std::string::npos || dot == 0
+                ? name + " (" + std::to_string(n) + ")"
+                : name.substr(0, dot) + " (" + std::to_string(n) + ")" + name.substr(dot);
+        }
+        
+        Entry entry;
+        entry.size = file->size;
+        entry.mtime = file->mtime > 0 ? file->mtime : time(nullptr);
+        entry.file = std::move(file);
+        entry.name = std::move(unique);
+        entry.headerOffset = 0;
+        entry.crc = 0;
+        entry.zip64 = entry.size >= ZIP32_LIMIT;
+        entries_.push_back(std::move(entry));
+    }
+    
+    // Lay the archive out once so the length is exact before anything is sent
+    uint64_t offset = 0;
+    for (Entry& entry : entries_) {
+        entry.headerOffset = offset;
+        if (format_ == Format::Zip) {
+            offset += zipLocalHeaderSize(entry) + entry.size + zipDescriptorSize(entry);
+        } else {
+            offset += tarHeadersSize(entry) + entry.size + tarPadding(entry.size);
+        }
+    }
+    centralDirectoryOffset_ = offset;
+    totalLength_ = offset + (format_ == Format::Zip ? zipCentralDirectorySize() : 2 * TAR_BLOCK);
+    crc_ = crc32(0, nullptr, 0);
+}
+
+bool ArchiveStream::next(Segment& out) {
+    out.bytes.clear();
+    out.file.reset();
+    out.length = 0;
+    if (finished_) {
+        return false;
+    }
+    
+    // Close off the entry whose data just went out
+    if (nextEntry_ > 0) {
+        Entry& previous = entries_[nextEntry_ - 1];
+        if (format_ == Format::Zip) {
+            previous.crc = crc_;
+            appendZipDescriptor(out.bytes, previous);
+        } else {
+            out.bytes.append(tarPadding(previous.size), '\0');
+        }
+    }
+    
+    if (nextEntry_ < entries_.size()) {
+        const Entry& entry = entries_[nextEntry_++];
+        if (format_ == Format::Zip) {
+            appendZipLocalHeader(out.bytes, entry);
+        } else {
+            appendTarHeaders(out.bytes, entry);
+        }
+        out.file = entry.file;
+        out.length = entry.size;
+        crc_ = crc32(0, nullptr, 0);
+        return true;
+    }
+    
+    if (format_ == Format::Zip) {
+        appendZipCentralDirectory(out.bytes);
+    } else {
+        // End of archive: two zero blocks
+        out.bytes.append(2 * TAR_BLOCK, '\0');
+    }
+    finished_ = true;
+    return true;
+}
+
+void ArchiveStream::consume(const char* data, size_t length) {
+    if (format_ == Format::Zip) {
+        crc_ = crc32(crc_, reinterpret_cast<const Bytef*>(data), static_cast<uInt>(length));
+    }
+}
+
+uint64_t ArchiveStream::zipLocalHeaderSize(const Entry& entry) {
+    return 30 + entry.name.size() + (entry.zip64 ? 20 : 0);
+}
+
+uint64_t ArchiveStream::zipDescriptorSize(const Entry& entry) {
+    return entry.zip64 ? 24 : 16;
+}
+
+void ArchiveStream::appendZipLocalHeader(std::string& out, const Entry& entry) const {
+    uint16_t date;
+    uint16_t time;
+    dosDateTime(entry.mtime, date, time);
+    
+    put32(out, ZIP_LOCAL_HEADER_SIG);
+    put16(out, entry.zip64 ? ZIP64_VERSION : ZIP_VERSION);
+    put16(out, ZIP_FLAGS);
+    put16(out, 0);                                  // Stored
+    put16(out, time);
+    put16(out, date);
+    // CRC and sizes come in the data descriptor
+    put32(out, 0);
+    put32(out, entry.zip64 ? ZIP32_LIMIT : 0);
+    put32(out, entry.zip64 ? ZIP32_LIMIT : 0);
+    put16(out, static_cast<uint16_t>(entry.name.size()));
+    put16(out, entry.zip64 ? 20 : 0);
+    out += entry.name;
+    if (entry.zip64) {
+        // Announces 8-byte sizes in the descriptor
+        put16(out, ZIP64_EXTRA_TAG);
+        put16(out, 16);
+        put64(out, 0);
+        put64(out, 0);
+    }
+}
+
+void ArchiveStream::appendZipDescriptor(std::string& out, const Entry& entry) const {
+    put32(out, ZIP_DESCRIPTOR_SIG);
+    put32(out, entry.crc);
+    if (entry.zip64) {
+        put64(out, entry.size);
+        put64(out, entry.size);
+    } else {
+        put32(out, static_cast<uint32_t>(entry.size));
+        put32(out, static_cast<uint32_t>(entry.size));
+    }
+}
+
+uint64_t ArchiveStream::zipCentralDirectorySize() const {
+    uint64_t size = 0;
+    for (const Entry& entry : entries_) {
+        int extraFields = (entry.zip64 ? 2 : 0) + (entry.headerOffset >= ZIP32_LIMIT ? 1 : 0);
+        size += 46 + entry.name.size() + (extraFields > 0 ? 4 + 8 * extraFields : 0);
+    }
+    uint64_t directorySize = size;
+    bool zip64End = entries_.size() >= ZIP16_LIMIT || directorySize >= ZIP32_LIMIT ||
+                    centralDirectoryOffset_ >= ZIP32_LIMIT;
+    return size + (zip64End ? 56 + 20 : 0) + 22;
+}
+
+void ArchiveStream::appendZipCentralDirectory(std::string& out) const {
+    size_t start = out.size();
+    for (const Entry& entry : entries_) {
+        uint16_t date;
+        uint16_t time;
+        dosDateTime(entry.mtime, date, time);
+        bool bigOffset = entry.headerOffset >= ZIP32_LIMIT;
+        int extraFields = (entry.zip64 ? 2 : 0) + (bigOffset ? 1 : 0);
+        bool needs64 = extraFields > 0;
+        
+        put32(out, ZIP_CENTRAL_HEADER_SIG);
+        put16(out, ZIP_MADE_BY_UNIX | (needs64 ? ZIP64_VERSION : ZIP_VERSION));
+        put16(out, needs64 ? ZIP64_VERSION : ZIP_VERSION);
+        put16(out, ZIP_FLAGS);
+        put16(out, 0);
+        put16(out, time);
+        put16(out, date);
+        put32(out, entry.crc);
+        put32(out, clamp32(entry.size));
+        put32(out, clamp32(entry.size));
+        put16(out, static_cast<uint16_t>(entry.name.size()));
+        put16(out, static_cast<uint16_t>(needs64 ? 4 + 8 * extraFields : 0));
+        put16(out, 0);                              // Comment
+        put16(out, 0);                              // Disk
+        put16(out, 0);                              // Internal attributes
+        put32(out, static_cast<uint32_t>(0100644) << 16);  // Regular file, rw-r--r--
+        put32(out, clamp32(entry.headerOffset));
+        out += entry.name;
+        if (needs64) {
+            put16(out, ZIP64_EXTRA_TAG);
+            put16(out, static_cast<uint16_t>(8 * extraFields));
+            if (entry.zip64) {
+                put64(out, entry.size);
+                put64(out, entry.size);
+            }
+            if (bigOffset) {
+                put64(out, entry.headerOffset);
+            }
+        }
+    }
+    uint64_t directorySize = out.size() - start;
+    uint64_t count = entries_.size();
+    
+    if (count >= ZIP16_LIMIT || directorySize >= ZIP32_LIMIT ||
+        centralDirectoryOffset_ >= ZIP32_LIMIT) {
+        uint64_t zip64EndOffset = centralDirectoryOffset_ + directorySize;
+        put32(out, ZIP64_END_SIG);
+        put64(out, 44);                             // Size of the rest of this record
+        put16(out, ZIP_MADE_BY_UNIX | ZIP64_VERSION);
+        put16(out, ZIP64_VERSION);
+        put32(out, 0);
+        put32(out, 0);
+        put64(out, count);
+        put64(out, count);
+        put64(out, directorySize);
+        put64(out, centralDirectoryOffset_);
+        
+        put32(out, ZIP64_LOCATOR_SIG);
+        put32(out, 0);
+        put64(out, zip64EndOffset);
+        put32(out, 1);
+    }
+    
+    put32(out, ZIP_END_SIG);
+    put16(out, 0);
+    put16(out, 0);
+    put16(out, static_cast<uint16_t>(std::min<uint64_t>(count, ZIP16_LIMIT)));
+    put16(out, static_cast<uint16_t>(std::min<uint64_t>(count, ZIP16_LIMIT)));
+    put32(out, clamp32(directorySize));
+    put32(out, clamp32(centralDirectoryOffset_));
+    put16(out, 0);
+}
+
+uint64_t ArchiveStream::tarHeadersSize(const Entry& entry) {
+    std::string records = paxRecords(entry.name, entry.size);
+    uint64_t size = TAR_BLOCK;
+    if (!records.empty()) {
+        size += TAR_BLOCK + records.size() + tarPadding(records.size());
+    }
+    return size;
+}
+
+void ArchiveStream::appendTarHeaders(std::string& out, const Entry& entry) const {
+    // Long, non-ASCII or huge entries get a PAX extended header first
+    std::string records = paxRecords(entry.name, entry.size);
+    if (!records.empty()) {
+        appendUstarHeader(out, "PaxHeaders/" + entry.name, records.size(), entry.mtime, 'x');
+        out += records;
+        out.append(tarPadding(records.size()), '\0');
+    }
+    appendUstarHeader(out, entry.name, entry.size, entry.mtime, '0');
+}
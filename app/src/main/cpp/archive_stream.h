@@ -0,0 +1,71 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <memory>
+#include <cstdint>
+#include <ctime>
+
+struct SharedFile;
+
+// Builds a ZIP (stored, ZIP64 where needed) or ustar/PAX TAR archive of shared
+// files on the fly. Every header, descriptor and the central directory is
+// generated as the stream advances, so nothing is buffered beyond the current
+// header and the exact total length is known before the first byte goes out.
+class ArchiveStream {
+public:
+    enum class Format {
+        Zip,
+        Tar,
+    };
+    
+    // Literal bytes to send, followed by 'length' bytes of 'file' (if set)
+    struct Segment {
+        std::string bytes;
+        std::shared_ptr<const SharedFile> file;
+        uint64_t length = 0;
+    };
+    
+    ArchiveStream(Format format, std::vector<std::shared_ptr<const SharedFile>> files);
+    
+    uint64_t totalLength() const { return totalLength_; }
+    size_t entryCount() const { return entries_.size(); }
+    
+    // The next segment; false once the archive is complete
+    bool next(Segment& out);
+    bool done() const { return finished_; }
+    
+    // ZIP stores a CRC-32 of each entry, so its data has to pass through
+    // consume() on its way out; TAR data can go out zero-copy
+    bool needsData() const { return format_ == Format::Zip; }
+    void consume(const char* data, size_t length);
+    
+private:
+    struct Entry {
+        std::shared_ptr<const SharedFile> file;
+        std::string name;           // Unique within the archive
+        uint64_t size;
+        time_t mtime;
+        uint64_t headerOffset;      // ZIP: where the local header starts
+        uint32_t crc;
+        bool zip64;                 // ZIP: size needs 64-bit fields
+    };
+    
+    void appendZipLocalHeader(std::string& out, const Entry& entry) const;
+    void appendZipDescriptor(std::string& out, const Entry& entry) const;
+    void appendZipCentralDirectory(std::string& out) const;
+    void appendTarHeaders(std::string& out, const Entry& entry) const;
+    
+    static uint64_t zipLocalHeaderSize(const Entry& entry);
+    static uint64_t zipDescriptorSize(const Entry& entry);
+    uint64_t zipCentralDirectorySize() const;
+    static uint64_t tarHeadersSize(const Entry& entry);
+    
+    Format format_;
+    std::vector<Entry> entries_;
+    uint64_t totalLength_ = 0;
+    uint64_t centralDirectoryOffset_ = 0;
+    size_t nextEntry_ = 0;
+    bool finished_ = false;
+    uint32_t crc_ = 0;
+};
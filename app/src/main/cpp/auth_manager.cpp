@@ -1,6 +1,11 @@
 #include "auth_manager.h"
+#include "sha256.h"
 #include <android/log.h>
 #include <algorithm>
+#include <array>
+#include <chrono>
+#include <random>
+#include <cstdlib>
 
 #define LOG_TAG "AuthManager"
 #define LOGI(...) __android_log_print(ANDROID_LOG_INFO, LOG_TAG, __VA_ARGS__)
@@ -11,111 +16,175 @@ AuthManager::AuthManager() : realm_("FileServer") {
 }
 
 void AuthManager::setCredentials(const std::string& username, const std::string& password) {
-    std::lock_guard<std::mutex> lock(mutex_);
-    username_ = username;
-    password_ = password;
+    std::shared_ptr<const Credentials> next;
+    if (!username.empty() && !password.empty()) {
+        auto credentials = std::make_shared<Credentials>();
+        credentials->userPass = username + ":" + password;
+        credentials->authorization = "Basic " + base64Encode(credentials->userPass);
+        std::random_device random;
+        for (int i = 0; i < 32; i++) {
+            credentials->sessionKey.push_back(static_cast<char>(random()));
+        }
+        next = std::move(credentials);
+    }
+    std::atomic_store(&credentials_, next);
     LOGI("Credentials set for user: %s", username.c_str());
 }
 
 bool AuthManager::hasCredentials() const {
-    std::lock_guard<std::mutex> lock(mutex_);
-    return !username_.empty() && !password_.empty();
+    return std::atomic_load(&credentials_) != nullptr;
 }
 
 std::string AuthManager::getAuthRealm() const {
     return realm_;
 }
 
-bool AuthManager::validateCredentials(const std::string& authHeader) const {
-    std::lock_guard<std::mutex> lock(mutex_);
-    
-    // Check if credentials are set
-    if (username_.empty() && password_.empty()) {
+bool AuthManager::validateCredentials(std::string_view authHeader) const {
+    auto credentials = std::atomic_load(&credentials_);
+    if (!credentials) {
         // No auth required
         return true;
     }
     
-    // Expect: "Basic <base64>"
-    const std::string prefix = "Basic ";
-    if (authHeader.length() < prefix.length() ||
-        authHeader.substr(0, prefix.length()) != prefix) {
+    // Every client we know of sends exactly the canonical encoding
+    if (constantTimeEquals(authHeader, credentials->authorization)) {
+        return true;
+    }
+    
+    // Expect: "Basic <base64>", possibly padded with whitespace or missing '='
+    constexpr std::string_view prefix = "Basic ";
+    if (authHeader.substr(0, prefix.size()) != prefix) {
         LOGE("Invalid auth header format");
         return false;
     }
-    
-    std::string encoded = authHeader.substr(prefix.length());
-    // Trim whitespace
-    encoded.erase(0, encoded.find_first_not_of(" \t\r\n"));
-    encoded.erase(encoded.find_last_not_of(" \t\r\n") + 1);
+    std::string_view encoded = authHeader.substr(prefix.size());
+    size_t first = encoded.find_first_not_of(" \t\r\n");
+    size_t last = encoded.find_last_not_of(" \t\r\n");
+    encoded = first == std::string_view::npos ? std::string_view() : encoded.substr(first, last - first + 1);
     
     std::string decoded = base64Decode(encoded);
-    
-    // Expected format: "username:password"
-    size_t colonPos = decoded.find(':');
-    if (colonPos == std::string::npos) {
-        LOGE("Invalid decoded credentials format");
-        return false;
+    if (constantTimeEquals(decoded, credentials->userPass)) {
+        return true;
+    }
+    LOGI("Authentication failed for user: %.*s",
+         static_cast<int>(std::min(decoded.find(':'), decoded.size())), decoded.c_str());
+    return false;
+}
+
+std::string AuthManager::issueSession() const {
+    auto credentials = std::atomic_load(&credentials_);
+    if (!credentials) {
+        return std::string();
+    }
+    std::string expiry = std::to_string(nowSeconds() + SESSION_LIFETIME_SECONDS);
+    return expiry + "." + sessionSignature(*credentials, expiry);
+}
+
+bool AuthManager::validateSession(std::string_view cookieHeader) const {
+    auto credentials = std::atomic_load(&credentials_);
+    if (!credentials) {
+        return true;
     }
     
-    std::string user = decoded.substr(0, colonPos);
-    std::string pass = decoded.substr(colonPos + 1);
-    
-    bool valid = (user == username_ && pass == password_);
-    if (!valid) {
-        LOGI("Authentication failed for user: %s", user.c_str());
+    // Cookie: a=1; fs_session=<expiry>.<signature>; b=2
+    const std::string_view name = SESSION_COOKIE;
+    size_t pos = 0;
+    while ((pos = cookieHeader.find(name, pos)) != std::string_view::npos) {
+        bool atStart = pos == 0 || cookieHeader[pos - 1] == ' ' || cookieHeader[pos - 1] == ';';
+        pos += name.size();
+        if (!atStart || pos >= cookieHeader.size() || cookieHeader[pos] != '=') {
+            continue;
+        }
+        std::string_view value = cookieHeader.substr(pos + 1);
+        value = value.substr(0, value.find(';'));
+        
+        size_t dot = value.find('.');
+        if (dot == std::string_view::npos) {
+            return false;
+        }
+        std::string expiry(value.substr(0, dot));
+        char* end = nullptr;
+        long long expiresAt = strtoll(expiry.c_str(), &end, 10);
+        if (expiry.empty() || *end != '\0' || expiresAt < nowSeconds()) {
+            return false;
+        }
+        return constantTimeEquals(value.substr(dot + 1), sessionSignature(*credentials, expiry));
+    }
+    return false;
+}
+
+std::string AuthManager::sessionSignature(const Credentials& credentials, std::string_view expiry) {
+    return Sha256::toHex(Sha256::hmac(credentials.sessionKey, expiry));
+}
+
+bool AuthManager::constantTimeEquals(std::string_view a, std::string_view b) {
+    // Time depends only on the expected length, never on where the inputs differ
+    uint8_t difference = a.size() == b.size() ? 0 : 1;
+    for (size_t i = 0; i < b.size(); i++) {
+        uint8_t c = i < a.size() ? static_cast<uint8_t>(a[i]) : 0;
+        difference |= c ^ static_cast<uint8_t>(b[i]);
     }
-    return valid;
+    return difference == 0;
 }
 
-bool AuthManager::isBase64Char(unsigned char c) {
-    return (isalnum(c) || c == '+' || c == '/');
+int64_t AuthManager::nowSeconds() {
+    return std::chrono::duration_cast<std::chrono::seconds>(
+        std::chrono::system_clock::now().time_since_epoch()).count();
 }
 
-std::string AuthManager::base64Decode(const std::string& encoded) {
-    static const std::string base64_chars =
+std::string AuthManager::base64Encode(std::string_view input) {
+    static const char alphabet[] =
         "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
-    
-    std::string decoded;
-    int in_len = encoded.size();
-    int i = 0;
-    int in_ = 0;
-    unsigned char char_array_4[4], char_array_3[3];
-    
-    while (in_len-- && encoded[in_] != '=' && isBase64Char(encoded[in_])) {
-        char_array_4[i++] = encoded[in_++];
-        if (i == 4) {
-            for (i = 0; i < 4; i++) {
-                char_array_4[i] = base64_chars.find(char_array_4[i]);
-            }
-            
-            char_array_3[0] = (char_array_4[0] << 2) + ((char_array_4[1] & 0x30) >> 4);
-            char_array_3[1] = ((char_array_4[1] & 0xf) << 4) + ((char_array_4[2] & 0x3c) >> 2);
-            char_array_3[2] = ((char_array_4[2] & 0x3) << 6) + char_array_4[3];
-            
-            for (i = 0; i < 3; i++) {
-                decoded += char_array_3[i];
-            }
-            i = 0;
+    std::string out;
+    out.reserve((input.size() + 2) / 3 * 4);
+    size_t i = 0;
+    for (; i + 2 < input.size(); i += 3) {
+        uint32_t n = (uint8_t(input[i]) << 16) | (uint8_t(input[i + 1]) << 8) | uint8_t(input[i + 2]);
+        out += alphabet[n >> 18];
+        out += alphabet[(n >> 12) & 63];
+        out += alphabet[(n >> 6) & 63];
+        out += alphabet[n & 63];
+    }
+    if (i < input.size()) {
+        uint32_t n = uint8_t(input[i]) << 16;
+        if (i + 1 < input.size()) {
+            n |= uint8_t(input[i + 1]) << 8;
         }
+        out += alphabet[n >> 18];
+        out += alphabet[(n >> 12) & 63];
+        out += i + 1 < input.size() ? alphabet[(n >> 6) & 63] : '=';
+        out += '=';
     }
-    
-    if (i) {
-        for (int j = i; j < 4; j++) {
-            char_array_4[j] = 0;
+    return out;
+}
+
+std::string AuthManager::base64Decode(std::string_view encoded) {
+    // 0xff marks bytes outside the alphabet; decoding stops at the first one
+    static const auto table = [] {
+        std::array<uint8_t, 256> t;
+        t.fill(0xff);
+        const char alphabet[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+        for (uint8_t i = 0; i < 64; i++) {
+            t[static_cast<uint8_t>(alphabet[i])] = i;
         }
-        
-        for (int j = 0; j < 4; j++) {
-            char_array_4[j] = base64_chars.find(char_array_4[j]);
+        return t;
+    }();
+    
+    std::string decoded;
+    decoded.reserve(encoded.size() / 4 * 3 + 2);
+    uint32_t bits = 0;
+    int bitCount = 0;
+    for (char c : encoded) {
+        uint8_t value = table[static_cast<uint8_t>(c)];
+        if (value == 0xff) {
+            break;
         }
-        
-        char_array_3[0] = (char_array_4[0] << 2) + ((char_array_4[1] & 0x30) >> 4);
-        char_array_3[1] = ((char_array_4[1] & 0xf) << 4) + ((char_array_4[2] & 0x3c) >> 2);
-        char_array_3[2] = ((char_array_4[2] & 0x3) << 6) + char_array_4[3];
-        
-        for (int j = 0; j < i - 1; j++) {
-            decoded += char_array_3[j];
+        bits = (bits << 6) | value;
+        bitCount += 6;
+        if (bitCount >= 8) {
+            bitCount -= 8;
+            decoded.push_back(static_cast<char>((bits >> bitCount) & 0xff));
         }
     }
-    
     return decoded;
 }
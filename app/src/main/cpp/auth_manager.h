@@ -1,24 +1,44 @@
 #pragma once
 
 #include <string>
-#include <mutex>
+#include <string_view>
+#include <memory>
+#include <cstdint>
 
 class AuthManager {
 public:
+    // Cookie handed out after a successful Basic login; clients that keep it can
+    // drop Authorization until it expires
+    static constexpr const char* SESSION_COOKIE = "fs_session";
+    static constexpr int64_t SESSION_LIFETIME_SECONDS = 12 * 60 * 60;
+    
     AuthManager();
     ~AuthManager() = default;
     
     void setCredentials(const std::string& username, const std::string& password);
-    bool validateCredentials(const std::string& authHeader) const;
+    bool validateCredentials(std::string_view authHeader) const;
     bool hasCredentials() const;
     std::string getAuthRealm() const;
     
+    // Cookie value for a new session, "<expiry>.<hex HMAC>"; empty without credentials
+    std::string issueSession() const;
+    // Whether a Cookie header carries an unexpired session signed with the current key
+    bool validateSession(std::string_view cookieHeader) const;
+    
 private:
-    static std::string base64Decode(const std::string& encoded);
-    static bool isBase64Char(unsigned char c);
+    // Published whole by setCredentials(), so requests check it without locking
+    struct Credentials {
+        std::string authorization;  // Expected "Basic <base64>" header value
+        std::string userPass;       // "user:pass", for clients that encode differently
+        std::string sessionKey;     // Random per setCredentials(): new credentials end old sessions
+    };
+    
+    static std::string base64Encode(std::string_view input);
+    static std::string base64Decode(std::string_view encoded);
+    static bool constantTimeEquals(std::string_view a, std::string_view b);
+    static std::string sessionSignature(const Credentials& credentials, std::string_view expiry);
+    static int64_t nowSeconds();
     
-    mutable std::mutex mutex_;
-    std::string username_;
-    std::string password_;
+    std::shared_ptr<const Credentials> credentials_;    // Accessed with std::atomic_load/store
     std::string realm_;
 };
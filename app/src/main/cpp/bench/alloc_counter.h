@@ -0,0 +1,6 @@
+#pragma once
+
+#include <cstdint>
+
+// Heap allocations made through any form of operator new on the calling thread
+uint64_t threadAllocations();
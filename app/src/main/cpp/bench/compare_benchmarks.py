@@ -0,0 +1,85 @@
+#!/usr/bin/env python3
+"""Compares two Google Benchmark JSON outputs and flags regressions.
+
+    compare_benchmarks.py baseline.json current.json [--threshold 0.10] [--metric cpu_time]
+
+Each benchmark present in both files is compared on its median when the runs
+used --benchmark_repetitions, otherwise on its single result. Exits with 1 if
+any benchmark got slower than the threshold allows, so CI can gate on it.
+Store a baseline by keeping a run's --benchmark_out file from the same machine.
+"""
+
+import argparse
+import json
+import sys
+
+
+def load(path, metric):
+    with open(path) as f:
+        data = json.load(f)
+    plain = {}
+    medians = {}
+    for run in data.get("benchmarks", []):
+        if run.get("error_occurred"):
+            continue
+        name = run.get("run_name", run["name"])
+        # Normalize to nanoseconds whatever time_unit was used
+        scale = {"ns": 1, "us": 1e3, "ms": 1e6, "s": 1e9}[run.get("time_unit", "ns")]
+        value = run[metric] * scale
+        if run.get("run_type") == "aggregate":
+            if run.get("aggregate_name") == "median":
+                medians[name] = value
+        else:
+            plain.setdefault(name, value)
+    plain.update(medians)
+    return plain
+
+
+def format_ns(ns):
+    for unit, scale in (("s", 1e9), ("ms", 1e6), ("us", 1e3)):
+        if ns >= scale:
+            return "%.3g %s" % (ns / scale, unit)
+    return "%.3g ns" % ns
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    parser.add_argument("baseline")
+    parser.add_argument("current")
+    parser.add_argument("--threshold", type=float, default=0.10,
+                        help="allowed slowdown as a fraction (default 0.10)")
+    parser.add_argument("--metric", choices=("real_time", "cpu_time"), default="real_time")
+    args = parser.parse_args()
+
+    baseline = load(args.baseline, args.metric)
+    current = load(args.current, args.metric)
+    names = [name for name in current if name in baseline]
+    if not names:
+        print("No benchmarks in common")
+        return 1
+
+    width = max(len(name) for name in names)
+    regressions = 0
+    print("%-*s %12s %12s %9s" % (width, "Benchmark", "Baseline", "Current", "Change"))
+    for name in names:
+        change = current[name] / baseline[name] - 1 if baseline[name] > 0 else 0.0
+        flag = ""
+        if change > args.threshold:
+            flag = "  REGRESSION"
+            regressions += 1
+        elif change < -args.threshold:
+            flag = "  faster"
+        print("%-*s %12s %12s %+8.1f%%%s" % (width, name, format_ns(baseline[name]),
+                                              format_ns(current[name]), change * 100, flag))
+    for name in sorted(set(baseline) - set(current)):
+        print("%-*s only in baseline" % (width, name))
+
+    if regressions:
+        print("\n%d of %d benchmarks regressed by more than %.0f%%" %
+              (regressions, len(names), args.threshold * 100))
+        return 1
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
@@ -0,0 +1,64 @@
+# Turns the web frontend into a header of constant byte arrays at build time:
+# the raw file, gzip and zstd variants, and a strong ETag for each.
+#
+# Usage: cmake -DINPUT=<index.html> -DOUTPUT=<web_assets.h> -DWORK_DIR=<dir> -P embed_web_assets.cmake
+#
+# CMake's own archive support does the compression, so no host tools beyond
+# CMake itself are needed (it has no brotli encoder, hence zstd).
+
+cmake_minimum_required(VERSION 3.19)
+
+if(NOT INPUT OR NOT OUTPUT OR NOT WORK_DIR)
+    message(FATAL_ERROR "INPUT, OUTPUT and WORK_DIR are required")
+endif()
+
+file(MAKE_DIRECTORY "${WORK_DIR}")
+get_filename_component(input_name "${INPUT}" NAME)
+configure_file("${INPUT}" "${WORK_DIR}/${input_name}" COPYONLY)
+
+# "raw" archives are a single compressed stream without any container
+file(ARCHIVE_CREATE OUTPUT "${WORK_DIR}/${input_name}.gz"
+     PATHS "${WORK_DIR}/${input_name}"
+     FORMAT raw COMPRESSION GZip COMPRESSION_LEVEL 9)
+file(ARCHIVE_CREATE OUTPUT "${WORK_DIR}/${input_name}.zst"
+     PATHS "${WORK_DIR}/${input_name}"
+     FORMAT raw COMPRESSION Zstd COMPRESSION_LEVEL 9)
+
+# Emits "inline constexpr unsigned char <name>[] = {...};"
+function(append_byte_array out_var name path)
+    file(READ "${path}" hex HEX)
+    string(LENGTH "${hex}" hex_length)
+    math(EXPR size "${hex_length} / 2")
+    string(REGEX REPLACE "([0-9a-f][0-9a-f])" "0x\\1," bytes "${hex}")
+    # Wrap every 16 bytes; CMake regexes have no {n}, so spell the repetition out
+    string(REPEAT "0x..," 16 line_pattern)
+    string(REGEX REPLACE "(${line_pattern})" "\\1\n    " bytes "${bytes}")
+    set(${out_var} "${${out_var}}inline constexpr unsigned char ${name}[${size}] = {\n    ${bytes}\n};\n\n" PARENT_SCOPE)
+endfunction()
+
+# Strong ETag per variant: the source digest plus the coding, so it is stable
+# across rebuilds even though compressed streams may embed timestamps
+function(append_etag out_var name digest suffix)
+    set(${out_var} "${${out_var}}inline constexpr char ${name}[] = \"\\\"${digest}${suffix}\\\"\";\n" PARENT_SCOPE)
+endfunction()
+
+set(content "// Generated by embed_web_assets.cmake from ${input_name}. Do not edit.\n")
+string(APPEND content "#pragma once\n\nnamespace WebAssets {\n\n")
+append_byte_array(content kIndexHtml "${WORK_DIR}/${input_name}")
+append_byte_array(content kIndexHtmlGzip "${WORK_DIR}/${input_name}.gz")
+append_byte_array(content kIndexHtmlZstd "${WORK_DIR}/${input_name}.zst")
+file(SHA256 "${INPUT}" digest)
+string(SUBSTRING "${digest}" 0 32 digest)
+append_etag(content kIndexHtmlEtag "${digest}" "")
+append_etag(content kIndexHtmlGzipEtag "${digest}" "-gzip")
+append_etag(content kIndexHtmlZstdEtag "${digest}" "-zstd")
+string(APPEND content "\n} // namespace WebAssets\n")
+
+# Only touch the header when it changes so dependents don't rebuild needlessly
+set(previous "")
+if(EXISTS "${OUTPUT}")
+    file(READ "${OUTPUT}" previous)
+endif()
+if(NOT previous STREQUAL content)
+    file(WRITE "${OUTPUT}" "${content}")
+endif()
@@ -0,0 +1,223 @@
+#include "compression_cache.h"
+#include "file_manager.h"
+#include "sha256.h"
+
+#include <sys/stat.h>
+#include <dirent.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <cerrno>
+#include <cstring>
+#include <algorithm>
+#include <atomic>
+#include <vector>
+#include <android/log.h>
+
+#define LOG_TAG "CompressionCache"
+#define LOGI(...) __android_log_print(ANDROID_LOG_INFO, LOG_TAG, __VA_ARGS__)
+#define LOGE(...) __android_log_print(ANDROID_LOG_ERROR, LOG_TAG, __VA_ARGS__)
+
+namespace {
+
+const char TEMP_PREFIX[] = ".tmp-";
+
+} // namespace
+
+CompressionCache::Writer::~Writer() {
+    if (fd_ >= 0) {
+        close(fd_);
+        unlink(tempPath_.c_str());
+    }
+}
+
+bool CompressionCache::Writer::write(const char* data, size_t length) {
+    if (fd_ < 0) {
+        return false;
+    }
+    size_ += length;
+    if (size_ > limit_) {
+        return false;
+    }
+    while (length > 0) {
+        ssize_t written = ::write(fd_, data, length);
+        if (written < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return false;
+        }
+        data += written;
+        length -= written;
+    }
+    return true;
+}
+
+CompressionCache::CompressionCache()
+    : maxBytes_(DEFAULT_MAX_BYTES), totalBytes_(0), useClock_(0) {
+}
+
+void CompressionCache::configure(const std::string& directory, int64_t maxBytes) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (maxBytes > 0) {
+        maxBytes_ = maxBytes;
+    }
+    if (directory != directory_) {
+        directory_ = directory;
+        entries_.clear();
+        totalBytes_ = 0;
+        useClock_ = 0;
+        if (!directory_.empty()) {
+            if (mkdir(directory_.c_str(), 0700) < 0 && errno != EEXIST) {
+                LOGE("Cannot create %s: %s", directory_.c_str(), strerror(errno));
+                directory_.clear();
+                return;
+            }
+            loadLocked();
+        }
+    }
+    evictLocked();
+}
+
+std::string CompressionCache::keyFor(const SharedFile& file, const char* encoding) {
+    if (!file.seekable || file.mtime <= 0) {
+        return std::string();
+    }
+    // Where the content lives plus its size and date. SAF shares have no path;
+    // the file behind their descriptor does the job (names can repeat).
+    std::string location = file.path;
+    if (location.empty()) {
+        struct stat st;
+        if (file.fd < 0 || fstat(file.fd, &st) < 0) {
+            return std::string();
+        }
+        location = "fd:" + std::to_string(st.st_dev) + ":" + std::to_string(st.st_ino) + ":" +
+                   std::to_string(st.st_mtim.tv_nsec);
+    }
+    Sha256 hasher;
+    hasher.update(location);
+    hasher.update(std::string_view("\0", 1));
+    hasher.update(std::to_string(file.size) + "-" + std::to_string(file.mtime));
+    return Sha256::toHex(hasher.finish()).substr(0, 32) + "." + encoding;
+}
+
+int CompressionCache::open(const std::string& key, off_t& outSize) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto it = entries_.find(key);
+    if (directory_.empty() || it == entries_.end()) {
+        return -1;
+    }
+    
+    int fd = ::open((directory_ + "/" + key).c_str(), O_RDONLY | O_CLOEXEC);
+    struct stat st;
+    if (fd < 0 || fstat(fd, &st) < 0) {
+        // Removed behind our back
+        if (fd >= 0) {
+            close(fd);
+        }
+        totalBytes_ -= it->second.size;
+        entries_.erase(it);
+        return -1;
+    }
+    // The file's mtime carries recency across restarts
+    futimens(fd, nullptr);
+    it->second.lastUse = ++useClock_;
+    outSize = st.st_size;
+    return fd;
+}
+
+std::unique_ptr<CompressionCache::Writer> CompressionCache::create(const std::string& key) {
+    static std::atomic<uint32_t> tempSequence(0);
+    
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (directory_.empty() || key.empty()) {
+        return nullptr;
+    }
+    auto writer = std::make_unique<Writer>();
+    writer->name_ = key;
+    writer->tempPath_ = directory_ + "/" + TEMP_PREFIX + key + "-" +
+                        std::to_string(getpid()) + "-" + std::to_string(tempSequence++);
+    // A single variant may not take more than half the budget
+    writer->limit_ = maxBytes_ / 2;
+    writer->fd_ = ::open(writer->tempPath_.c_str(), O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC, 0600);
+    if (writer->fd_ < 0) {
+        LOGE("Cannot create %s: %s", writer->tempPath_.c_str(), strerror(errno));
+        return nullptr;
+    }
+    return writer;
+}
+
+void CompressionCache::commit(std::unique_ptr<Writer> writer) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (!writer || writer->fd_ < 0 || writer->size_ > writer->limit_ ||
+        directory_.empty() || writer->tempPath_.compare(0, directory_.size(), directory_) != 0) {
+        // Failed, too big, or the cache moved meanwhile; the destructor removes it
+        return;
+    }
+    
+    close(writer->fd_);
+    writer->fd_ = -1;
+    if (rename(writer->tempPath_.c_str(), (directory_ + "/" + writer->name_).c_str()) < 0) {
+        LOGE("Cannot store %s: %s", writer->name_.c_str(), strerror(errno));
+        unlink(writer->tempPath_.c_str());
+        return;
+    }
+    
+    // A concurrent compression of the same file may have got there first
+    Entry& entry = entries_[writer->name_];
+    totalBytes_ -= entry.size;
+    entry.size = writer->size_;
+    entry.lastUse = ++useClock_;
+    totalBytes_ += entry.size;
+    evictLocked();
+}
+
+void CompressionCache::loadLocked() {
+    DIR* dir = opendir(directory_.c_str());
+    if (!dir) {
+        return;
+    }
+    
+    // Oldest first, so recency order survives a restart
+    std::vector<std::pair<time_t, std::string>> found;
+    while (struct dirent* item = readdir(dir)) {
+        std::string name = item->d_name;
+        if (name == "." || name == "..") {
+            continue;
+        }
+        std::string path = directory_ + "/" + name;
+        if (name.compare(0, sizeof(TEMP_PREFIX) - 1, TEMP_PREFIX) == 0) {
+            // Left over from a transfer that never finished
+            unlink(path.c_str());
+            continue;
+        }
+        struct stat st;
+        if (stat(path.c_str(), &st) == 0 && S_ISREG(st.st_mode)) {
+            found.emplace_back(st.st_mtime, name);
+            entries_[name] = {static_cast<uint64_t>(st.st_size), 0};
+            totalBytes_ += st.st_size;
+        }
+    }
+    closedir(dir);
+    
+    std::sort(found.begin(), found.end());
+    for (const auto& item : found) {
+        entries_[item.second].lastUse = ++useClock_;
+    }
+    LOGI("%zu cached variants, %llu bytes", entries_.size(),
+         static_cast<unsigned long long>(totalBytes_));
+}
+
+void CompressionCache::evictLocked() {
+    while (totalBytes_ > maxBytes_ && !entries_.empty()) {
+        auto oldest = entries_.begin();
+        for (auto it = entries_.begin(); it != entries_.end(); ++it) {
+            if (it->second.lastUse < oldest->second.lastUse) {
+                oldest = it;
+            }
+        }
+        // Transfers that already opened it keep reading the unlinked file
+        unlink((directory_ + "/" + oldest->first).c_str());
+        totalBytes_ -= oldest->second.size;
+        entries_.erase(oldest);
+    }
+}
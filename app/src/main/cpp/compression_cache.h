@@ -0,0 +1,67 @@
+#pragma once
+
+#include <string>
+#include <unordered_map>
+#include <memory>
+#include <mutex>
+#include <cstdint>
+#include <sys/types.h>
+
+struct SharedFile;
+
+// Size-bounded directory of compressed variants of shared files. A variant is
+// written while its first compressed response streams out and served with
+// sendfile from then on; the least recently used ones are evicted first.
+class CompressionCache {
+public:
+    // A variant being written; discarded unless handed to commit()
+    class Writer {
+    public:
+        ~Writer();
+        
+        // False once writing has failed or the variant outgrew the cache
+        bool write(const char* data, size_t length);
+    
+    private:
+        friend class CompressionCache;
+        
+        int fd_ = -1;
+        std::string tempPath_;
+        std::string name_;
+        uint64_t size_ = 0;
+        uint64_t limit_ = 0;
+    };
+    
+    CompressionCache();
+    
+    // Empty directory disables the cache; maxBytes <= 0 keeps the current budget
+    void configure(const std::string& directory, int64_t maxBytes);
+    
+    // Cache key for a file's content in the given encoding; empty when the file
+    // has no stable identity (streams, unknown modification time)
+    static std::string keyFor(const SharedFile& file, const char* encoding);
+    
+    // Opens a cached variant; returns -1 on a miss
+    int open(const std::string& key, off_t& outSize);
+    
+    std::unique_ptr<Writer> create(const std::string& key);
+    void commit(std::unique_ptr<Writer> writer);
+    
+private:
+    struct Entry {
+        uint64_t size;
+        uint64_t lastUse;
+    };
+    
+    void loadLocked();
+    void evictLocked();
+    
+    std::mutex mutex_;
+    std::string directory_;
+    uint64_t maxBytes_;
+    uint64_t totalBytes_;
+    uint64_t useClock_;
+    std::unordered_map<std::string, Entry> entries_;
+    
+    static constexpr int64_t DEFAULT_MAX_BYTES = 256LL << 20;
+};
@@ -0,0 +1,329 @@
+#include "content_hasher.h"
+#include "xxhash64.h"
+
+#include <sys/stat.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <android/log.h>
+#include <algorithm>
+#include <chrono>
+#include <cerrno>
+#include <cinttypes>
+#include <cstdio>
+#include <cstring>
+
+#define LOG_TAG "ContentHasher"
+#define LOGI(...) __android_log_print(ANDROID_LOG_INFO, LOG_TAG, __VA_ARGS__)
+#define LOGE(...) __android_log_print(ANDROID_LOG_ERROR, LOG_TAG, __VA_ARGS__)
+
+ContentHasher::Job::~Job() {
+    if (ownsFd && fd >= 0) {
+        close(fd);
+    }
+}
+
+ContentHasher::ContentHasher(bool sha256, const std::string& cacheDirectory,
+                             std::function<void()> published)
+    : sha256_(sha256),
+      cachePath_(cacheDirectory.empty() ? std::string() : cacheDirectory + "/" + CACHE_FILE),
+      published_(std::move(published)) {
+    if (!cacheDirectory.empty()) {
+        mkdir(cacheDirectory.c_str(), 0700);
+        loadCache();
+    }
+    
+    // Half the cores: enough to saturate flash without starving the event loops
+    unsigned workerCount = std::max(1u, std::thread::hardware_concurrency() / 2);
+    for (unsigned i = 0; i < workerCount; i++) {
+        workers_.emplace_back(&ContentHasher::workerLoop, this, static_cast<int>(i));
+    }
+    LOGI("Content hashing on: %u workers, SHA-256 %s, cache %s", workerCount,
+         sha256_ ? "on" : "off", cachePath_.empty() ? "none" : cachePath_.c_str());
+}
+
+ContentHasher::~ContentHasher() {
+    {
+        std::lock_guard<std::mutex> lock(queueMutex_);
+        stopping_ = true;
+        queue_.clear();
+    }
+    queueReady_.notify_all();
+    for (std::thread& worker : workers_) {
+        worker.join();
+    }
+    if (cacheFd_ >= 0) {
+        close(cacheFd_);
+    }
+}
+
+void ContentHasher::setThrottle(std::function<bool()> busy) {
+    std::lock_guard<std::mutex> lock(throttleMutex_);
+    busy_ = std::move(busy);
+}
+
+bool ContentHasher::busy() {
+    std::lock_guard<std::mutex> lock(throttleMutex_);
+    return busy_ && busy_();
+}
+
+std::string ContentHasher::treeHex(uint64_t tree) {
+    char buffer[17];
+    snprintf(buffer, sizeof(buffer), "%016" PRIx64, tree);
+    return buffer;
+}
+
+void ContentHasher::submit(const std::shared_ptr<const SharedFile>& file) {
+    if (!file->seekable || std::atomic_load(&file->digest)) {
+        return;
+    }
+    
+    auto job = std::make_shared<Job>();
+    job->file = file;
+    if (file->fd >= 0) {
+        // The entry keeps its fd open while the job holds it; reads are positional
+        job->fd = file->fd;
+    } else {
+        job->fd = open(file->path.c_str(), O_RDONLY | O_CLOEXEC);
+        job->ownsFd = true;
+    }
+    struct stat st;
+    if (job->fd < 0 || fstat(job->fd, &st) != 0 || !S_ISREG(st.st_mode)) {
+        return;
+    }
+    job->size = static_cast<uint64_t>(st.st_size);
+    char key[96];
+    snprintf(key, sizeof(key), "%llx:%llx:%llx:%lld.%09ld",
+             static_cast<unsigned long long>(st.st_dev), static_cast<unsigned long long>(st.st_ino),
+             static_cast<unsigned long long>(st.st_size), static_cast<long long>(st.st_mtim.tv_sec),
+             static_cast<long>(st.st_mtim.tv_nsec));
+    job->key = key;
+    
+    bool remembered = false;
+    {
+        std::lock_guard<std::mutex> lock(cacheMutex_);
+        auto cached = cache_.find(job->key);
+        if (cached != cache_.end() && (cached->second.hasSha256 || !sha256_)) {
+            std::atomic_store(&file->digest, std::make_shared<const FileDigest>(cached->second));
+            remembered = true;
+        }
+    }
+    if (remembered) {
+        publish();
+        return;
+    }
+    
+    size_t chunkCount = std::max<uint64_t>(1, (job->size + CHUNK_SIZE - 1) / CHUNK_SIZE);
+    job->leaves.resize(chunkCount);
+    job->remaining = static_cast<int>(chunkCount) + (sha256_ ? 1 : 0);
+    pendingJobs_++;
+    {
+        std::lock_guard<std::mutex> lock(queueMutex_);
+        if (sha256_) {
+            // First, so the one sequential pass starts while the chunks spread out
+            queue_.push_back({job, -1});
+        }
+        for (size_t i = 0; i < chunkCount; i++) {
+            queue_.push_back({job, static_cast<int64_t>(i)});
+        }
+    }
+    queueReady_.notify_all();
+}
+
+void ContentHasher::workerLoop(int index) {
+    // Hashing is housekeeping; serving files comes first
+    setpriority(PRIO_PROCESS, static_cast<id_t>(syscall(SYS_gettid)), 10);
+    std::vector<uint8_t> buffer(READ_SIZE);
+    
+    for (;;) {
+        Item item;
+        {
+            std::unique_lock<std::mutex> lock(queueMutex_);
+            for (;;) {
+                if (stopping_) {
+                    return;
+                }
+                // While transfers run only worker 0 keeps going
+                if (!queue_.empty() && (index == 0 || !busy())) {
+                    break;
+                }
+                queueReady_.wait_for(lock, std::chrono::milliseconds(queue_.empty() ? 1000 : 50));
+            }
+            item = std::move(queue_.front());
+            queue_.pop_front();
+        }
+        
+        Job& job = *item.job;
+        if (!job.failed) {
+            bool ok;
+            if (item.chunk < 0) {
+                Sha256 sha;
+                ok = readRange(buffer.data(), job, 0, job.size, [&sha](const uint8_t* data, size_t length) {
+                    sha.update(data, length);
+                });
+                job.sha256 = sha.finish();
+            } else {
+                uint64_t offset = static_cast<uint64_t>(item.chunk) * CHUNK_SIZE;
+                uint64_t length = std::min<uint64_t>(CHUNK_SIZE, job.size - std::min(job.size, offset));
+                Xxh64 xxh(static_cast<uint64_t>(item.chunk));
+                ok = readRange(buffer.data(), job, offset, length, [&xxh](const uint8_t* data, size_t length) {
+                    xxh.update(data, length);
+                });
+                job.leaves[item.chunk] = xxh.finish();
+            }
+            if (!ok) {
+                job.failed = true;
+            }
+        }
+        if (job.remaining.fetch_sub(1) == 1) {
+            finish(job);
+        }
+    }
+}
+
+template <typename Feed>
+bool ContentHasher::readRange(uint8_t* buffer, const Job& job, uint64_t offset, uint64_t length,
+                              Feed feed) {
+    while (length > 0) {
+        if (stopping_) {
+            return false;
+        }
+        size_t want = static_cast<size_t>(std::min<uint64_t>(READ_SIZE, length));
+        ssize_t n = pread(job.fd, buffer, want, static_cast<off_t>(offset));
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            return false;
+        }
+        feed(buffer, static_cast<size_t>(n));
+        offset += n;
+        length -= n;
+        if (busy()) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(THROTTLED_PAUSE_MS));
+        }
+    }
+    return true;
+}
+
+void ContentHasher::finish(Job& job) {
+    pendingJobs_--;
+    if (job.failed) {
+        if (!stopping_) {
+            LOGE("Could not hash %s", job.file->displayName.c_str());
+            // Flushes anything an earlier publish() held back
+            publish();
+        }
+        return;
+    }
+    
+    Xxh64 root(job.size);
+    for (uint64_t leaf : job.leaves) {
+        uint8_t bytes[8];
+        for (int i = 0; i < 8; i++) {
+            bytes[i] = static_cast<uint8_t>(leaf >> (8 * i));
+        }
+        root.update(bytes, sizeof(bytes));
+    }
+    auto digest = std::make_shared<FileDigest>();
+    digest->tree = root.finish();
+    digest->hasSha256 = sha256_;
+    digest->sha256 = job.sha256;
+    
+    std::atomic_store(&job.file->digest, std::shared_ptr<const FileDigest>(digest));
+    remember(job.key, *digest);
+    LOGI("Hashed %s: %s", job.file->displayName.c_str(), treeHex(digest->tree).c_str());
+    publish();
+}
+
+void ContentHasher::publish() {
+    if (!published_) {
+        return;
+    }
+    int64_t now = std::chrono::duration_cast<std::chrono::milliseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+    if (pendingJobs_.load() > 0 && now - lastPublishMs_.load() < PUBLISH_INTERVAL_MS) {
+        // A later finish publishes this digest along with its own
+        return;
+    }
+    lastPublishMs_ = now;
+    published_();
+}
+
+void ContentHasher::loadCache() {
+    FILE* file = fopen(cachePath_.c_str(), "r");
+    if (file) {
+        char line[256];
+        std::string key;
+        FileDigest digest;
+        while (fgets(line, sizeof(line), file)) {
+            if (parseLine(line, key, digest)) {
+                // Later lines are newer
+                cache_[key] = digest;
+            }
+        }
+        fclose(file);
+    }
+    
+    // Compact: rewrite one line per file, then append from there
+    std::string temporary = cachePath_ + ".tmp";
+    int fd = open(temporary.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+    if (fd >= 0) {
+        std::string contents;
+        for (const auto& entry : cache_) {
+            contents += formatLine(entry.first, entry.second);
+        }
+        bool written = write(fd, contents.data(), contents.size()) == static_cast<ssize_t>(contents.size());
+        close(fd);
+        if (!written || rename(temporary.c_str(), cachePath_.c_str()) != 0) {
+            unlink(temporary.c_str());
+        }
+    }
+    cacheFd_ = open(cachePath_.c_str(), O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0600);
+    if (cacheFd_ < 0) {
+        LOGE("Cannot open digest cache %s: %s", cachePath_.c_str(), strerror(errno));
+    }
+    LOGI("Loaded %zu cached digests", cache_.size());
+}
+
+void ContentHasher::remember(const std::string& key, const FileDigest& digest) {
+    std::lock_guard<std::mutex> lock(cacheMutex_);
+    cache_[key] = digest;
+    if (cacheFd_ >= 0) {
+        // One short O_APPEND write per line, so a crash loses at most that line
+        std::string line = formatLine(key, digest);
+        if (write(cacheFd_, line.data(), line.size()) < 0) {
+            LOGE("Digest cache write failed: %s", strerror(errno));
+        }
+    }
+}
+
+// "<key> <tree hex> <sha-256 hex or ->"
+std::string ContentHasher::formatLine(const std::string& key, const FileDigest& digest) {
+    return key + " " + treeHex(digest.tree) + " " +
+           (digest.hasSha256 ? Sha256::toHex(digest.sha256) : std::string("-")) + "\n";
+}
+
+bool ContentHasher::parseLine(const std::string& line, std::string& key, FileDigest& digest) {
+    char keyText[96];
+    char shaText[65];
+    unsigned long long tree;
+    if (sscanf(line.c_str(), "%95s %16llx %64s", keyText, &tree, shaText) != 3) {
+        return false;
+    }
+    key = keyText;
+    digest.tree = tree;
+    digest.hasSha256 = strlen(shaText) == 64;
+    if (!digest.hasSha256) {
+        return strcmp(shaText, "-") == 0;
+    }
+    for (size_t i = 0; i < digest.sha256.size(); i++) {
+        unsigned value;
+        if (sscanf(shaText + 2 * i, "%2x", &value) != 1) {
+            return false;
+        }
+        digest.sha256[i] = static_cast<uint8_t>(value);
+    }
+    return true;
+}
@@ -0,0 +1,102 @@
+#pragma once
+
+#include "file_manager.h"
+
+#include <string>
+#include <deque>
+#include <vector>
+#include <unordered_map>
+#include <memory>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <thread>
+#include <atomic>
+#include <cstdint>
+
+// Background hashing of shared files.
+//
+// The main hash is a tree XXH64: the file is cut into CHUNK_SIZE pieces, each
+// hashed with XXH64 seeded by its index, and the root is XXH64 over the chunk
+// hashes (little endian) seeded by the file size. Chunks are independent, so a
+// large file is spread over every worker with positional reads. SHA-256, when
+// asked for, needs one sequential pass and runs alongside as its own work item.
+//
+// Workers run at a lowered priority and, while the busy check says transfers
+// are active, drop to a single worker reading at a capped rate.
+//
+// Results are kept by file identity (device, inode, size, mtime) in an
+// append-only log in the cache directory, compacted whenever it is loaded.
+class ContentHasher {
+public:
+    static constexpr size_t CHUNK_SIZE = 4 << 20;
+    
+    // 'published' runs after digests are stored in their entries: at most once per
+    // PUBLISH_INTERVAL_MS while files are being hashed, and once when the last finishes
+    ContentHasher(bool sha256, const std::string& cacheDirectory, std::function<void()> published);
+    ~ContentHasher();
+    
+    void setThrottle(std::function<bool()> busy);
+    
+    // Digests 'file' unless it already has one; a remembered result is applied at once
+    void submit(const std::shared_ptr<const SharedFile>& file);
+    
+    static std::string treeHex(uint64_t tree);
+    
+private:
+    static constexpr size_t READ_SIZE = 1 << 20;
+    static constexpr int THROTTLED_PAUSE_MS = 10;      // Per READ_SIZE while busy: ~100 MB/s
+    static constexpr const char* CACHE_FILE = "digests";
+    // Each publish makes the next /api/files poll re-render the listing
+    static constexpr int64_t PUBLISH_INTERVAL_MS = 1000;
+    
+    struct Job {
+        std::shared_ptr<const SharedFile> file;
+        int fd = -1;
+        bool ownsFd = false;
+        std::string key;                    // Identity for the cache
+        uint64_t size = 0;
+        std::vector<uint64_t> leaves;
+        Sha256::Digest sha256{};
+        std::atomic<int> remaining{0};      // Work items still to finish
+        std::atomic<bool> failed{false};
+        ~Job();
+    };
+    struct Item {
+        std::shared_ptr<Job> job;
+        int64_t chunk = 0;                  // -1: the SHA-256 pass
+    };
+    
+    void workerLoop(int index);
+    // Reads [offset, offset + length) through 'buffer' (READ_SIZE bytes), passing each
+    // piece to 'feed'; false on I/O error, a short file or shutdown
+    template <typename Feed>
+    bool readRange(uint8_t* buffer, const Job& job, uint64_t offset, uint64_t length, Feed feed);
+    bool busy();
+    void finish(Job& job);
+    // Runs published_ unless it ran within PUBLISH_INTERVAL_MS and more jobs are pending
+    void publish();
+    void loadCache();
+    void remember(const std::string& key, const FileDigest& digest);
+    static bool parseLine(const std::string& line, std::string& key, FileDigest& digest);
+    static std::string formatLine(const std::string& key, const FileDigest& digest);
+    
+    const bool sha256_;
+    const std::string cachePath_;           // Empty: no persistence
+    std::function<void()> published_;
+    std::atomic<int> pendingJobs_{0};       // Submitted and not yet finished
+    std::atomic<int64_t> lastPublishMs_{0};
+    
+    std::mutex throttleMutex_;
+    std::function<bool()> busy_;
+    
+    std::mutex cacheMutex_;
+    std::unordered_map<std::string, FileDigest> cache_;
+    int cacheFd_ = -1;
+    
+    std::mutex queueMutex_;
+    std::condition_variable queueReady_;
+    std::deque<Item> queue_;
+    std::atomic<bool> stopping_{false};
+    std::vector<std::thread> workers_;
+};
@@ -0,0 +1,155 @@
+#include "file_listing.h"
+#include "file_manager.h"
+#include "content_hasher.h"
+
+#include <zlib.h>
+#include <android/log.h>
+
+#define LOG_TAG "FileListing"
+#define LOGI(...) __android_log_print(ANDROID_LOG_INFO, LOG_TAG, __VA_ARGS__)
+#define LOGE(...) __android_log_print(ANDROID_LOG_ERROR, LOG_TAG, __VA_ARGS__)
+
+namespace {
+
+// Characters that can be copied into a JSON string as-is
+struct JsonSafeTable {
+    bool safe[256];
+    
+    constexpr JsonSafeTable() : safe() {
+        for (int c = 0x20; c < 256; c++) safe[c] = true;
+        safe[static_cast<unsigned char>('"')] = false;
+        safe[static_cast<unsigned char>('\\')] = false;
+    }
+};
+
+constexpr JsonSafeTable kJsonSafe;
+
+bool gzipCompress(const std::string& input, std::string& output) {
+    z_stream stream = {};
+    // 15 window bits + 16 selects the gzip wrapper
+    if (deflateInit2(&stream, Z_DEFAULT_COMPRESSION, Z_DEFLATED, 15 + 16, 8,
+                     Z_DEFAULT_STRATEGY) != Z_OK) {
+        return false;
+    }
+    output.resize(deflateBound(&stream, input.size()));
+    stream.next_in = reinterpret_cast<Bytef*>(const_cast<char*>(input.data()));
+    stream.avail_in = input.size();
+    stream.next_out = reinterpret_cast<Bytef*>(&output[0]);
+    stream.avail_out = output.size();
+    int result = deflate(&stream, Z_FINISH);
+    output.resize(stream.total_out);
+    deflateEnd(&stream);
+    return result == Z_STREAM_END;
+}
+
+} // namespace
+
+const std::string& FileListing::Rendered::gzip() const {
+    std::call_once(gzipOnce_, [this] {
+        std::string compressed;
+        if (gzipCompress(json, compressed) && compressed.size() < json.size()) {
+            gzip_ = std::move(compressed);
+        }
+        LOGI("Compressed file listing v%llu: %zu -> %zu bytes",
+             static_cast<unsigned long long>(version), json.size(), gzip_.size());
+    });
+    return gzip_;
+}
+
+void FileListing::appendJsonString(std::string& out, std::string_view value) {
+    static const char hex[] = "0123456789abcdef";
+    out.push_back('"');
+    size_t runStart = 0;
+    for (size_t i = 0; i < value.size(); i++) {
+        unsigned char c = value[i];
+        if (kJsonSafe.safe[c]) {
+            continue;
+        }
+        // Flush the run of plain characters before the one that needs escaping
+        out.append(value.data() + runStart, i - runStart);
+        runStart = i + 1;
+        switch (c) {
+            case '"': out.append("\\\""); break;
+            case '\\': out.append("\\\\"); break;
+            case '\b': out.append("\\b"); break;
+            case '\f': out.append("\\f"); break;
+            case '\n': out.append("\\n"); break;
+            case '\r': out.append("\\r"); break;
+            case '\t': out.append("\\t"); break;
+            default: {
+                char escaped[] = {'\\', 'u', '0', '0', hex[c >> 4], hex[c & 0xf]};
+                out.append(escaped, sizeof(escaped));
+                break;
+            }
+        }
+    }
+    out.append(value.data() + runStart, value.size() - runStart);
+    out.push_back('"');
+}
+
+std::shared_ptr<const FileListing::Rendered> FileListing::get(const FileManager& fileManager) {
+    auto current = std::atomic_load(&rendered_);
+    if (current && current->version == fileManager.getVersion() &&
+        current->digests == fileManager.getDigestGeneration()) {
+        return current;
+    }
+    
+    std::lock_guard<std::mutex> lock(rebuildMutex_);
+    
+    // Another request may have rebuilt it while we waited
+    uint64_t digests = fileManager.getDigestGeneration();
+    auto catalog = fileManager.snapshot();
+    current = std::atomic_load(&rendered_);
+    if (current && current->version == catalog->version && current->digests == digests) {
+        return current;
+    }
+    
+    auto next = std::make_shared<Rendered>();
+    next->version = catalog->version;
+    next->digests = digests;
+    std::string tag = "files-" + std::to_string(catalog->version) + "." + std::to_string(digests);
+    next->etag = "\"" + tag + "\"";
+    next->gzipEtag = "\"" + tag + "-gzip\"";
+    
+    std::unordered_map<uint64_t, Fragment> fragments;
+    fragments.reserve(catalog->files.size());
+    next->json.push_back('[');
+    for (const auto& entry : catalog->files) {
+        const SharedFile& file = *entry.second;
+        std::shared_ptr<const FileDigest> digest = std::atomic_load(&file.digest);
+        auto cached = fragments_.find(file.version);
+        Fragment fragment;
+        if (cached != fragments_.end() && cached->second.hashed == (digest != nullptr)) {
+            fragment = std::move(cached->second);
+        } else {
+            fragment.hashed = digest != nullptr;
+            fragment.json = "{\"id\":";
+            appendJsonString(fragment.json, file.id);
+            fragment.json += ",\"name\":";
+            appendJsonString(fragment.json, file.displayName);
+            fragment.json += ",\"size\":" + std::to_string(file.size);
+            if (digest) {
+                fragment.json += ",\"hash\":\"" + ContentHasher::treeHex(digest->tree) + "\"";
+                if (digest->hasSha256) {
+                    fragment.json += ",\"sha256\":\"" + Sha256::toHex(digest->sha256) + "\"";
+                }
+            }
+            fragment.json += "}";
+        }
+        if (next->json.size() > 1) {
+            next->json.push_back(',');
+        }
+        next->json += fragment.json;
+        fragments.emplace(file.version, std::move(fragment));
+    }
+    next->json.push_back(']');
+    // Removed entries drop out here
+    fragments_.swap(fragments);
+    
+    LOGI("Rendered file listing v%llu: %zu entries, %zu bytes",
+         static_cast<unsigned long long>(next->version), catalog->files.size(), next->json.size());
+    
+    current = std::shared_ptr<const Rendered>(std::move(next));
+    std::atomic_store(&rendered_, current);
+    return current;
+}
@@ -0,0 +1,49 @@
+#pragma once
+
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <memory>
+#include <mutex>
+#include <cstdint>
+
+class FileManager;
+
+// The /api/files JSON, rendered once per catalog version and shared by every
+// request until the share set changes again or more content digests come in.
+class FileListing {
+public:
+    struct Rendered {
+        uint64_t version = 0;
+        uint64_t digests = 0;   // FileManager digest generation it includes
+        std::string json;
+        std::string etag;
+        std::string gzipEtag;
+        
+        // Compressed on first use, so rebuilds nobody fetches with gzip cost nothing
+        // extra. Empty if compression failed or didn't pay off.
+        const std::string& gzip() const;
+    
+    private:
+        mutable std::once_flag gzipOnce_;
+        mutable std::string gzip_;
+    };
+    
+    // Current rendering for the manager's latest catalog; only rebuilds after a change
+    std::shared_ptr<const Rendered> get(const FileManager& fileManager);
+    
+    // Appends 'value' as a quoted JSON string. Quotes, backslashes and control
+    // characters are escaped; UTF-8 is passed through untouched.
+    static void appendJsonString(std::string& out, std::string_view value);
+    
+private:
+    std::mutex rebuildMutex_;
+    std::shared_ptr<const Rendered> rendered_;      // Accessed with std::atomic_load/store
+    struct Fragment {
+        bool hashed = false;    // Rendered with the entry's digest
+        std::string json;
+    };
+    // Per-entry JSON objects keyed by the entry's table version, so a single
+    // add/remove re-serializes one entry and the rest is concatenation
+    std::unordered_map<uint64_t, Fragment> fragments_;
+};
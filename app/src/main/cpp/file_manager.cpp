@@ -1,127 +1,260 @@
 #include "file_manager.h"
+#include "mime_types.h"
+#include "content_hasher.h"
 #include <unistd.h>
 #include <fcntl.h>
+#include <sys/stat.h>
 #include <android/log.h>
 
 #define LOG_TAG "FileManager"
 #define LOGI(...) __android_log_print(ANDROID_LOG_INFO, LOG_TAG, __VA_ARGS__)
 #define LOGE(...) __android_log_print(ANDROID_LOG_ERROR, LOG_TAG, __VA_ARGS__)
 
-FileManager::FileManager() {
-    LOGI("FileManager created");
+namespace {
+
+// The entry owns its fd: it is closed when the last reference goes away
+std::shared_ptr<const SharedFile> makeEntry(SharedFile file) {
+    return std::shared_ptr<const SharedFile>(new SharedFile(std::move(file)), [](SharedFile* f) {
+        if (f->fd >= 0) {
+            close(f->fd);
+        }
+        delete f;
+    });
 }
 
-FileManager::~FileManager() {
-    clearFiles();
+// Type by extension; true if that found nothing and the content should be sniffed
+bool typeByName(SharedFile& file, bool sniff) {
+    file.mimeType = std::string(MimeTypes::forName(file.displayName));
+    return sniff && file.seekable && file.mimeType == MimeTypes::DEFAULT_TYPE;
 }
 
-void FileManager::addFile(const std::string& id, const std::string& displayName,
-                          const std::string& path, size_t size) {
-    std::lock_guard<std::mutex> lock(mutex_);
-    
+void sniffType(SharedFile& file, int fd) {
+    std::string_view sniffed = MimeTypes::sniffFile(fd);
+    if (!sniffed.empty()) {
+        file.mimeType = std::string(sniffed);
+    }
+}
+
+SharedFile pathEntry(const std::string& id, const std::string& displayName,
+                     const std::string& path, size_t size, bool sniff) {
     SharedFile file;
     file.id = id;
     file.displayName = displayName;
     file.path = path;
     file.fd = -1;
     file.size = size;
+    struct stat st;
+    if (stat(path.c_str(), &st) == 0) {
+        file.mtime = st.st_mtime;
+        file.seekable = S_ISREG(st.st_mode);
+    }
+    if (typeByName(file, sniff)) {
+        int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+        if (fd >= 0) {
+            sniffType(file, fd);
+            close(fd);
+        }
+    }
+    return file;
+}
+
+} // namespace
+
+FileManager::FileManager() : catalog_(std::make_shared<const FileCatalog>()) {
+    LOGI("FileManager created");
+}
+
+FileManager::~FileManager() {
+    // Workers call back into us; stop them first, outside the lock since that joins them
+    std::shared_ptr<ContentHasher> hasher;
+    {
+        std::lock_guard<std::mutex> lock(hasherMutex_);
+        std::swap(hasher_, hasher);
+    }
+    hasher.reset();
+    clearFiles();
+}
+
+template <typename Mutate>
+void FileManager::update(Mutate mutate) {
+    std::lock_guard<std::mutex> lock(writeMutex_);
     
-    files_[id] = file;
+    // Copying the map only copies entry pointers, never the entries themselves
+    auto next = std::make_shared<FileCatalog>(*std::atomic_load(&catalog_));
+    next->version++;
+    mutate(*next);
+    std::atomic_store(&catalog_, std::shared_ptr<const FileCatalog>(std::move(next)));
+}
+
+void FileManager::addFile(const std::string& id, const std::string& displayName,
+                          const std::string& path, size_t size) {
+    SharedFile file = pathEntry(id, displayName, path, size, sniffContent_);
+    
+    std::shared_ptr<const SharedFile> entry;
+    update([&](FileCatalog& catalog) {
+        file.version = catalog.version;
+        entry = makeEntry(std::move(file));
+        catalog.files[id] = entry;
+    });
     LOGI("Added file: %s (path: %s, size: %zu)", displayName.c_str(), path.c_str(), size);
+    hash(entry);
+}
+
+void FileManager::addFiles(const std::vector<NewFile>& files) {
+    // stat() everything before taking the write lock, then publish one catalog
+    bool sniff = sniffContent_;
+    std::vector<SharedFile> entries;
+    entries.reserve(files.size());
+    for (const NewFile& file : files) {
+        entries.push_back(pathEntry(file.id, file.displayName, file.path, file.size, sniff));
+    }
+    
+    std::vector<std::shared_ptr<const SharedFile>> added;
+    added.reserve(entries.size());
+    update([&](FileCatalog& catalog) {
+        catalog.files.reserve(catalog.files.size() + entries.size());
+        for (SharedFile& entry : entries) {
+            // One version per entry, not per batch: the listing caches each
+            // entry's JSON by its version
+            entry.version = ++catalog.version;
+            std::string id = entry.id;
+            added.push_back(makeEntry(std::move(entry)));
+            catalog.files[id] = added.back();
+        }
+    });
+    LOGI("Added %zu files", files.size());
+    for (const auto& entry : added) {
+        hash(entry);
+    }
 }
 
 void FileManager::addFileDescriptor(const std::string& id, const std::string& displayName,
                                      int fd, size_t size) {
-    std::lock_guard<std::mutex> lock(mutex_);
-    
     SharedFile file;
     file.id = id;
     file.displayName = displayName;
     file.fd = fd;
     file.size = size;
+    struct stat st;
+    if (fstat(fd, &st) == 0) {
+        file.mtime = st.st_mtime;
+        file.seekable = S_ISREG(st.st_mode);
+    }
+    if (typeByName(file, sniffContent_)) {
+        sniffType(file, fd);
+    }
     
-    files_[id] = file;
+    std::shared_ptr<const SharedFile> entry;
+    update([&](FileCatalog& catalog) {
+        file.version = catalog.version;
+        entry = makeEntry(std::move(file));
+        catalog.files[id] = entry;
+    });
     LOGI("Added file descriptor: %s (fd: %d, size: %zu)", displayName.c_str(), fd, size);
+    hash(entry);
 }
 
 void FileManager::removeFile(const std::string& id) {
-    std::lock_guard<std::mutex> lock(mutex_);
-    
-    auto it = files_.find(id);
-    if (it != files_.end()) {
-        if (it->second.fd >= 0) {
-            close(it->second.fd);
-        }
-        files_.erase(it);
+    bool removed = false;
+    update([&](FileCatalog& catalog) {
+        removed = catalog.files.erase(id) > 0;
+    });
+    if (removed) {
         LOGI("Removed file: %s", id.c_str());
     }
 }
 
 void FileManager::clearFiles() {
-    std::lock_guard<std::mutex> lock(mutex_);
-    
-    for (auto& pair : files_) {
-        if (pair.second.fd >= 0) {
-            close(pair.second.fd);
-        }
-    }
-    files_.clear();
+    update([](FileCatalog& catalog) {
+        catalog.files.clear();
+    });
     LOGI("Cleared all files");
 }
 
-std::vector<SharedFile> FileManager::getFiles() const {
-    std::lock_guard<std::mutex> lock(mutex_);
+void FileManager::setContentSniffing(bool enabled) {
+    sniffContent_ = enabled;
+}
+
+void FileManager::setContentHashing(bool enabled, bool sha256, const std::string& cacheDirectory) {
+    std::shared_ptr<ContentHasher> hasher;
+    if (enabled) {
+        hasher = std::make_shared<ContentHasher>(sha256, cacheDirectory, [this] {
+            digestGeneration_.fetch_add(1, std::memory_order_release);
+        });
+    }
+    {
+        std::lock_guard<std::mutex> lock(hasherMutex_);
+        if (hasher) {
+            hasher->setThrottle(throttle_);
+        }
+        std::swap(hasher_, hasher);
+    }
+    // The previous hasher, if any, stops here: outside the lock, since it joins its workers
+    hasher.reset();
+    if (!enabled) {
+        LOGI("Content hashing off");
+        return;
+    }
     
-    std::vector<SharedFile> result;
-    for (const auto& pair : files_) {
-        result.push_back(pair.second);
+    // Files shared before hashing was turned on
+    auto catalog = snapshot();
+    for (const auto& entry : catalog->files) {
+        hash(entry.second);
     }
-    return result;
 }
 
-bool FileManager::getFile(const std::string& id, SharedFile& outFile) const {
-    std::lock_guard<std::mutex> lock(mutex_);
-    
-    auto it = files_.find(id);
-    if (it != files_.end()) {
-        outFile = it->second;
-        return true;
+void FileManager::setHashingThrottle(std::function<bool()> busy) {
+    std::lock_guard<std::mutex> lock(hasherMutex_);
+    throttle_ = busy;
+    if (hasher_) {
+        hasher_->setThrottle(std::move(busy));
     }
-    return false;
 }
 
-bool FileManager::openFile(const std::string& id, int& outFd, size_t& outSize, 
-                           std::string& outName) const {
-    std::lock_guard<std::mutex> lock(mutex_);
-    
-    auto it = files_.find(id);
-    if (it == files_.end()) {
-        LOGE("File not found: %s", id.c_str());
-        return false;
+void FileManager::hash(const std::shared_ptr<const SharedFile>& entry) {
+    std::shared_ptr<ContentHasher> hasher;
+    {
+        std::lock_guard<std::mutex> lock(hasherMutex_);
+        hasher = hasher_;
     }
-    
-    const SharedFile& file = it->second;
-    outSize = file.size;
-    outName = file.displayName;
-    
+    if (hasher && entry) {
+        hasher->submit(entry);
+    }
+}
+
+std::shared_ptr<const FileCatalog> FileManager::snapshot() const {
+    return std::atomic_load(&catalog_);
+}
+
+std::shared_ptr<const SharedFile> FileManager::findFile(const std::string& id) const {
+    auto catalog = snapshot();
+    auto it = catalog->files.find(id);
+    if (it == catalog->files.end()) {
+        return nullptr;
+    }
+    return it->second;
+}
+
+uint64_t FileManager::getVersion() const {
+    return snapshot()->version;
+}
+
+bool FileManager::openFile(const SharedFile& file, int& outFd, bool& outOwned) {
     if (file.fd >= 0) {
-        // Duplicate the file descriptor for serving
-        outFd = dup(file.fd);
-        if (outFd < 0) {
-            LOGE("Failed to dup fd for file: %s", id.c_str());
-            return false;
-        }
-        // Seek to beginning
-        lseek(outFd, 0, SEEK_SET);
+        // No dup()/lseek(): a dup shares the offset anyway, so concurrent
+        // transfers each keep their own cursor and read with pread/sendfile
+        outFd = file.fd;
+        outOwned = false;
     } else if (!file.path.empty()) {
         // Open from path
-        outFd = open(file.path.c_str(), O_RDONLY);
+        outFd = open(file.path.c_str(), O_RDONLY | O_CLOEXEC);
         if (outFd < 0) {
             LOGE("Failed to open file: %s", file.path.c_str());
             return false;
         }
+        outOwned = true;
     } else {
-        LOGE("No valid fd or path for file: %s", id.c_str());
+        LOGE("No valid fd or path for file: %s", file.id.c_str());
         return false;
     }
     
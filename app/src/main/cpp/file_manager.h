@@ -3,7 +3,23 @@
 #include <string>
 #include <vector>
 #include <unordered_map>
+#include <memory>
 #include <mutex>
+#include <atomic>
+#include <functional>
+#include <cstdint>
+#include <ctime>
+
+#include "sha256.h"
+
+class ContentHasher;
+
+// Content hashes of a shared file, filled in by ContentHasher after it is added
+struct FileDigest {
+    uint64_t tree = 0;          // Tree XXH64, see ContentHasher
+    bool hasSha256 = false;
+    Sha256::Digest sha256{};
+};
 
 struct SharedFile {
     std::string id;
@@ -11,10 +27,29 @@ struct SharedFile {
     std::string path;       // File path (for regular files)
     int fd;                 // File descriptor (for SAF files, -1 if not used)
     size_t size;
+    std::string mimeType;   // From the extension, else sniffed when added
+    time_t mtime;           // Modification time when shared, 0 if unknown
+    uint64_t version;       // File-table version at which this entry was added
+    bool seekable;          // Regular file: supports ranges and has stable validators
+    // Set once hashing finishes; accessed with std::atomic_load/store
+    mutable std::shared_ptr<const FileDigest> digest;
     
-    SharedFile() : fd(-1), size(0) {}
+    SharedFile() : fd(-1), size(0), mtime(0), version(0), seekable(false) {}
+};
+
+// An immutable view of the share set. Entries are shared between successive
+// catalogs; an entry's fd is closed only when the last catalog (and any
+// request) holding it lets go, so readers holding the entry can serve straight
+// from that fd with pread/sendfile at explicit offsets, never touching its shared
+// file position.
+struct FileCatalog {
+    uint64_t version = 0;
+    std::unordered_map<std::string, std::shared_ptr<const SharedFile>> files;
 };
 
+// Read-mostly: readers take the current catalog with one atomic load and never
+// block; writers (JNI calls, finished uploads) copy it, modify the copy and
+// publish it.
 class FileManager {
 public:
     FileManager();
@@ -24,16 +59,57 @@ public:
                  const std::string& path, size_t size);
     void addFileDescriptor(const std::string& id, const std::string& displayName, 
                            int fd, size_t size);
+    
+    struct NewFile {
+        std::string id;
+        std::string displayName;
+        std::string path;
+        size_t size;
+    };
+    // Like addFile for each, but publishes a single new catalog: large share
+    // sets would otherwise copy the catalog once per file
+    void addFiles(const std::vector<NewFile>& files);
     void removeFile(const std::string& id);
     void clearFiles();
     
-    std::vector<SharedFile> getFiles() const;
-    bool getFile(const std::string& id, SharedFile& outFile) const;
+    // Whether files added from now on without a known extension get their type
+    // from their first bytes (one small read each, when added). On by default.
+    void setContentSniffing(bool enabled);
+    
+    std::shared_ptr<const FileCatalog> snapshot() const;
+    std::shared_ptr<const SharedFile> findFile(const std::string& id) const;
+    
+    // Bumped on every add/remove/clear; validates cached views of the catalog
+    uint64_t getVersion() const;
     
-    // Read file content - caller must handle file descriptor duplication for SAF files
-    bool openFile(const std::string& id, int& outFd, size_t& outSize, std::string& outName) const;
+    // Hashes seekable files in the background as they are added (and those
+    // already shared when enabled), remembering results in cacheDirectory so
+    // unchanged files are never hashed twice. An empty directory keeps them in
+    // memory only. Off by default.
+    void setContentHashing(bool enabled, bool sha256, const std::string& cacheDirectory);
+    // Hashing backs off while this returns true; the server points it at its bulk transfers
+    void setHashingThrottle(std::function<bool()> busy);
+    // Bumped whenever a digest lands; listings that show digests rebuild on it
+    uint64_t getDigestGeneration() const { return digestGeneration_.load(std::memory_order_acquire); }
+    
+    // Descriptor to serve the file from. Path shares are opened fresh and owned
+    // by the caller; SAF shares hand out the stored fd itself (outOwned false),
+    // which stays valid while the caller holds the entry. Readers must use
+    // positional I/O only: the file offset is shared by everyone serving it.
+    static bool openFile(const SharedFile& file, int& outFd, bool& outOwned);
     
 private:
-    mutable std::mutex mutex_;
-    std::unordered_map<std::string, SharedFile> files_;
+    // Applies 'mutate' to a copy of the current catalog and publishes it
+    template <typename Mutate>
+    void update(Mutate mutate);
+    
+    void hash(const std::shared_ptr<const SharedFile>& entry);
+    
+    std::atomic<bool> sniffContent_{true};
+    std::atomic<uint64_t> digestGeneration_{0};
+    std::mutex hasherMutex_;
+    std::shared_ptr<ContentHasher> hasher_;         // Null while hashing is off
+    std::function<bool()> throttle_;
+    std::mutex writeMutex_;                         // Serializes writers only
+    std::shared_ptr<const FileCatalog> catalog_;    // Accessed with std::atomic_load/store
 };
@@ -0,0 +1,47 @@
+#include "gzip_encoder.h"
+
+namespace {
+
+constexpr size_t OUTPUT_STEP = 1 << 15;
+
+} // namespace
+
+GzipEncoder::GzipEncoder(int level) : stream_() {
+    // 15 window bits + 16 selects the gzip wrapper
+    valid_ = deflateInit2(&stream_, level, Z_DEFLATED, 15 + 16, 8, Z_DEFAULT_STRATEGY) == Z_OK;
+}
+
+GzipEncoder::~GzipEncoder() {
+    if (valid_) {
+        deflateEnd(&stream_);
+    }
+}
+
+bool GzipEncoder::encode(const char* data, size_t length, bool finish, std::string_view& out) {
+    output_.clear();
+    if (!valid_) {
+        return false;
+    }
+    
+    stream_.next_in = reinterpret_cast<Bytef*>(const_cast<char*>(data));
+    stream_.avail_in = static_cast<uInt>(length);
+    int flush = finish ? Z_FINISH : Z_NO_FLUSH;
+    while (true) {
+        size_t used = output_.size();
+        output_.resize(used + OUTPUT_STEP);
+        stream_.next_out = reinterpret_cast<Bytef*>(&output_[used]);
+        stream_.avail_out = OUTPUT_STEP;
+        int result = deflate(&stream_, flush);
+        output_.resize(used + OUTPUT_STEP - stream_.avail_out);
+        if (result == Z_STREAM_ERROR) {
+            valid_ = false;
+            return false;
+        }
+        if (finish ? result == Z_STREAM_END : stream_.avail_out != 0) {
+            // Z_NO_FLUSH leaves space only once all input has been taken
+            break;
+        }
+    }
+    out = output_;
+    return true;
+}
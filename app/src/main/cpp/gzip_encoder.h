@@ -0,0 +1,25 @@
+#pragma once
+
+#include <string>
+#include <string_view>
+#include <zlib.h>
+
+// Streaming gzip encoder for response bodies. Input goes in in arbitrary
+// pieces; whatever compressed output is ready comes back from each call.
+class GzipEncoder {
+public:
+    explicit GzipEncoder(int level);
+    ~GzipEncoder();
+    
+    GzipEncoder(const GzipEncoder&) = delete;
+    GzipEncoder& operator=(const GzipEncoder&) = delete;
+    
+    // Compresses 'data'; 'finish' flushes everything plus the gzip trailer.
+    // 'out' points into the encoder and stays valid until the next call.
+    bool encode(const char* data, size_t length, bool finish, std::string_view& out);
+    
+private:
+    z_stream stream_;
+    bool valid_;
+    std::string output_;
+};
@@ -0,0 +1,41 @@
+#pragma once
+
+// Host stand-in for the NDK's <android/log.h>, used by the non-Android build:
+// the server's LOGI/LOGE lines go to stderr. Messages below hostLogPriority()
+// are dropped; fileserver_host raises it with --quiet.
+
+#include <cstdarg>
+#include <cstdio>
+
+typedef enum android_LogPriority {
+    ANDROID_LOG_UNKNOWN = 0,
+    ANDROID_LOG_DEFAULT,
+    ANDROID_LOG_VERBOSE,
+    ANDROID_LOG_DEBUG,
+    ANDROID_LOG_INFO,
+    ANDROID_LOG_WARN,
+    ANDROID_LOG_ERROR,
+    ANDROID_LOG_FATAL,
+    ANDROID_LOG_SILENT,
+} android_LogPriority;
+
+inline int& hostLogPriority() {
+    static int priority = ANDROID_LOG_INFO;
+    return priority;
+}
+
+__attribute__((format(printf, 3, 4)))
+inline int __android_log_print(int priority, const char* tag, const char* format, ...) {
+    if (priority < hostLogPriority()) {
+        return 0;
+    }
+    char message[1024];
+    va_list args;
+    va_start(args, format);
+    vsnprintf(message, sizeof(message), format, args);
+    va_end(args);
+    // One write per line so lines from different threads don't interleave
+    char level = priority >= ANDROID_LOG_VERBOSE && priority <= ANDROID_LOG_FATAL
+        ? "??VDIWEF"[priority] : '?';
+    return fprintf(stderr, "%c/%s: %s\n", level, tag, message);
+}
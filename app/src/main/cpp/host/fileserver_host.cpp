@@ -0,0 +1,247 @@
+// Runs the server on a Linux host, sharing the files of one directory.
+//
+//   fileserver_host --dir ~/Downloads [--port 8080] [--user NAME --password PASS]
+//
+// Meant for profiling and load testing off-device; see --help for the knobs
+// that mirror the app's settings.
+
+#include "http_server.h"
+#include "file_manager.h"
+#include "auth_manager.h"
+
+#include <android/log.h>
+#include <sys/stat.h>
+#include <dirent.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <csignal>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <vector>
+#include <algorithm>
+
+namespace {
+
+void usage(const char* program) {
+    fprintf(stderr,
+            "usage: %s --dir PATH [options]\n"
+            "  -d, --dir PATH             directory whose regular files are shared\n"
+            "  -p, --port N               listen port (default 8080)\n"
+            "  -u, --user NAME            require Basic auth with this user...\n"
+            "  -P, --password PASS        ...and password\n"
+            "      --fd                   share open descriptors instead of paths, like SAF shares\n"
+            "      --no-sniff             type files without a known extension as octet-stream\n"
+            "      --hash                 hash files in the background for ETags and digests\n"
+            "      --hash-cache PATH      remember digests in PATH across runs\n"
+            "      --no-sha256            with --hash, skip the SHA-256 pass\n"
+            "      --upload PATH          accept uploads into PATH\n"
+            "      --cache PATH           keep compressed variants in PATH\n"
+            "      --workers N            event loops (default: one per core)\n"
+            "      --queue N              per-loop accept queue depth\n"
+            "      --max-connections N\n"
+            "      --bulk N               concurrent bulk transfers\n"
+            "      --rate G,C,T           bytes/s caps: global, per client, per transfer\n"
+            "      --capture FILE         record served requests for fileserver_loadgen --replay\n"
+            "  -q, --quiet                log errors only\n",
+            program);
+}
+
+struct Options {
+    std::string directory;
+    int port = 8080;
+    std::string user;
+    std::string password;
+    bool byDescriptor = false;
+    bool sniff = true;
+    bool hash = false;
+    std::string hashCacheDirectory;
+    bool sha256 = true;
+    std::string uploadDirectory;
+    std::string cacheDirectory;
+    int workers = 0;
+    int queueDepth = 0;
+    int maxConnections = 0;
+    int bulkTransfers = 0;
+    long long rates[3] = {0, 0, 0};
+    std::string captureFile;
+    bool quiet = false;
+};
+
+bool parseOptions(int argc, char** argv, Options& options) {
+    enum { FD = 1000, NO_SNIFF, HASH, HASH_CACHE, NO_SHA256, UPLOAD, CACHE, WORKERS, QUEUE, MAX_CONNECTIONS, BULK, RATE, CAPTURE };
+    static const struct option longOptions[] = {
+        {"dir", required_argument, nullptr, 'd'},
+        {"port", required_argument, nullptr, 'p'},
+        {"user", required_argument, nullptr, 'u'},
+        {"password", required_argument, nullptr, 'P'},
+        {"fd", no_argument, nullptr, FD},
+        {"no-sniff", no_argument, nullptr, NO_SNIFF},
+        {"hash", no_argument, nullptr, HASH},
+        {"hash-cache", required_argument, nullptr, HASH_CACHE},
+        {"no-sha256", no_argument, nullptr, NO_SHA256},
+        {"upload", required_argument, nullptr, UPLOAD},
+        {"cache", required_argument, nullptr, CACHE},
+        {"workers", required_argument, nullptr, WORKERS},
+        {"queue", required_argument, nullptr, QUEUE},
+        {"max-connections", required_argument, nullptr, MAX_CONNECTIONS},
+        {"bulk", required_argument, nullptr, BULK},
+        {"rate", required_argument, nullptr, RATE},
+        {"capture", required_argument, nullptr, CAPTURE},
+        {"quiet", no_argument, nullptr, 'q'},
+        {"help", no_argument, nullptr, 'h'},
+        {nullptr, 0, nullptr, 0},
+    };
+    
+    int option;
+    while ((option = getopt_long(argc, argv, "d:p:u:P:qh", longOptions, nullptr)) != -1) {
+        switch (option) {
+            case 'd': options.directory = optarg; break;
+            case 'p': options.port = atoi(optarg); break;
+            case 'u': options.user = optarg; break;
+            case 'P': options.password = optarg; break;
+            case 'q': options.quiet = true; break;
+            case FD: options.byDescriptor = true; break;
+            case NO_SNIFF: options.sniff = false; break;
+            case HASH: options.hash = true; break;
+            case HASH_CACHE: options.hashCacheDirectory = optarg; break;
+            case NO_SHA256: options.sha256 = false; break;
+            case UPLOAD: options.uploadDirectory = optarg; break;
+            case CACHE: options.cacheDirectory = optarg; break;
+            case WORKERS: options.workers = atoi(optarg); break;
+            case QUEUE: options.queueDepth = atoi(optarg); break;
+            case MAX_CONNECTIONS: options.maxConnections = atoi(optarg); break;
+            case BULK: options.bulkTransfers = atoi(optarg); break;
+            case CAPTURE: options.captureFile = optarg; break;
+            case RATE:
+                if (sscanf(optarg, "%lld,%lld,%lld",
+                           &options.rates[0], &options.rates[1], &options.rates[2]) != 3) {
+                    fprintf(stderr, "--rate expects G,C,T\n");
+                    return false;
+                }
+                break;
+            default:
+                return false;
+        }
+    }
+    if (options.directory.empty() || options.port <= 0 || options.port > 65535 ||
+        options.user.empty() != options.password.empty()) {
+        return false;
+    }
+    return true;
+}
+
+// Shares every regular file directly in 'directory', in name order with ids 1, 2, ...
+int shareDirectory(FileManager& fileManager, const std::string& directory, bool byDescriptor) {
+    DIR* dir = opendir(directory.c_str());
+    if (!dir) {
+        perror(directory.c_str());
+        return -1;
+    }
+    std::vector<std::string> names;
+    while (struct dirent* entry = readdir(dir)) {
+        names.push_back(entry->d_name);
+    }
+    closedir(dir);
+    std::sort(names.begin(), names.end());
+    
+    int shared = 0;
+    for (const std::string& name : names) {
+        std::string path = directory + "/" + name;
+        struct stat st;
+        if (stat(path.c_str(), &st) != 0 || !S_ISREG(st.st_mode)) {
+            continue;
+        }
+        std::string id = std::to_string(shared + 1);
+        if (byDescriptor) {
+            int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+            if (fd < 0) {
+                perror(path.c_str());
+                continue;
+            }
+            fileManager.addFileDescriptor(id, name, fd, static_cast<size_t>(st.st_size));
+        } else {
+            fileManager.addFile(id, name, path, static_cast<size_t>(st.st_size));
+        }
+        printf("  /download/%-6s %12lld  %s\n", id.c_str(), static_cast<long long>(st.st_size),
+               name.c_str());
+        shared++;
+    }
+    return shared;
+}
+
+} // namespace
+
+int main(int argc, char** argv) {
+    Options options;
+    if (!parseOptions(argc, argv, options)) {
+        usage(argv[0]);
+        return 2;
+    }
+    if (options.quiet) {
+        hostLogPriority() = ANDROID_LOG_ERROR;
+    }
+    
+    // Block the stop signals before any server thread starts, so they all inherit
+    // the mask and only the sigwait below sees them
+    signal(SIGPIPE, SIG_IGN);
+    sigset_t stopSignals;
+    sigemptyset(&stopSignals);
+    sigaddset(&stopSignals, SIGINT);
+    sigaddset(&stopSignals, SIGTERM);
+    pthread_sigmask(SIG_BLOCK, &stopSignals, nullptr);
+    
+    FileManager fileManager;
+    AuthManager authManager;
+    HttpServer server;
+    server.setFileManager(&fileManager);
+    server.setAuthManager(&authManager);
+    if (!options.user.empty()) {
+        authManager.setCredentials(options.user, options.password);
+    }
+    
+    fileManager.setContentSniffing(options.sniff);
+    if (options.hash) {
+        fileManager.setContentHashing(true, options.sha256, options.hashCacheDirectory);
+    }
+    printf("Sharing %s\n", options.directory.c_str());
+    int shared = shareDirectory(fileManager, options.directory, options.byDescriptor);
+    if (shared < 0) {
+        return 1;
+    }
+    
+    server.setLimits(options.workers, options.queueDepth, options.maxConnections);
+    server.setBulkTransferLimit(options.bulkTransfers);
+    server.setRateLimits(options.rates[0], options.rates[1], options.rates[2]);
+    if (!options.uploadDirectory.empty()) {
+        server.setUploadDirectory(options.uploadDirectory);
+    }
+    if (!options.cacheDirectory.empty()) {
+        server.setCompressionCache(options.cacheDirectory, 0);
+    }
+    if (!options.captureFile.empty() && !server.startCapture(options.captureFile)) {
+        return 1;
+    }
+    if (!server.start(options.port)) {
+        fprintf(stderr, "Failed to start on port %d\n", options.port);
+        return 1;
+    }
+    printf("%d files on http://127.0.0.1:%d/ (Ctrl-C to stop)\n", shared, server.getPort());
+    fflush(stdout);
+    
+    int signalNumber = 0;
+    sigwait(&stopSignals, &signalNumber);
+    server.stop();
+    
+    HttpServer::Stats stats = server.getStats();
+    printf("Stopped: %lld connections accepted, %lld rejected; transfers: "
+           "%lld sendfile, %lld splice, %lld copy\n",
+           static_cast<long long>(stats.acceptedConnections),
+           static_cast<long long>(stats.rejectedConnections),
+           static_cast<long long>(stats.sendfileTransfers),
+           static_cast<long long>(stats.spliceTransfers),
+           static_cast<long long>(stats.copyTransfers));
+    return 0;
+}
@@ -0,0 +1,977 @@
+// HTTP/1.1 load generator for benchmarking the server on loopback.
+//
+//   fileserver_loadgen [options] [WEIGHT*]PATH...
+//
+// Each path is requested in proportion to its weight (default 1), so
+// "8*/download/1 1*/api/files" is a download-heavy mix. Connections are spread
+// over a few threads, each running its own epoll loop; every connection has one
+// request in flight at a time. Reports throughput and latency percentiles
+// measured from the request being written to the last body byte arriving.
+//
+//   fileserver_loadgen --replay capture.bin [--speed 4] [--json run.json]
+//
+// Replays a capture taken with HttpServer::startCapture() (fileserver_host
+// --capture) instead: each captured connection becomes one client connection
+// issuing its requests, Range headers included, at their original offsets
+// divided by --speed. Uploads are skipped since their bodies aren't captured.
+// --json saves the summary and --compare prints deltas against an earlier one,
+// so two builds can be replayed against the same traffic and compared.
+
+#include <sys/epoll.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include <netdb.h>
+#include "traffic_capture.h"
+#include <fcntl.h>
+#include <getopt.h>
+#include <unistd.h>
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <csignal>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <functional>
+#include <map>
+#include <memory>
+#include <queue>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace {
+
+struct Target {
+    std::string path;
+    int weight = 1;
+    int64_t length = -1;    // From a HEAD probe; needed for range requests
+};
+
+struct Options {
+    std::string host = "127.0.0.1";
+    int port = 8080;
+    int connections = 16;
+    int threads = 0;
+    double durationSeconds = 10;
+    int64_t maxRequests = 0;        // 0: run for durationSeconds instead
+    bool keepAlive = true;
+    int64_t rangeBytes = 0;
+    double rangeRatio = 1.0;
+    std::string authorization;      // Complete header value
+    std::string verifyFile;
+    std::vector<Target> targets;
+    std::string replayFile;
+    double speed = 1.0;             // Replay time scale; 0: as fast as possible
+    std::string jsonFile;
+    std::string compareFile;
+};
+
+// One captured connection's requests, in the order they started
+using Script = std::vector<const TrafficCapture::Record*>;
+
+struct Result {
+    int64_t requests = 0;
+    int64_t errors = 0;             // Connection failures and malformed or truncated responses
+    int64_t badStatus = 0;          // Anything but 2xx/304
+    int64_t verifyFailures = 0;
+    int64_t bytes = 0;
+    int64_t connects = 0;
+    int64_t skipped = 0;            // Replay: captured requests that can't be re-issued
+    int64_t statusChanged = 0;      // Replay: status differs from the captured one
+    std::vector<int64_t> latencyUs;
+};
+
+int64_t nowNs() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+std::string base64Encode(const std::string& input) {
+    static const char alphabet[] =
+        "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+    std::string out;
+    size_t i = 0;
+    for (; i + 2 < input.size(); i += 3) {
+        uint32_t n = (uint8_t(input[i]) << 16) | (uint8_t(input[i + 1]) << 8) | uint8_t(input[i + 2]);
+        out += alphabet[n >> 18];
+        out += alphabet[(n >> 12) & 63];
+        out += alphabet[(n >> 6) & 63];
+        out += alphabet[n & 63];
+    }
+    if (i < input.size()) {
+        uint32_t n = uint8_t(input[i]) << 16;
+        if (i + 1 < input.size()) {
+            n |= uint8_t(input[i + 1]) << 8;
+        }
+        out += alphabet[n >> 18];
+        out += alphabet[(n >> 12) & 63];
+        out += i + 1 < input.size() ? alphabet[(n >> 6) & 63] : '=';
+        out += '=';
+    }
+    return out;
+}
+
+// Case-insensitive header lookup in a raw response head; empty if absent
+std::string headerValue(const std::string& head, const char* name) {
+    size_t nameLength = strlen(name);
+    size_t lineStart = head.find("\r\n");
+    while (lineStart != std::string::npos && lineStart + 2 < head.size()) {
+        lineStart += 2;
+        size_t lineEnd = head.find("\r\n", lineStart);
+        if (lineEnd == std::string::npos) {
+            lineEnd = head.size();
+        }
+        if (lineEnd - lineStart > nameLength && head[lineStart + nameLength] == ':' &&
+            strncasecmp(head.c_str() + lineStart, name, nameLength) == 0) {
+            size_t valueStart = lineStart + nameLength + 1;
+            while (valueStart < lineEnd && head[valueStart] == ' ') {
+                valueStart++;
+            }
+            return head.substr(valueStart, lineEnd - valueStart);
+        }
+        lineStart = lineEnd;
+    }
+    return std::string();
+}
+
+bool resolve(const Options& options, struct sockaddr_storage& address, socklen_t& length) {
+    struct addrinfo hints;
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    struct addrinfo* result = nullptr;
+    std::string port = std::to_string(options.port);
+    if (getaddrinfo(options.host.c_str(), port.c_str(), &hints, &result) != 0 || !result) {
+        return false;
+    }
+    memcpy(&address, result->ai_addr, result->ai_addrlen);
+    length = result->ai_addrlen;
+    freeaddrinfo(result);
+    return true;
+}
+
+// Blocking HEAD request to learn a target's length before the run
+bool probe(const Options& options, const struct sockaddr_storage& address, socklen_t length,
+           Target& target) {
+    int fd = socket(address.ss_family, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd < 0 || connect(fd, reinterpret_cast<const struct sockaddr*>(&address), length) != 0) {
+        if (fd >= 0) close(fd);
+        return false;
+    }
+    std::string request = "HEAD " + target.path + " HTTP/1.1\r\nHost: " + options.host +
+                          "\r\nConnection: close\r\n";
+    if (!options.authorization.empty()) {
+        request += "Authorization: " + options.authorization + "\r\n";
+    }
+    request += "\r\n";
+    send(fd, request.data(), request.size(), MSG_NOSIGNAL);
+    
+    std::string head;
+    char buffer[4096];
+    ssize_t n;
+    while (head.find("\r\n\r\n") == std::string::npos &&
+           (n = recv(fd, buffer, sizeof(buffer), 0)) > 0) {
+        head.append(buffer, n);
+    }
+    close(fd);
+    int status = 0;
+    if (sscanf(head.c_str(), "HTTP/1.%*d %d", &status) != 1 || status != 200) {
+        fprintf(stderr, "HEAD %s: %s\n", target.path.c_str(),
+                status ? ("status " + std::to_string(status)).c_str() : "no response");
+        return false;
+    }
+    std::string contentLength = headerValue(head, "Content-Length");
+    target.length = contentLength.empty() ? -1 : atoll(contentLength.c_str());
+    return true;
+}
+
+class Worker {
+public:
+    Worker(const Options& options, const struct sockaddr_storage& address, socklen_t addressLength,
+           int connections, const uint8_t* verifyData, int64_t verifyLength, int64_t deadlineNs,
+           std::atomic<int64_t>& requestBudget, uint64_t seed)
+        : options_(options), address_(address), addressLength_(addressLength),
+          verifyData_(verifyData), verifyLength_(verifyLength), deadlineNs_(deadlineNs),
+          requestBudget_(requestBudget), random_(seed), conns_(connections) {
+        for (const Target& target : options.targets) {
+            totalWeight_ += target.weight;
+        }
+    }
+    
+    // Replays these scripts, one connection each, instead of picking targets
+    void setReplay(std::vector<const Script*> scripts, int64_t replayStartNs);
+    void run();
+    Result& result() { return result_; }
+    
+private:
+    struct Conn {
+        int fd = -1;
+        bool connecting = false;
+        bool busy = false;              // A request is in flight
+        std::string out;
+        size_t outOffset = 0;
+        std::string head;
+        bool headDone = false;
+        int status = 0;
+        int64_t contentLength = -1;     // -1: body runs to EOF
+        int64_t received = 0;
+        int64_t bodyOffset = 0;         // Offset of the body within the target
+        bool serverCloses = false;
+        bool headOnly = false;          // HEAD: the response has no body
+        bool reused = false;            // Sent on a connection that served earlier requests
+        bool retrying = false;          // Resend 'out' on a fresh connection
+        int64_t startNs = 0;
+        const Script* script = nullptr;
+        size_t next = 0;                // Next script entry
+        uint32_t expectedStatus = 0;
+    };
+    
+    bool mayStart();
+    bool nextTarget(Conn& conn);
+    bool nextReplayed(Conn& conn);
+    void startRequest(Conn& conn);
+    bool openSocket(Conn& conn);
+    void drive(Conn& conn);
+    bool onData(Conn& conn, const char* data, size_t length);
+    void complete(Conn& conn);
+    void fail(Conn& conn);
+    void closeSocket(Conn& conn);
+    
+    const Options& options_;
+    const struct sockaddr_storage& address_;
+    socklen_t addressLength_;
+    const uint8_t* verifyData_;
+    int64_t verifyLength_;
+    int64_t deadlineNs_;
+    std::atomic<int64_t>& requestBudget_;
+    std::mt19937_64 random_;
+    int totalWeight_ = 0;
+    int epollFd_ = -1;
+    std::vector<Conn> conns_;
+    int inFlight_ = 0;
+    std::vector<Conn*> restart_;    // Due their next request; started from run() to keep the stack flat
+    bool replay_ = false;
+    int64_t replayStartNs_ = 0;
+    // Replayed connections waiting for their next request's start time
+    std::priority_queue<std::pair<int64_t, Conn*>, std::vector<std::pair<int64_t, Conn*>>,
+                        std::greater<std::pair<int64_t, Conn*>>> timers_;
+    Result result_;
+};
+
+void Worker::setReplay(std::vector<const Script*> scripts, int64_t replayStartNs) {
+    replay_ = true;
+    replayStartNs_ = replayStartNs;
+    conns_ = std::vector<Conn>(scripts.size());
+    for (size_t i = 0; i < scripts.size(); i++) {
+        conns_[i].script = scripts[i];
+    }
+}
+
+bool Worker::mayStart() {
+    if (options_.maxRequests > 0) {
+        return requestBudget_.fetch_sub(1) > 0;
+    }
+    return nowNs() < deadlineNs_;
+}
+
+bool Worker::openSocket(Conn& conn) {
+    conn.fd = socket(address_.ss_family, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (conn.fd < 0) {
+        return false;
+    }
+    int one = 1;
+    setsockopt(conn.fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    result_.connects++;
+    if (connect(conn.fd, reinterpret_cast<const struct sockaddr*>(&address_), addressLength_) != 0 &&
+        errno != EINPROGRESS) {
+        close(conn.fd);
+        conn.fd = -1;
+        return false;
+    }
+    conn.connecting = true;
+    
+    struct epoll_event ev;
+    memset(&ev, 0, sizeof(ev));
+    ev.events = EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET;
+    ev.data.ptr = &conn;
+    epoll_ctl(epollFd_, EPOLL_CTL_ADD, conn.fd, &ev);
+    return true;
+}
+
+// Builds the next synthetic request into conn.out; false once the run is over
+bool Worker::nextTarget(Conn& conn) {
+    if (!mayStart()) {
+        return false;
+    }
+    
+    // Weighted pick, then maybe a random slice of it
+    int pick = std::uniform_int_distribution<int>(0, totalWeight_ - 1)(random_);
+    const Target* target = &options_.targets[0];
+    for (const Target& candidate : options_.targets) {
+        if (pick < candidate.weight) {
+            target = &candidate;
+            break;
+        }
+        pick -= candidate.weight;
+    }
+    conn.out = "GET " + target->path + " HTTP/1.1\r\nHost: " + options_.host + "\r\n";
+    if (!options_.keepAlive) {
+        conn.out += "Connection: close\r\n";
+    }
+    if (!options_.authorization.empty()) {
+        conn.out += "Authorization: " + options_.authorization + "\r\n";
+    }
+    conn.bodyOffset = 0;
+    if (options_.rangeBytes > 0 && target->length > options_.rangeBytes &&
+        std::uniform_real_distribution<double>(0, 1)(random_) < options_.rangeRatio) {
+        conn.bodyOffset = std::uniform_int_distribution<int64_t>(
+            0, target->length - options_.rangeBytes)(random_);
+        conn.out += "Range: bytes=" + std::to_string(conn.bodyOffset) + "-" +
+                    std::to_string(conn.bodyOffset + options_.rangeBytes - 1) + "\r\n";
+    }
+    conn.out += "\r\n";
+    conn.headOnly = false;
+    return true;
+}
+
+// Builds the connection's next captured request into conn.out once it is due;
+// false if it isn't due yet (a timer is set) or the script is done
+bool Worker::nextReplayed(Conn& conn) {
+    while (conn.next < conn.script->size()) {
+        const TrafficCapture::Record& record = *(*conn.script)[conn.next];
+        if (record.method != TrafficCapture::Method::Get &&
+            record.method != TrafficCapture::Method::Head) {
+            result_.skipped++;
+            conn.next++;
+            continue;
+        }
+        if (options_.speed > 0) {
+            int64_t dueNs = replayStartNs_ + static_cast<int64_t>(record.startUs * 1000 / options_.speed);
+            if (dueNs > nowNs()) {
+                timers_.emplace(dueNs, &conn);
+                return false;
+            }
+        }
+        
+        conn.next++;
+        conn.headOnly = record.method == TrafficCapture::Method::Head;
+        conn.expectedStatus = record.status;
+        conn.out = std::string(TrafficCapture::methodName(record.method)) + " " + record.target +
+                   " HTTP/1.1\r\nHost: " + options_.host + "\r\n";
+        if (!options_.authorization.empty()) {
+            conn.out += "Authorization: " + options_.authorization + "\r\n";
+        }
+        if (!record.range.empty()) {
+            conn.out += "Range: " + record.range + "\r\n";
+        }
+        conn.out += "\r\n";
+        // Ranged bodies aren't verified, so the offset only matters for --verify
+        conn.bodyOffset = 0;
+        return true;
+    }
+    return false;
+}
+
+void Worker::startRequest(Conn& conn) {
+    if (conn.retrying) {
+        // Same request and start time, new connection
+        conn.retrying = false;
+    } else {
+        if (replay_ ? !nextReplayed(conn) : !nextTarget(conn)) {
+            if (!replay_ || conn.next >= conn.script->size()) {
+                closeSocket(conn);
+            }
+            return;
+        }
+        conn.startNs = nowNs();
+    }
+    conn.reused = conn.fd >= 0;
+    conn.outOffset = 0;
+    conn.head.clear();
+    conn.headDone = false;
+    conn.status = 0;
+    conn.contentLength = -1;
+    conn.received = 0;
+    conn.serverCloses = false;
+    conn.busy = true;
+    inFlight_++;
+    
+    if (conn.fd < 0 && !openSocket(conn)) {
+        // Out of descriptors or the like: retire this connection rather than spin
+        result_.errors++;
+        conn.busy = false;
+        inFlight_--;
+        return;
+    }
+    drive(conn);
+}
+
+void Worker::drive(Conn& conn) {
+    if (conn.connecting) {
+        int error = 0;
+        socklen_t length = sizeof(error);
+        getsockopt(conn.fd, SOL_SOCKET, SO_ERROR, &error, &length);
+        if (error != 0) {
+            fail(conn);
+            return;
+        }
+        // Still in progress: no error yet, and the request can't be written
+        ssize_t sent = send(conn.fd, conn.out.data(), conn.out.size(), MSG_NOSIGNAL);
+        if (sent < 0) {
+            if (errno == EAGAIN || errno == EWOULDBLOCK || errno == ENOTCONN) {
+                return;
+            }
+            fail(conn);
+            return;
+        }
+        conn.connecting = false;
+        conn.outOffset = sent;
+    }
+    while (conn.outOffset < conn.out.size()) {
+        ssize_t sent = send(conn.fd, conn.out.data() + conn.outOffset,
+                            conn.out.size() - conn.outOffset, MSG_NOSIGNAL);
+        if (sent < 0) {
+            if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                return;
+            }
+            fail(conn);
+            return;
+        }
+        conn.outOffset += sent;
+    }
+    
+    char buffer[1 << 16];
+    while (conn.busy) {
+        ssize_t n = recv(conn.fd, buffer, sizeof(buffer), 0);
+        if (n < 0) {
+            if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                return;
+            }
+            fail(conn);
+            return;
+        }
+        if (n == 0) {
+            if (conn.headDone && conn.contentLength < 0) {
+                conn.serverCloses = true;
+                complete(conn);
+            } else {
+                fail(conn);
+            }
+            return;
+        }
+        if (!onData(conn, buffer, n)) {
+            fail(conn);
+            return;
+        }
+    }
+}
+
+bool Worker::onData(Conn& conn, const char* data, size_t length) {
+    if (!conn.headDone) {
+        size_t before = conn.head.size();
+        conn.head.append(data, length);
+        size_t end = conn.head.find("\r\n\r\n");
+        if (end == std::string::npos) {
+            return conn.head.size() < 65536;
+        }
+        conn.headDone = true;
+        size_t bodyStart = end + 4;
+        data += bodyStart - before;
+        length -= bodyStart - before;
+        conn.head.resize(end + 2);
+        
+        if (sscanf(conn.head.c_str(), "HTTP/1.%*d %d", &conn.status) != 1) {
+            return false;
+        }
+        std::string contentLength = headerValue(conn.head, "Content-Length");
+        if (conn.headOnly || conn.status == 204 || conn.status == 304) {
+            conn.contentLength = 0;
+        } else if (!contentLength.empty()) {
+            conn.contentLength = atoll(contentLength.c_str());
+        } else if (!headerValue(conn.head, "Transfer-Encoding").empty()) {
+            // Only asked for identity bodies; chunked would need decoding
+            return false;
+        }
+        std::string connection = headerValue(conn.head, "Connection");
+        conn.serverCloses = !options_.keepAlive || strcasecmp(connection.c_str(), "close") == 0;
+    }
+    
+    if (length > 0) {
+        if (verifyData_ && conn.status / 100 == 2) {
+            int64_t offset = conn.bodyOffset + conn.received;
+            if (offset + static_cast<int64_t>(length) > verifyLength_ ||
+                memcmp(verifyData_ + offset, data, length) != 0) {
+                if (result_.verifyFailures++ == 0) {
+                    fprintf(stderr, "Body mismatch in bytes %lld-%lld\n", static_cast<long long>(offset),
+                            static_cast<long long>(offset + length - 1));
+                }
+            }
+        }
+        conn.received += length;
+        result_.bytes += length;
+    }
+    if (conn.contentLength >= 0 && conn.received >= conn.contentLength) {
+        if (conn.received > conn.contentLength) {
+            return false;
+        }
+        complete(conn);
+    }
+    return true;
+}
+
+void Worker::complete(Conn& conn) {
+    result_.latencyUs.push_back((nowNs() - conn.startNs) / 1000);
+    result_.requests++;
+    if (conn.status / 100 != 2 && conn.status != 304) {
+        result_.badStatus++;
+    }
+    if (replay_ && static_cast<uint32_t>(conn.status) != conn.expectedStatus) {
+        result_.statusChanged++;
+    }
+    conn.busy = false;
+    inFlight_--;
+    if (conn.serverCloses) {
+        closeSocket(conn);
+    }
+    restart_.push_back(&conn);
+}
+
+void Worker::fail(Conn& conn) {
+    if (conn.busy && conn.reused && conn.head.empty()) {
+        // The server closed the idle connection as this request went out (keep-alive
+        // timeout or request cap): not an error, send it again on a new one
+        conn.busy = false;
+        inFlight_--;
+        closeSocket(conn);
+        conn.retrying = true;
+        restart_.push_back(&conn);
+        return;
+    }
+    result_.errors++;
+    if (conn.busy) {
+        conn.busy = false;
+        inFlight_--;
+    }
+    closeSocket(conn);
+    restart_.push_back(&conn);
+}
+
+void Worker::closeSocket(Conn& conn) {
+    if (conn.fd >= 0) {
+        epoll_ctl(epollFd_, EPOLL_CTL_DEL, conn.fd, nullptr);
+        close(conn.fd);
+        conn.fd = -1;
+    }
+    conn.connecting = false;
+}
+
+void Worker::run() {
+    epollFd_ = epoll_create1(EPOLL_CLOEXEC);
+    for (Conn& conn : conns_) {
+        restart_.push_back(&conn);
+    }
+    
+    struct epoll_event events[64];
+    int64_t giveUpNs = deadlineNs_ + 5'000'000'000LL;   // Stragglers past the deadline
+    while (inFlight_ > 0 || !restart_.empty() || !timers_.empty()) {
+        int64_t now = nowNs();
+        while (!timers_.empty() && timers_.top().first <= now) {
+            restart_.push_back(timers_.top().second);
+            timers_.pop();
+        }
+        std::vector<Conn*> due;
+        due.swap(restart_);
+        for (Conn* conn : due) {
+            startRequest(*conn);
+        }
+        if (!replay_ && options_.maxRequests == 0 && nowNs() > giveUpNs) {
+            break;
+        }
+        int timeoutMs = 100;
+        if (!restart_.empty()) {
+            timeoutMs = 0;
+        } else if (!timers_.empty()) {
+            int64_t untilMs = (timers_.top().first - nowNs() + 999'999) / 1'000'000;
+            timeoutMs = static_cast<int>(std::max<int64_t>(0, std::min<int64_t>(timeoutMs, untilMs)));
+        }
+        int count = epoll_wait(epollFd_, events, 64, timeoutMs);
+        for (int i = 0; i < count; i++) {
+            Conn& conn = *static_cast<Conn*>(events[i].data.ptr);
+            if (conn.fd >= 0 && conn.busy) {
+                drive(conn);
+            }
+        }
+    }
+    for (Conn& conn : conns_) {
+        closeSocket(conn);
+    }
+    close(epollFd_);
+}
+
+void usage(const char* program) {
+    fprintf(stderr,
+            "usage: %s [options] [WEIGHT*]PATH...\n"
+            "  -h, --host HOST            server address (default 127.0.0.1)\n"
+            "  -p, --port N               server port (default 8080)\n"
+            "  -c, --connections N        concurrent connections (default 16)\n"
+            "  -t, --threads N            client threads (default: min(cores, connections))\n"
+            "  -d, --duration SECONDS     run time (default 10)\n"
+            "  -n, --requests N           stop after N requests instead\n"
+            "      --no-keep-alive        one request per connection\n"
+            "      --range BYTES          request random BYTES-long ranges...\n"
+            "      --range-ratio R        ...for this fraction of requests (default 1)\n"
+            "  -a, --auth USER:PASS       send Basic credentials\n"
+            "      --verify FILE          compare every body with FILE (single path only)\n"
+            "      --replay FILE          re-issue a traffic capture instead of PATHs\n"
+            "      --speed X              replay X times faster (default 1; 0: no pauses)\n"
+            "      --json FILE            save the summary as JSON\n"
+            "      --compare FILE         print deltas against a summary saved with --json\n",
+            program);
+}
+
+bool parseOptions(int argc, char** argv, Options& options) {
+    enum { NO_KEEP_ALIVE = 1000, RANGE, RANGE_RATIO, VERIFY, REPLAY, SPEED, JSON, COMPARE };
+    static const struct option longOptions[] = {
+        {"host", required_argument, nullptr, 'h'},
+        {"port", required_argument, nullptr, 'p'},
+        {"connections", required_argument, nullptr, 'c'},
+        {"threads", required_argument, nullptr, 't'},
+        {"duration", required_argument, nullptr, 'd'},
+        {"requests", required_argument, nullptr, 'n'},
+        {"no-keep-alive", no_argument, nullptr, NO_KEEP_ALIVE},
+        {"range", required_argument, nullptr, RANGE},
+        {"range-ratio", required_argument, nullptr, RANGE_RATIO},
+        {"auth", required_argument, nullptr, 'a'},
+        {"verify", required_argument, nullptr, VERIFY},
+        {"replay", required_argument, nullptr, REPLAY},
+        {"speed", required_argument, nullptr, SPEED},
+        {"json", required_argument, nullptr, JSON},
+        {"compare", required_argument, nullptr, COMPARE},
+        {nullptr, 0, nullptr, 0},
+    };
+    
+    int option;
+    while ((option = getopt_long(argc, argv, "h:p:c:t:d:n:a:", longOptions, nullptr)) != -1) {
+        switch (option) {
+            case 'h': options.host = optarg; break;
+            case 'p': options.port = atoi(optarg); break;
+            case 'c': options.connections = atoi(optarg); break;
+            case 't': options.threads = atoi(optarg); break;
+            case 'd': options.durationSeconds = atof(optarg); break;
+            case 'n': options.maxRequests = atoll(optarg); break;
+            case 'a': options.authorization = "Basic " + base64Encode(optarg); break;
+            case NO_KEEP_ALIVE: options.keepAlive = false; break;
+            case RANGE: options.rangeBytes = atoll(optarg); break;
+            case RANGE_RATIO: options.rangeRatio = atof(optarg); break;
+            case VERIFY: options.verifyFile = optarg; break;
+            case REPLAY: options.replayFile = optarg; break;
+            case SPEED: options.speed = atof(optarg); break;
+            case JSON: options.jsonFile = optarg; break;
+            case COMPARE: options.compareFile = optarg; break;
+            default: return false;
+        }
+    }
+    for (int i = optind; i < argc; i++) {
+        Target target;
+        const char* star = strchr(argv[i], '*');
+        target.path = star ? star + 1 : argv[i];
+        target.weight = star ? atoi(argv[i]) : 1;
+        if (target.path.empty() || target.path[0] != '/' || target.weight <= 0) {
+            fprintf(stderr, "Bad target: %s\n", argv[i]);
+            return false;
+        }
+        options.targets.push_back(target);
+    }
+    if (!options.replayFile.empty()) {
+        // Connections and threads follow the capture
+        return options.targets.empty() && options.verifyFile.empty() && options.speed >= 0;
+    }
+    if (options.targets.empty() || options.connections <= 0 || options.durationSeconds <= 0 ||
+        (!options.verifyFile.empty() && options.targets.size() != 1)) {
+        return false;
+    }
+    if (options.threads <= 0) {
+        options.threads = std::min<int>(options.connections,
+                                        std::max(1u, std::thread::hardware_concurrency()));
+    }
+    options.threads = std::min(options.threads, options.connections);
+    return true;
+}
+
+// Headline numbers of a run, in the order --json writes them
+using Summary = std::vector<std::pair<std::string, double>>;
+
+bool writeSummary(const std::string& path, const Summary& summary) {
+    FILE* file = fopen(path.c_str(), "w");
+    if (!file) {
+        perror(path.c_str());
+        return false;
+    }
+    fprintf(file, "{\n");
+    for (size_t i = 0; i < summary.size(); i++) {
+        fprintf(file, "  \"%s\": %.12g%s\n", summary[i].first.c_str(), summary[i].second,
+                i + 1 < summary.size() ? "," : "");
+    }
+    fprintf(file, "}\n");
+    return fclose(file) == 0;
+}
+
+// Reads back what writeSummary() wrote: one flat object of numbers
+bool readSummary(const std::string& path, Summary& summary) {
+    FILE* file = fopen(path.c_str(), "r");
+    if (!file) {
+        perror(path.c_str());
+        return false;
+    }
+    char line[256];
+    char name[128];
+    double value;
+    while (fgets(line, sizeof(line), file)) {
+        if (sscanf(line, " \"%127[^\"]\": %lf", name, &value) == 2) {
+            summary.emplace_back(name, value);
+        }
+    }
+    fclose(file);
+    return !summary.empty();
+}
+
+void printComparison(const Summary& before, const Summary& after) {
+    // Lower is better for everything but throughput
+    static const char* const compared[] = {
+        "requests_per_second", "mib_per_second", "p50_ms", "p90_ms", "p99_ms", "p999_ms",
+        "max_ms", "errors",
+    };
+    auto find = [](const Summary& summary, const char* name, double& value) {
+        for (const auto& entry : summary) {
+            if (entry.first == name) {
+                value = entry.second;
+                return true;
+            }
+        }
+        return false;
+    };
+    printf("Compared with the saved run:\n");
+    for (const char* name : compared) {
+        double was, now;
+        if (!find(before, name, was) || !find(after, name, now)) {
+            continue;
+        }
+        printf("  %-20s %12.3f -> %12.3f", name, was, now);
+        if (was != 0) {
+            bool higherIsBetter = strstr(name, "_per_second") != nullptr;
+            double change = (now - was) / was * 100;
+            bool better = higherIsBetter ? change > 0 : change < 0;
+            printf("  %+7.1f%%%s", change, change == 0 ? "" : better ? "  better" : "  worse");
+        }
+        printf("\n");
+    }
+}
+
+} // namespace
+
+int main(int argc, char** argv) {
+    Options options;
+    if (!parseOptions(argc, argv, options)) {
+        usage(argv[0]);
+        return 2;
+    }
+    signal(SIGPIPE, SIG_IGN);
+    
+    struct sockaddr_storage address;
+    socklen_t addressLength = 0;
+    if (!resolve(options, address, addressLength)) {
+        fprintf(stderr, "Can't resolve %s\n", options.host.c_str());
+        return 1;
+    }
+    // Replay: one script per captured connection, handed out round-robin in order
+    // of their first request
+    std::vector<TrafficCapture::Record> records;
+    std::vector<Script> scripts;
+    if (!options.replayFile.empty()) {
+        if (!TrafficCapture::read(options.replayFile, records)) {
+            fprintf(stderr, "%s is not a readable traffic capture\n", options.replayFile.c_str());
+            return 1;
+        }
+        std::map<std::pair<uint32_t, uint32_t>, size_t> byConnection;
+        for (const TrafficCapture::Record& record : records) {
+            auto key = std::make_pair(record.client, record.connection);
+            auto it = byConnection.emplace(key, scripts.size()).first;
+            if (it->second == scripts.size()) {
+                scripts.emplace_back();
+            }
+            scripts[it->second].push_back(&record);
+        }
+        auto byStart = [](const TrafficCapture::Record* a, const TrafficCapture::Record* b) {
+            return a->startUs < b->startUs;
+        };
+        for (Script& script : scripts) {
+            std::stable_sort(script.begin(), script.end(), byStart);
+        }
+        std::stable_sort(scripts.begin(), scripts.end(), [&byStart](const Script& a, const Script& b) {
+            return byStart(a.front(), b.front());
+        });
+        if (scripts.empty()) {
+            fprintf(stderr, "%s has no requests\n", options.replayFile.c_str());
+            return 1;
+        }
+        int threads = options.threads > 0 ? options.threads
+                                          : static_cast<int>(std::max(1u, std::thread::hardware_concurrency()));
+        options.threads = static_cast<int>(std::min<size_t>(threads, scripts.size()));
+        options.connections = static_cast<int>(scripts.size());
+    }
+    
+    if (options.rangeBytes > 0 || !options.verifyFile.empty()) {
+        for (Target& target : options.targets) {
+            if (!probe(options, address, addressLength, target)) {
+                return 1;
+            }
+        }
+    }
+    
+    const uint8_t* verifyData = nullptr;
+    int64_t verifyLength = 0;
+    if (!options.verifyFile.empty()) {
+        int fd = open(options.verifyFile.c_str(), O_RDONLY | O_CLOEXEC);
+        struct stat st;
+        if (fd < 0 || fstat(fd, &st) != 0) {
+            perror(options.verifyFile.c_str());
+            return 1;
+        }
+        verifyLength = st.st_size;
+        if (verifyLength != options.targets[0].length) {
+            fprintf(stderr, "%s is %lld bytes but %s serves %lld\n", options.verifyFile.c_str(),
+                    static_cast<long long>(verifyLength), options.targets[0].path.c_str(),
+                    static_cast<long long>(options.targets[0].length));
+            return 1;
+        }
+        if (verifyLength > 0) {
+            void* mapped = mmap(nullptr, verifyLength, PROT_READ, MAP_PRIVATE, fd, 0);
+            if (mapped == MAP_FAILED) {
+                perror("mmap");
+                return 1;
+            }
+            verifyData = static_cast<const uint8_t*>(mapped);
+        }
+        close(fd);
+    }
+    
+    int64_t startNs = nowNs();
+    int64_t deadlineNs = startNs + static_cast<int64_t>(options.durationSeconds * 1e9);
+    std::atomic<int64_t> requestBudget(options.maxRequests);
+    std::vector<std::unique_ptr<Worker>> workers;
+    for (int i = 0; i < options.threads; i++) {
+        // Connections split as evenly as possible
+        int connections = options.connections / options.threads +
+                          (i < options.connections % options.threads ? 1 : 0);
+        workers.push_back(std::make_unique<Worker>(options, address, addressLength, connections,
+                                                   verifyData, verifyLength, deadlineNs,
+                                                   requestBudget, 0x9e3779b97f4a7c15ULL * (i + 1)));
+        if (!scripts.empty()) {
+            std::vector<const Script*> assigned;
+            for (size_t j = i; j < scripts.size(); j += options.threads) {
+                assigned.push_back(&scripts[j]);
+            }
+            workers.back()->setReplay(std::move(assigned), startNs);
+        }
+    }
+    std::vector<std::thread> threads;
+    for (auto& worker : workers) {
+        threads.emplace_back(&Worker::run, worker.get());
+    }
+    for (std::thread& thread : threads) {
+        thread.join();
+    }
+    double elapsed = (nowNs() - startNs) / 1e9;
+    
+    Result total;
+    for (auto& worker : workers) {
+        Result& result = worker->result();
+        total.requests += result.requests;
+        total.errors += result.errors;
+        total.badStatus += result.badStatus;
+        total.verifyFailures += result.verifyFailures;
+        total.bytes += result.bytes;
+        total.connects += result.connects;
+        total.skipped += result.skipped;
+        total.statusChanged += result.statusChanged;
+        total.latencyUs.insert(total.latencyUs.end(), result.latencyUs.begin(),
+                               result.latencyUs.end());
+    }
+    std::sort(total.latencyUs.begin(), total.latencyUs.end());
+    auto percentile = [&total](double p) {
+        if (total.latencyUs.empty()) {
+            return 0.0;
+        }
+        size_t index = std::min(total.latencyUs.size() - 1,
+                                static_cast<size_t>(p * total.latencyUs.size()));
+        return total.latencyUs[index] / 1000.0;
+    };
+    
+    if (!scripts.empty()) {
+        double spanSeconds = 0;
+        for (const TrafficCapture::Record& record : records) {
+            spanSeconds = std::max(spanSeconds, (record.startUs + record.durationUs) / 1e6);
+        }
+        char speed[32] = "full";
+        if (options.speed > 0) {
+            snprintf(speed, sizeof(speed), "%gx", options.speed);
+        }
+        printf("Replayed:    %zu captured requests spanning %.2f s at %s speed, "
+               "%lld uploads skipped\n",
+               records.size(), spanSeconds, speed, static_cast<long long>(total.skipped));
+        printf("Status:      %lld responses differ from the capture\n",
+               static_cast<long long>(total.statusChanged));
+    }
+    printf("Requests:    %lld in %.2f s over %lld connections (%d threads)\n",
+           static_cast<long long>(total.requests), elapsed, static_cast<long long>(total.connects),
+           options.threads);
+    printf("Errors:      %lld failed, %lld non-2xx", static_cast<long long>(total.errors),
+           static_cast<long long>(total.badStatus));
+    if (verifyData || !options.verifyFile.empty()) {
+        printf(", %lld verify failures", static_cast<long long>(total.verifyFailures));
+    }
+    printf("\n");
+    printf("Throughput:  %.1f req/s, %.2f MiB/s\n", total.requests / elapsed,
+           total.bytes / elapsed / (1 << 20));
+    printf("Latency ms:  p50 %.3f  p90 %.3f  p99 %.3f  p99.9 %.3f  max %.3f\n",
+           percentile(0.5), percentile(0.9), percentile(0.99), percentile(0.999),
+           total.latencyUs.empty() ? 0.0 : total.latencyUs.back() / 1000.0);
+    
+    Summary summary = {
+        {"requests", static_cast<double>(total.requests)},
+        {"errors", static_cast<double>(total.errors)},
+        {"non_2xx", static_cast<double>(total.badStatus)},
+        {"seconds", elapsed},
+        {"bytes", static_cast<double>(total.bytes)},
+        {"requests_per_second", total.requests / elapsed},
+        {"mib_per_second", total.bytes / elapsed / (1 << 20)},
+        {"p50_ms", percentile(0.5)},
+        {"p90_ms", percentile(0.9)},
+        {"p99_ms", percentile(0.99)},
+        {"p999_ms", percentile(0.999)},
+        {"max_ms", total.latencyUs.empty() ? 0.0 : total.latencyUs.back() / 1000.0},
+    };
+    if (!options.compareFile.empty()) {
+        Summary before;
+        if (readSummary(options.compareFile, before)) {
+            printComparison(before, summary);
+        } else {
+            fprintf(stderr, "%s has no saved summary\n", options.compareFile.c_str());
+        }
+    }
+    if (!options.jsonFile.empty()) {
+        writeSummary(options.jsonFile, summary);
+    }
+    
+    if (verifyData) {
+        munmap(const_cast<uint8_t*>(verifyData), verifyLength);
+    }
+    return total.errors > 0 || total.verifyFailures > 0 ? 1 : 0;
+}
@@ -0,0 +1,375 @@
+#include "http_parser.h"
+
+#include <cstring>
+
+namespace {
+
+// RFC 9110 token characters, as a table built at compile time
+struct TokenTable {
+    bool allowed[256];
+    
+    constexpr TokenTable() : allowed() {
+        for (int c = '0'; c <= '9'; c++) allowed[c] = true;
+        for (int c = 'a'; c <= 'z'; c++) allowed[c] = allowed[c - 'a' + 'A'] = true;
+        const char symbols[] = "!#$%&'*+-.^_`|~";
+        for (size_t i = 0; i < sizeof(symbols) - 1; i++) {
+            allowed[static_cast<unsigned char>(symbols[i])] = true;
+        }
+    }
+};
+
+constexpr TokenTable kTokenTable;
+
+inline bool isTokenChar(unsigned char c) {
+    return kTokenTable.allowed[c];
+}
+
+std::string_view trim(std::string_view s) {
+    while (!s.empty() && (s.front() == ' ' || s.front() == '\t')) s.remove_prefix(1);
+    while (!s.empty() && (s.back() == ' ' || s.back() == '\t')) s.remove_suffix(1);
+    return s;
+}
+
+struct KnownHeader {
+    std::string_view name;
+    HttpHeader id;
+};
+
+const KnownHeader kKnownHeaders[] = {
+    {"authorization", HttpHeader::Authorization},
+    {"range", HttpHeader::Range},
+    {"if-range", HttpHeader::IfRange},
+    {"if-none-match", HttpHeader::IfNoneMatch},
+    {"if-modified-since", HttpHeader::IfModifiedSince},
+    {"accept-encoding", HttpHeader::AcceptEncoding},
+    {"connection", HttpHeader::Connection},
+    {"content-length", HttpHeader::ContentLength},
+    {"transfer-encoding", HttpHeader::TransferEncoding},
+    {"expect", HttpHeader::Expect},
+    {"cookie", HttpHeader::Cookie},
+};
+
+// Bucketed by name length so most headers are rejected without a string compare
+int lookupKnownHeader(std::string_view name) {
+    auto match = [&](size_t index) {
+        return HttpParser::equalsIgnoreCase(kKnownHeaders[index].name, name)
+            ? static_cast<int>(kKnownHeaders[index].id) : -1;
+    };
+    switch (name.size()) {
+        case 5: return match(1);                                    // range
+        case 6: {
+            int id = match(9);                                      // expect
+            return id >= 0 ? id : match(10);                        // cookie
+        }
+        case 8: return match(2);                                    // if-range
+        case 10: return match(6);                                   // connection
+        case 13: {
+            int id = match(0);                                      // authorization
+            return id >= 0 ? id : match(3);                         // if-none-match
+        }
+        case 14: return match(7);                                   // content-length
+        case 15: return match(5);                                   // accept-encoding
+        case 17: {
+            int id = match(4);                                      // if-modified-since
+            return id >= 0 ? id : match(8);                         // transfer-encoding
+        }
+        default: return -1;
+    }
+}
+
+} // namespace
+
+void HttpRequest::clear() {
+    method = target = path = query = version = std::string_view();
+    for (auto& slot : known) {
+        slot = std::string_view();
+    }
+    otherCount = 0;
+    headBytes = 0;
+}
+
+std::string_view HttpRequest::header(std::string_view name) const {
+    int id = lookupKnownHeader(name);
+    if (id >= 0) {
+        return known[id];
+    }
+    for (size_t i = 0; i < otherCount; i++) {
+        if (HttpParser::equalsIgnoreCase(others[i].name, name)) {
+            return others[i].value;
+        }
+    }
+    return std::string_view();
+}
+
+bool HttpParser::equalsIgnoreCase(std::string_view a, std::string_view b) {
+    if (a.size() != b.size()) {
+        return false;
+    }
+    for (size_t i = 0; i < a.size(); i++) {
+        unsigned char x = a[i];
+        unsigned char y = b[i];
+        if (x != y) {
+            // Only letters may differ, and only in the case bit
+            if ((x ^ y) != 0x20 || (x | 0x20) < 'a' || (x | 0x20) > 'z') {
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+void HttpParser::reset() {
+    offset_ = 0;
+    scanned_ = 0;
+    state_ = State::RequestLine;
+}
+
+HttpParser::Status HttpParser::parse(const char* data, size_t length, HttpRequest& request) {
+    while (offset_ < length) {
+        // Resume the newline search where the previous call gave up
+        const char* lineStart = data + offset_;
+        size_t searchFrom = scanned_ > offset_ ? scanned_ : offset_;
+        const char* newline = static_cast<const char*>(
+            memchr(data + searchFrom, '\n', length - searchFrom));
+        if (!newline) {
+            scanned_ = length;
+            return Status::Incomplete;
+        }
+        
+        size_t lineLength = newline - lineStart;
+        offset_ += lineLength + 1;
+        if (lineLength > 0 && lineStart[lineLength - 1] == '\r') {
+            lineLength--;
+        }
+        std::string_view line(lineStart, lineLength);
+        
+        if (state_ == State::RequestLine) {
+            if (line.empty()) {
+                // Tolerate stray CRLFs between pipelined requests (RFC 9112 2.2)
+                continue;
+            }
+            request.clear();
+            if (!parseRequestLine(line, request)) {
+                return Status::BadRequest;
+            }
+            state_ = State::Headers;
+            continue;
+        }
+        
+        if (line.empty()) {
+            request.headBytes = offset_;
+            return Status::Complete;
+        }
+        
+        bool tooMany = false;
+        if (!parseHeaderLine(line, request, tooMany)) {
+            return tooMany ? Status::TooLarge : Status::BadRequest;
+        }
+    }
+    return Status::Incomplete;
+}
+
+bool HttpParser::parseRequestLine(std::string_view line, HttpRequest& request) {
+    // method SP request-target SP HTTP-version
+    size_t firstSpace = line.find(' ');
+    if (firstSpace == std::string_view::npos || firstSpace == 0) {
+        return false;
+    }
+    size_t secondSpace = line.find(' ', firstSpace + 1);
+    if (secondSpace == std::string_view::npos || secondSpace == firstSpace + 1) {
+        return false;
+    }
+    
+    request.method = line.substr(0, firstSpace);
+    request.target = line.substr(firstSpace + 1, secondSpace - firstSpace - 1);
+    request.version = line.substr(secondSpace + 1);
+    
+    for (unsigned char c : request.method) {
+        if (!isTokenChar(c)) {
+            return false;
+        }
+    }
+    for (unsigned char c : request.target) {
+        if (c <= ' ' || c == 0x7f) {
+            return false;
+        }
+    }
+    const std::string_view& v = request.version;
+    if (v.size() != 8 || v.substr(0, 5) != "HTTP/" || v[5] < '0' || v[5] > '9' ||
+        v[6] != '.' || v[7] < '0' || v[7] > '9') {
+        return false;
+    }
+    
+    size_t question = request.target.find('?');
+    if (question == std::string_view::npos) {
+        request.path = request.target;
+    } else {
+        request.path = request.target.substr(0, question);
+        request.query = request.target.substr(question + 1);
+    }
+    return true;
+}
+
+bool HttpParser::parseHeaderLine(std::string_view line, HttpRequest& request, bool& tooMany) {
+    if (line[0] == ' ' || line[0] == '\t') {
+        // Obsolete line folding
+        return false;
+    }
+    
+    size_t colon = 0;
+    while (colon < line.size() && isTokenChar(static_cast<unsigned char>(line[colon]))) {
+        colon++;
+    }
+    // No whitespace (or anything else) allowed between the name and the colon
+    if (colon == 0 || colon == line.size() || line[colon] != ':') {
+        return false;
+    }
+    
+    std::string_view name = line.substr(0, colon);
+    std::string_view value = trim(line.substr(colon + 1));
+    for (unsigned char c : value) {
+        if ((c < ' ' && c != '\t') || c == 0x7f) {
+            return false;
+        }
+    }
+    
+    int id = lookupKnownHeader(name);
+    if (id >= 0) {
+        std::string_view& slot = request.known[id];
+        if (slot.data() != nullptr) {
+            // Conflicting framing headers are a smuggling vector; otherwise keep the first
+            if (id == static_cast<int>(HttpHeader::ContentLength) && slot != value) {
+                return false;
+            }
+            return true;
+        }
+        slot = value;
+        return true;
+    }
+    
+    if (request.otherCount >= HttpRequest::MAX_OTHER_HEADERS) {
+        tooMany = true;
+        return false;
+    }
+    request.others[request.otherCount++] = {name, value};
+    return true;
+}
+
+bool headerHasToken(std::string_view value, std::string_view token) {
+    while (!value.empty()) {
+        size_t comma = value.find(',');
+        std::string_view item = value.substr(0, comma);
+        size_t semicolon = item.find(';');
+        if (semicolon != std::string_view::npos) {
+            item = item.substr(0, semicolon);
+        }
+        if (HttpParser::equalsIgnoreCase(trim(item), token)) {
+            return true;
+        }
+        if (comma == std::string_view::npos) {
+            break;
+        }
+        value.remove_prefix(comma + 1);
+    }
+    return false;
+}
+
+bool acceptsEncoding(std::string_view acceptEncoding, std::string_view coding) {
+    bool wildcard = false;
+    while (!acceptEncoding.empty()) {
+        size_t comma = acceptEncoding.find(',');
+        std::string_view item = acceptEncoding.substr(0, comma);
+        std::string_view params;
+        size_t semicolon = item.find(';');
+        if (semicolon != std::string_view::npos) {
+            params = item.substr(semicolon + 1);
+            item = item.substr(0, semicolon);
+        }
+        item = trim(item);
+        
+        // Only "q=0", "q=0.0" etc. refuse a coding; any other weight accepts it
+        bool refused = false;
+        params = trim(params);
+        if (params.size() >= 3 && (params[0] == 'q' || params[0] == 'Q') && params[1] == '=') {
+            std::string_view weight = trim(params.substr(2));
+            refused = !weight.empty() && weight[0] == '0' &&
+                      weight.find_first_not_of("0.", 1) == std::string_view::npos;
+        }
+        
+        if (HttpParser::equalsIgnoreCase(item, coding)) {
+            return !refused;
+        }
+        if (item == "*") {
+            wildcard = !refused;
+        }
+        if (comma == std::string_view::npos) {
+            break;
+        }
+        acceptEncoding.remove_prefix(comma + 1);
+    }
+    return wildcard;
+}
+
+bool etagListMatches(std::string_view list, std::string_view etag) {
+    if (etag.size() >= 2 && etag.substr(0, 2) == "W/") {
+        etag.remove_prefix(2);
+    }
+    list = trim(list);
+    if (list == "*") {
+        return true;
+    }
+    size_t pos = 0;
+    while (pos < list.size()) {
+        // Commas are legal inside an opaque tag, so walk quoted strings rather than split
+        while (pos < list.size() && (list[pos] == ',' || list[pos] == ' ' || list[pos] == '\t')) {
+            pos++;
+        }
+        if (list.compare(pos, 2, "W/") == 0) {
+            pos += 2;
+        }
+        if (pos >= list.size() || list[pos] != '"') {
+            return false;
+        }
+        size_t close = list.find('"', pos + 1);
+        if (close == std::string_view::npos) {
+            return false;
+        }
+        if (list.substr(pos, close - pos + 1) == etag) {
+            return true;
+        }
+        pos = close + 1;
+    }
+    return false;
+}
+
+std::string_view queryParameter(std::string_view query, std::string_view name) {
+    while (!query.empty()) {
+        size_t amp = query.find('&');
+        std::string_view pair = query.substr(0, amp);
+        size_t equals = pair.find('=');
+        std::string_view key = pair.substr(0, equals);
+        if (key == name) {
+            // "?flag" counts as present with an empty value
+            return equals == std::string_view::npos ? pair.substr(pair.size()) : pair.substr(equals + 1);
+        }
+        if (amp == std::string_view::npos) {
+            break;
+        }
+        query.remove_prefix(amp + 1);
+    }
+    return std::string_view();
+}
+
+bool parseDecimal(std::string_view value, uint64_t& out) {
+    if (value.empty() || value.size() > 18) {
+        return false;
+    }
+    out = 0;
+    for (char c : value) {
+        if (c < '0' || c > '9') {
+            return false;
+        }
+        out = out * 10 + (c - '0');
+    }
+    return true;
+}
@@ -0,0 +1,107 @@
+#pragma once
+
+#include <string_view>
+#include <cstddef>
+#include <cstdint>
+
+// Headers the server acts on get a fixed slot so lookups are an array index
+enum class HttpHeader : uint8_t {
+    Authorization,
+    Range,
+    IfRange,
+    IfNoneMatch,
+    IfModifiedSince,
+    AcceptEncoding,
+    Connection,
+    ContentLength,
+    TransferEncoding,
+    Expect,
+    Cookie,
+    Count
+};
+
+// A parsed request head. Every view points into the connection's receive
+// buffer and is only valid until that buffer is compacted.
+struct HttpRequest {
+    static constexpr size_t MAX_OTHER_HEADERS = 48;
+    
+    struct Field {
+        std::string_view name;
+        std::string_view value;
+    };
+    
+    std::string_view method;
+    std::string_view target;    // As sent, e.g. "/download/abc?x=1"
+    std::string_view path;      // target up to '?'
+    std::string_view query;     // After '?', empty if none
+    std::string_view version;   // "HTTP/1.1"
+    
+    std::string_view known[static_cast<size_t>(HttpHeader::Count)];
+    Field others[MAX_OTHER_HEADERS];
+    size_t otherCount = 0;
+    
+    size_t headBytes = 0;       // Request line + headers + blank line
+    
+    // Absent headers come back with data() == nullptr
+    std::string_view header(HttpHeader h) const { return known[static_cast<size_t>(h)]; }
+    bool hasHeader(HttpHeader h) const { return header(h).data() != nullptr; }
+    // Case-insensitive lookup for headers without a fixed slot
+    std::string_view header(std::string_view name) const;
+    
+    bool isHttp11() const { return version == "HTTP/1.1"; }
+    
+    // Cheaper than assigning a fresh HttpRequest: unused 'others' slots stay stale
+    void clear();
+};
+
+// Resumable single-pass parser for a request head. Feed it the same buffer
+// again as more bytes arrive; it continues where it stopped and never copies
+// or allocates.
+class HttpParser {
+public:
+    enum class Status {
+        Incomplete,     // Need more bytes
+        Complete,       // request.headBytes bytes form the request head
+        BadRequest,     // Malformed request line or header
+        TooLarge,       // Too many headers (buffer size is enforced by the caller)
+    };
+    
+    HttpParser() = default;
+    
+    void reset();
+    Status parse(const char* data, size_t length, HttpRequest& request);
+    
+    // Case-insensitive ASCII comparison
+    static bool equalsIgnoreCase(std::string_view a, std::string_view b);
+    
+private:
+    enum class State : uint8_t {
+        RequestLine,
+        Headers,
+    };
+    
+    bool parseRequestLine(std::string_view line, HttpRequest& request);
+    bool parseHeaderLine(std::string_view line, HttpRequest& request, bool& tooMany);
+    
+    uint32_t offset_ = 0;       // Bytes consumed into complete lines so far
+    uint32_t scanned_ = 0;      // Bytes already searched for the next newline
+    State state_ = State::RequestLine;
+};
+
+// True if a comma-separated header value lists the token (case-insensitive,
+// parameters after ';' ignored), e.g. headerHasToken("keep-alive, Upgrade", "upgrade")
+bool headerHasToken(std::string_view value, std::string_view token);
+
+// True if an Accept-Encoding value allows the content coding with a non-zero
+// q-value, either by name or through "*"
+bool acceptsEncoding(std::string_view acceptEncoding, std::string_view coding);
+
+// True if an If-None-Match / If-Match value is "*" or lists the entity tag,
+// using the weak comparison (a W/ prefix on either side is ignored)
+bool etagListMatches(std::string_view list, std::string_view etag);
+
+// Raw (still percent-encoded) value of a query parameter; data() == nullptr if absent
+std::string_view queryParameter(std::string_view query, std::string_view name);
+
+// Plain non-negative decimal (no sign, no spaces), at most 18 digits
+bool parseDecimal(std::string_view value, uint64_t& out);
@@ -0,0 +1,134 @@
+#include "http_range.h"
+
+#include <cctype>
+#include <algorithm>
+
+namespace HttpRange {
+
+namespace {
+
+constexpr size_t MAX_RANGES = 32;
+
+void skipSpaces(std::string_view s, size_t& pos) {
+    while (pos < s.size() && (s[pos] == ' ' || s[pos] == '\t')) {
+        pos++;
+    }
+}
+
+// Reads a run of digits; false if there are none or the value overflows
+bool readNumber(std::string_view s, size_t& pos, uint64_t& out) {
+    size_t start = pos;
+    out = 0;
+    while (pos < s.size() && isdigit(static_cast<unsigned char>(s[pos]))) {
+        uint64_t digit = s[pos] - '0';
+        if (out > (UINT64_MAX - digit) / 10) {
+            return false;
+        }
+        out = out * 10 + digit;
+        pos++;
+    }
+    return pos > start;
+}
+
+} // namespace
+
+Result parse(std::string_view header, uint64_t size, std::vector<ByteRange>& outRanges) {
+    outRanges.clear();
+    
+    size_t pos = 0;
+    skipSpaces(header, pos);
+    static const char unit[] = "bytes=";
+    for (size_t i = 0; i < sizeof(unit) - 1; i++, pos++) {
+        if (pos >= header.size() || tolower(static_cast<unsigned char>(header[pos])) != unit[i]) {
+            return Result::None;
+        }
+    }
+    
+    size_t specCount = 0;
+    while (true) {
+        skipSpaces(header, pos);
+        if (pos >= header.size()) {
+            break;
+        }
+        if (header[pos] == ',') {
+            // Empty list elements are allowed
+            pos++;
+            continue;
+        }
+        
+        if (++specCount > MAX_RANGES) {
+            // Too many ranges to be a legitimate client; just send everything
+            outRanges.clear();
+            return Result::None;
+        }
+        
+        uint64_t first = 0;
+        uint64_t last = 0;
+        if (header[pos] == '-') {
+            // Suffix range: the final N bytes
+            pos++;
+            uint64_t suffix;
+            if (!readNumber(header, pos, suffix)) {
+                outRanges.clear();
+                return Result::None;
+            }
+            if (suffix > 0 && size > 0) {
+                first = suffix >= size ? 0 : size - suffix;
+                outRanges.push_back({first, size - 1});
+            }
+        } else {
+            if (!readNumber(header, pos, first) || pos >= header.size() || header[pos] != '-') {
+                outRanges.clear();
+                return Result::None;
+            }
+            pos++;
+            bool openEnded = !readNumber(header, pos, last);
+            if (!openEnded && last < first) {
+                outRanges.clear();
+                return Result::None;
+            }
+            if (first < size) {
+                if (openEnded || last >= size) {
+                    last = size - 1;
+                }
+                outRanges.push_back({first, last});
+            }
+        }
+        
+        skipSpaces(header, pos);
+        if (pos < header.size()) {
+            if (header[pos] != ',') {
+                outRanges.clear();
+                return Result::None;
+            }
+            pos++;
+        }
+    }
+    
+    if (specCount == 0) {
+        return Result::None;
+    }
+    if (outRanges.size() > 1) {
+        // Overlapping or adjacent ranges become one (RFC 9110 14.2), so even
+        // "bytes=0-,0-,..." sends each byte at most once
+        std::sort(outRanges.begin(), outRanges.end(),
+                  [](const ByteRange& a, const ByteRange& b) { return a.first < b.first; });
+        size_t merged = 0;
+        for (size_t i = 1; i < outRanges.size(); i++) {
+            if (outRanges[i].first <= outRanges[merged].last + 1) {
+                outRanges[merged].last = std::max(outRanges[merged].last, outRanges[i].last);
+            } else {
+                outRanges[++merged] = outRanges[i];
+            }
+        }
+        outRanges.resize(merged + 1);
+    }
+    return outRanges.empty() ? Result::Unsatisfiable : Result::Satisfiable;
+}
+
+std::string contentRange(const ByteRange& range, uint64_t size) {
+    return "bytes " + std::to_string(range.first) + "-" + std::to_string(range.last) +
+           "/" + std::to_string(size);
+}
+
+} // namespace HttpRange
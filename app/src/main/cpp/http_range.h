@@ -0,0 +1,33 @@
+#pragma once
+
+#include <string>
+#include <string_view>
+#include <vector>
+#include <cstdint>
+
+// Byte-range request handling (RFC 9110 section 14)
+namespace HttpRange {
+
+// Inclusive byte range, already clamped to the representation size
+struct ByteRange {
+    uint64_t first;
+    uint64_t last;
+    
+    uint64_t length() const { return last - first + 1; }
+};
+
+enum class Result {
+    None,           // No usable Range header: send the full representation
+    Satisfiable,    // At least one range overlaps the file
+    Unsatisfiable,  // Well-formed, but nothing overlaps: 416
+};
+
+// Parses a "bytes=" Range header against a representation of the given size.
+// Malformed headers, other units and abusive range counts are ignored (None).
+// Satisfiable ranges come back in ascending order with overlaps merged.
+Result parse(std::string_view header, uint64_t size, std::vector<ByteRange>& outRanges);
+
+// "bytes first-last/size"
+std::string contentRange(const ByteRange& range, uint64_t size);
+
+} // namespace HttpRange
@@ -2,15 +2,30 @@
 #include "file_manager.h"
 #include "auth_manager.h"
 #include "web_frontend.h"
+#include "http_range.h"
+#include "http_parser.h"
+#include "upload_store.h"
+#include "gzip_encoder.h"
+#include "content_hasher.h"
 
 #include <sys/socket.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/sendfile.h>
+#include <sys/stat.h>
 #include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <linux/pkt_sched.h>
 #include <arpa/inet.h>
 #include <unistd.h>
 #include <fcntl.h>
 #include <cstring>
+#include <cctype>
 #include <sstream>
 #include <algorithm>
+#include <unordered_set>
+#include <chrono>
+#include <ctime>
 #include <android/log.h>
 
 #define LOG_TAG "HttpServer"
@@ -18,7 +33,17 @@
 #define LOGE(...) __android_log_print(ANDROID_LOG_ERROR, LOG_TAG, __VA_ARGS__)
 
 HttpServer::HttpServer() 
-    : serverSocket_(-1), running_(false), port_(0), 
+    : serverSocket_(-1), running_(false), port_(0), nextLoop_(0), drainDeadlineMs_(0),
+      workerCount_(std::max(1u, std::thread::hardware_concurrency())),
+      queueDepth_(DEFAULT_QUEUE_DEPTH), maxConnections_(DEFAULT_MAX_CONNECTIONS),
+      acceptedCount_(0), rejectedCount_(0), activeConnections_(0), queuedConnections_(0),
+      sendfileTransfers_(0), spliceTransfers_(0), copyTransfers_(0),
+      maxBulkTransfers_(DEFAULT_MAX_BULK_TRANSFERS), activeBulkTransfers_(0), waitingBulkTransfers_(0),
+      interactiveRequests_(0), interactiveQueueUs_(0), interactiveQueueMaxUs_(0),
+      bulkRequests_(0), bulkQueueUs_(0), bulkQueueMaxUs_(0),
+      keepAliveTimeoutMs_(DEFAULT_KEEP_ALIVE_TIMEOUT_MS),
+      maxRequestsPerConnection_(DEFAULT_MAX_REQUESTS_PER_CONNECTION),
+      uploadDirectory_(std::make_shared<const std::string>()), uploadSequence_(0),
       fileManager_(nullptr), authManager_(nullptr) {
     LOGI("HttpServer created");
 }
@@ -29,12 +54,202 @@ HttpServer::~HttpServer() {
 
 void HttpServer::setFileManager(FileManager* fm) {
     fileManager_ = fm;
+    uploadSessions_.setFileManager(fm);
 }
 
 void HttpServer::setAuthManager(AuthManager* am) {
     authManager_ = am;
 }
 
+void HttpServer::setLimits(int workerCount, int queueDepth, int maxConnections) {
+    if (running_) {
+        LOGI("Server running; limits apply on next start");
+    }
+    if (workerCount > 0) workerCount_ = workerCount;
+    if (queueDepth > 0) queueDepth_ = queueDepth;
+    if (maxConnections > 0) maxConnections_ = maxConnections;
+    LOGI("Limits: %d workers, queue depth %d, max %d connections",
+         workerCount_, queueDepth_, maxConnections_);
+}
+
+void HttpServer::setKeepAlive(int timeoutMs, int maxRequests) {
+    if (timeoutMs > 0) keepAliveTimeoutMs_ = timeoutMs;
+    if (maxRequests > 0) maxRequestsPerConnection_ = maxRequests;
+    LOGI("Keep-alive: %d ms idle timeout, %d requests per connection",
+         keepAliveTimeoutMs_.load(), maxRequestsPerConnection_.load());
+}
+
+void HttpServer::setBulkTransferLimit(int maxBulkTransfers) {
+    // A raised limit lets waiting transfers in at the loops' next sweep
+    if (maxBulkTransfers > 0) maxBulkTransfers_ = maxBulkTransfers;
+    LOGI("Bulk transfers: at most %d at once", maxBulkTransfers_.load());
+}
+
+void HttpServer::setRateLimits(int64_t globalBytesPerSecond, int64_t perClientBytesPerSecond,
+                               int64_t perTransferBytesPerSecond) {
+    rateLimiter_.setLimits(globalBytesPerSecond, perClientBytesPerSecond, perTransferBytesPerSecond);
+    LOGI("Rate limits (bytes/s): global %lld, per client %lld, per transfer %lld",
+         static_cast<long long>(globalBytesPerSecond), static_cast<long long>(perClientBytesPerSecond),
+         static_cast<long long>(perTransferBytesPerSecond));
+}
+
+void HttpServer::setCompressionCache(const std::string& directory, int64_t maxBytes) {
+    compressionCache_.configure(directory, maxBytes);
+    LOGI("Compression cache: %s", directory.empty() ? "disabled" : directory.c_str());
+}
+
+void HttpServer::setUploadDirectory(const std::string& directory) {
+    // Trailing slashes would double up when joined with file names
+    std::string trimmed = directory;
+    while (trimmed.size() > 1 && trimmed.back() == '/') {
+        trimmed.pop_back();
+    }
+    std::atomic_store(&uploadDirectory_, std::make_shared<const std::string>(trimmed));
+    LOGI("Upload directory: %s", trimmed.empty() ? "(disabled)" : trimmed.c_str());
+}
+
+HttpServer::Stats HttpServer::getStats() const {
+    Stats stats;
+    stats.acceptedConnections = acceptedCount_;
+    stats.rejectedConnections = rejectedCount_;
+    stats.activeConnections = activeConnections_;
+    stats.queuedConnections = queuedConnections_;
+    stats.sendfileTransfers = sendfileTransfers_;
+    stats.spliceTransfers = spliceTransfers_;
+    stats.copyTransfers = copyTransfers_;
+    stats.workerCount = workerCount_;
+    stats.queueDepth = queueDepth_;
+    stats.maxConnections = maxConnections_;
+    stats.interactiveRequests = interactiveRequests_;
+    stats.interactiveQueueUs = interactiveQueueUs_;
+    stats.interactiveQueueMaxUs = interactiveQueueMaxUs_;
+    stats.bulkRequests = bulkRequests_;
+    stats.bulkQueueUs = bulkQueueUs_;
+    stats.bulkQueueMaxUs = bulkQueueMaxUs_;
+    stats.activeBulkTransfers = activeBulkTransfers_;
+    stats.waitingBulkTransfers = waitingBulkTransfers_;
+    stats.maxBulkTransfers = maxBulkTransfers_;
+    return stats;
+}
+
+std::string HttpServer::renderMetrics() const {
+    std::string out;
+    metrics_.render(out);
+    ServerMetrics::appendMetric(out, "fileserver_accepted_connections_total", "counter",
+                                "Connections accepted.", acceptedCount_);
+    ServerMetrics::appendMetric(out, "fileserver_rejected_connections_total", "counter",
+                                "Connections turned away with 503 at capacity.", rejectedCount_);
+    ServerMetrics::appendMetric(out, "fileserver_active_connections", "gauge",
+                                "Open client connections, including queued ones.", activeConnections_);
+    ServerMetrics::appendMetric(out, "fileserver_accept_queue_depth", "gauge",
+                                "Accepted connections not yet picked up by an event loop.",
+                                queuedConnections_);
+    ServerMetrics::appendMetric(out, "fileserver_active_bulk_transfers", "gauge",
+                                "Bulk transfers holding a slot.", activeBulkTransfers_);
+    ServerMetrics::appendMetric(out, "fileserver_waiting_bulk_transfers", "gauge",
+                                "Bulk transfers waiting for a slot.", waitingBulkTransfers_);
+    ServerMetrics::appendMetric(out, "fileserver_sendfile_transfers_total", "counter",
+                                "Bodies sent with sendfile.", sendfileTransfers_);
+    ServerMetrics::appendMetric(out, "fileserver_splice_transfers_total", "counter",
+                                "Bodies sent with splice through a pipe.", spliceTransfers_);
+    ServerMetrics::appendMetric(out, "fileserver_copy_transfers_total", "counter",
+                                "Bodies copied through user space.", copyTransfers_);
+    return out;
+}
+
+std::string HttpServer::exportTrace() const {
+    return tracer_.exportJson();
+}
+
+bool HttpServer::startCapture(const std::string& path) {
+    return capture_.start(path);
+}
+
+void HttpServer::stopCapture() {
+    capture_.stop();
+}
+
+int64_t HttpServer::nowMs() {
+    return std::chrono::duration_cast<std::chrono::milliseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+int64_t HttpServer::nowNs() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+std::string HttpServer::httpDate(time_t t) {
+    struct tm tm;
+    gmtime_r(&t, &tm);
+    char buffer[64];
+    strftime(buffer, sizeof(buffer), "%a, %d %b %Y %H:%M:%S GMT", &tm);
+    return buffer;
+}
+
+std::string HttpServer::contentDisposition(std::string_view filename) {
+    // Plain ASCII fallback, with anything that would need quoting replaced
+    std::string value = "attachment; filename=\"";
+    bool exact = true;
+    for (unsigned char c : filename) {
+        if (c < 0x20 || c >= 0x7f || c == '"' || c == '\\') {
+            value.push_back('_');
+            exact = false;
+        } else {
+            value.push_back(static_cast<char>(c));
+        }
+    }
+    value.push_back('"');
+    if (exact) {
+        return value;
+    }
+    
+    // The real name for clients that read filename* (RFC 8187 attr-chars kept as-is)
+    static const char hex[] = "0123456789ABCDEF";
+    value += "; filename*=UTF-8''";
+    for (unsigned char c : filename) {
+        if (isalnum(c) || (c != '\0' && strchr("!#$&+-.^_`|~", c))) {
+            value.push_back(static_cast<char>(c));
+        } else {
+            value.push_back('%');
+            value.push_back(hex[c >> 4]);
+            value.push_back(hex[c & 0xf]);
+        }
+    }
+    return value;
+}
+
+bool HttpServer::parseHttpDate(std::string_view value, time_t& out) {
+    // Only the IMF-fixdate form; obsolete formats just disable the check
+    char buffer[64];
+    if (value.size() >= sizeof(buffer)) {
+        return false;
+    }
+    memcpy(buffer, value.data(), value.size());
+    buffer[value.size()] = '\0';
+    
+    struct tm tm = {};
+    const char* end = strptime(buffer, "%a, %d %b %Y %H:%M:%S GMT", &tm);
+    if (!end || *end != '\0') {
+        return false;
+    }
+    out = timegm(&tm);
+    return out != static_cast<time_t>(-1);
+}
+
+bool HttpServer::isNotModified(const HttpRequest& request, const std::string& etag,
+                               time_t lastModified) {
+    if (request.hasHeader(HttpHeader::IfNoneMatch)) {
+        return !etag.empty() && etagListMatches(request.header(HttpHeader::IfNoneMatch), etag);
+    }
+    if (lastModified > 0 && request.hasHeader(HttpHeader::IfModifiedSince)) {
+        time_t since;
+        return parseHttpDate(request.header(HttpHeader::IfModifiedSince), since) &&
+               lastModified <= since;
+    }
+    return false;
+}
+
 bool HttpServer::start(int port) {
     if (running_) {
         LOGI("Server already running");
@@ -69,20 +284,66 @@ bool HttpServer::start(int port) {
     }
     
     // Listen
-    if (listen(serverSocket_, 10) < 0) {
+    if (listen(serverSocket_, SOMAXCONN) < 0) {
         LOGE("Failed to listen: %s", strerror(errno));
         close(serverSocket_);
         serverSocket_ = -1;
         return false;
     }
     
+    // Fixed pool of event loops (one per core by default)
+    for (int i = 0; i < workerCount_; i++) {
+        auto loop = std::make_unique<EventLoop>();
+        loop->epollFd = epoll_create1(EPOLL_CLOEXEC);
+        loop->wakeFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+        if (loop->epollFd < 0 || loop->wakeFd < 0) {
+            LOGE("Failed to create event loop: %s", strerror(errno));
+            if (loop->epollFd >= 0) close(loop->epollFd);
+            if (loop->wakeFd >= 0) close(loop->wakeFd);
+            break;
+        }
+        struct epoll_event ev;
+        memset(&ev, 0, sizeof(ev));
+        ev.events = EPOLLIN | EPOLLET;
+        ev.data.fd = loop->wakeFd;
+        epoll_ctl(loop->epollFd, EPOLL_CTL_ADD, loop->wakeFd, &ev);
+        loop->metrics = metrics_.shard(loops_.size());
+#if FILESERVER_TRACING
+        loop->traceRing = tracer_.ring(loops_.size());
+#endif
+        loops_.push_back(std::move(loop));
+    }
+    if (loops_.empty()) {
+        close(serverSocket_);
+        serverSocket_ = -1;
+        return false;
+    }
+    
+    // Port 0 binds an ephemeral port; report the one we got
+    struct sockaddr_in bound;
+    socklen_t boundLength = sizeof(bound);
+    if (getsockname(serverSocket_, reinterpret_cast<struct sockaddr*>(&bound), &boundLength) == 0) {
+        port = ntohs(bound.sin_port);
+    }
     port_ = port;
     running_ = true;
+    nextLoop_ = 0;
+    
+    for (auto& loop : loops_) {
+        loop->thread = std::thread(&HttpServer::runEventLoop, this, loop.get());
+    }
     
     // Start accept thread
     acceptThread_ = std::thread(&HttpServer::acceptLoop, this);
     
-    LOGI("Server started on port %d", port);
+    if (fileManager_) {
+        // Background hashing yields to downloads
+        fileManager_->setHashingThrottle([this] {
+            return activeBulkTransfers_.load(std::memory_order_relaxed) > 0;
+        });
+    }
+    
+    LOGI("Server started on port %d with %zu event loops", port, loops_.size());
     return true;
 }
 
@@ -91,6 +352,9 @@ void HttpServer::stop() {
         return;
     }
     
+    // In-flight responses get a grace period to finish before the loops
+    // tear their connections down
+    drainDeadlineMs_ = nowMs() + DRAIN_TIMEOUT_MS;
     running_ = false;
     
     // Close server socket to unblock accept
@@ -105,6 +369,24 @@ void HttpServer::stop() {
         acceptThread_.join();
     }
     
+    // Wake every loop so it notices running_
+    for (auto& loop : loops_) {
+        uint64_t one = 1;
+        write(loop->wakeFd, &one, sizeof(one));
+    }
+    for (auto& loop : loops_) {
+        if (loop->thread.joinable()) {
+            loop->thread.join();
+        }
+        close(loop->epollFd);
+        close(loop->wakeFd);
+    }
+    loops_.clear();
+    
+    if (fileManager_) {
+        fileManager_->setHashingThrottle(nullptr);
+    }
+    capture_.flush();
     LOGI("Server stopped");
 }
 
@@ -123,7 +405,8 @@ void HttpServer::acceptLoop() {
         struct sockaddr_in clientAddr;
         socklen_t clientLen = sizeof(clientAddr);
         
-        int clientSocket = accept(serverSocket_, (struct sockaddr*)&clientAddr, &clientLen);
+        int clientSocket = accept4(serverSocket_, (struct sockaddr*)&clientAddr, &clientLen,
+                                   SOCK_NONBLOCK | SOCK_CLOEXEC);
         if (clientSocket < 0) {
             if (running_) {
                 LOGE("Accept failed: %s", strerror(errno));
@@ -135,346 +418,1912 @@ void HttpServer::acceptLoop() {
         inet_ntop(AF_INET, &clientAddr.sin_addr, clientIp, INET_ADDRSTRLEN);
         LOGI("Connection from %s:%d", clientIp, ntohs(clientAddr.sin_port));
         
-        // Handle in new thread (simple approach)
-        std::thread([this, clientSocket]() {
-            handleClient(clientSocket);
-        }).detach();
+        // Small responses on persistent connections must not wait on Nagle
+        int noDelay = 1;
+        setsockopt(clientSocket, IPPROTO_TCP, TCP_NODELAY, &noDelay, sizeof(noDelay));
+        
+        // Admission control: answer 503 fast instead of queueing without bound
+        if (activeConnections_ >= maxConnections_ || !enqueueConnection(clientSocket)) {
+            rejectConnection(clientSocket);
+            continue;
+        }
+        acceptedCount_++;
     }
     
     LOGI("Accept loop ended");
 }
 
-void HttpServer::handleClient(int clientSocket) {
-    // Set socket timeout
-    struct timeval timeout;
-    timeout.tv_sec = 30;
-    timeout.tv_usec = 0;
-    setsockopt(clientSocket, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
-    
-    std::string method, path;
-    std::unordered_map<std::string, std::string> headers;
+bool HttpServer::enqueueConnection(int clientSocket) {
+    // Round-robin, skipping workers whose queue is full
+    for (size_t attempt = 0; attempt < loops_.size(); attempt++) {
+        EventLoop& loop = *loops_[nextLoop_];
+        nextLoop_ = (nextLoop_ + 1) % loops_.size();
+        {
+            std::lock_guard<std::mutex> lock(loop.pendingMutex);
+            if (loop.pending.size() >= static_cast<size_t>(queueDepth_)) {
+                continue;
+            }
+            PendingSocket socket{clientSocket, 0};
+            TRACE_DO(socket.acceptedNs = RequestTrace::now());
+            loop.pending.push_back(socket);
+        }
+        activeConnections_++;
+        queuedConnections_++;
+        uint64_t one = 1;
+        write(loop.wakeFd, &one, sizeof(one));
+        return true;
+    }
+    return false;
+}
+
+void HttpServer::rejectConnection(int clientSocket) {
+    rejectedCount_++;
+    LOGI("Server saturated, rejecting connection (active: %lld)",
+         static_cast<long long>(activeConnections_.load()));
     
-    std::string body = parseRequest(clientSocket, method, path, headers);
+    static const std::string body =
+        "<html><body><h1>503 Service Unavailable</h1></body></html>";
+    static const std::string response =
+        "HTTP/1.1 503 Service Unavailable\r\n"
+        "Retry-After: " + std::to_string(RETRY_AFTER_SECONDS) + "\r\n"
+        "Content-Type: text/html; charset=utf-8\r\n"
+        "Content-Length: " + std::to_string(body.size()) + "\r\n"
+        "Connection: close\r\n"
+        "\r\n" + body;
     
-    if (method.empty()) {
-        close(clientSocket);
-        return;
-    }
+    // Swallow whatever request bytes already arrived so close() doesn't reset
+    // the connection before the client reads the 503
+    char buffer[BUFFER_SIZE];
+    while (recv(clientSocket, buffer, BUFFER_SIZE, 0) > 0) {}
+    send(clientSocket, response.data(), response.size(), MSG_NOSIGNAL);
+    shutdown(clientSocket, SHUT_WR);
+    close(clientSocket);
+}
+
+void HttpServer::runEventLoop(EventLoop* loop) {
+    struct epoll_event events[MAX_EVENTS];
+    int64_t lastSweepMs = nowMs();
     
-    LOGI("Request: %s %s", method.c_str(), path.c_str());
+    bool draining = false;
     
-    // Check authentication
-    if (authManager_ && authManager_->hasCredentials()) {
-        auto authIt = headers.find("authorization");
-        if (authIt == headers.end() || !authManager_->validateCredentials(authIt->second)) {
-            // Send 401 Unauthorized
-            std::unordered_map<std::string, std::string> respHeaders;
-            respHeaders["WWW-Authenticate"] = "Basic realm=\"" + authManager_->getAuthRealm() + "\"";
-            respHeaders["Content-Type"] = "text/html; charset=utf-8";
-            sendResponse(clientSocket, 401, "Unauthorized", respHeaders,
-                        "<html><body><h1>401 Unauthorized</h1><p>Authentication required.</p></body></html>");
-            close(clientSocket);
-            return;
+    while (running_ || !loop->connections.empty()) {
+        if (!running_ && !draining) {
+            // Stop accepting new requests; let responses in flight finish
+            draining = true;
+            adoptPending(*loop);
+            std::vector<int> idle;
+            for (const auto& pair : loop->connections) {
+                if (pair.second->state == Connection::State::ReadingRequest) {
+                    idle.push_back(pair.first);
+                }
+            }
+            for (int fd : idle) {
+                closeConnection(*loop, fd);
+            }
+            continue;
         }
-    }
-    
-    // Route request
-    if (method == "GET") {
-        if (path == "/" || path == "/index.html") {
-            std::string html = handleIndexPage();
-            std::unordered_map<std::string, std::string> respHeaders;
-            respHeaders["Content-Type"] = "text/html; charset=utf-8";
-            sendResponse(clientSocket, 200, "OK", respHeaders, html);
+        if (draining && nowMs() >= drainDeadlineMs_) {
+            LOGI("Drain timeout, dropping %zu connections", loop->connections.size());
+            break;
         }
-        else if (path == "/api/files") {
-            std::string json = handleApiFiles();
-            std::unordered_map<std::string, std::string> respHeaders;
-            respHeaders["Content-Type"] = "application/json";
-            sendResponse(clientSocket, 200, "OK", respHeaders, json);
+        
+        int timeoutMs = draining ? 100 : 1000;
+        if (!loop->bulkReady.empty()) {
+            // Bulk transfers still have turns to take; just pick up new events first
+            timeoutMs = 0;
+        } else if (!loop->wakeups.empty()) {
+            timeoutMs = static_cast<int>(std::max<int64_t>(0, std::min<int64_t>(
+                timeoutMs, loop->wakeups.top().first - nowMs())));
         }
-        else if (path.rfind("/download/", 0) == 0) {
-            std::string fileId = path.substr(10); // Remove "/download/"
-            if (!handleFileDownload(clientSocket, fileId)) {
-                std::unordered_map<std::string, std::string> respHeaders;
-                respHeaders["Content-Type"] = "text/html; charset=utf-8";
-                sendResponse(clientSocket, 404, "Not Found", respHeaders,
-                            "<html><body><h1>404 Not Found</h1></body></html>");
+        int n = epoll_wait(loop->epollFd, events, MAX_EVENTS, timeoutMs);
+        if (n < 0 && errno != EINTR) {
+            LOGE("epoll_wait failed: %s", strerror(errno));
+            break;
+        }
+        
+        for (int i = 0; i < n; i++) {
+            int fd = events[i].data.fd;
+            if (fd == loop->wakeFd) {
+                uint64_t count;
+                while (read(loop->wakeFd, &count, sizeof(count)) > 0) {}
+                adoptPending(*loop);
+                admitBulkWaiting(*loop);
+                continue;
+            }
+            
+            auto it = loop->connections.find(fd);
+            if (it == loop->connections.end()) {
+                continue;
+            }
+            Connection& conn = *it->second;
+            if (events[i].events & (EPOLLERR | EPOLLHUP)) {
+                closeConnection(*loop, fd);
+            } else if (conn.bulkSlot) {
+                // Interactive connections are served first; this one waits for its turn
+                if (!conn.bulkQueued) {
+                    conn.bulkQueued = true;
+                    loop->bulkReady.push_back(fd);
+                }
+            } else if (!driveConnection(*loop, conn)) {
+                closeConnection(*loop, fd);
             }
         }
-        else {
-            // 404
-            std::unordered_map<std::string, std::string> respHeaders;
-            respHeaders["Content-Type"] = "text/html; charset=utf-8";
-            sendResponse(clientSocket, 404, "Not Found", respHeaders,
-                        "<html><body><h1>404 Not Found</h1></body></html>");
+        
+        int64_t now = nowMs();
+        resumeThrottled(*loop, now);
+        runBulkTurns(*loop);
+        if (now - lastSweepMs >= 1000) {
+            sweepIdleConnections(*loop, now);
+            admitBulkWaiting(*loop);
+            lastSweepMs = now;
         }
-    } else {
-        // Method not allowed
-        std::unordered_map<std::string, std::string> respHeaders;
-        respHeaders["Content-Type"] = "text/html; charset=utf-8";
-        sendResponse(clientSocket, 405, "Method Not Allowed", respHeaders,
-                    "<html><body><h1>405 Method Not Allowed</h1></body></html>");
     }
     
-    close(clientSocket);
+    // Shutting down: drop whatever is left
+    adoptPending(*loop);
+    while (!loop->connections.empty()) {
+        closeConnection(*loop, loop->connections.begin()->first);
+    }
 }
 
-std::string HttpServer::parseRequest(int clientSocket, std::string& method, std::string& path,
-                                     std::unordered_map<std::string, std::string>& headers) {
-    char buffer[BUFFER_SIZE];
-    std::string requestData;
-    
-    // Read request headers
-    while (requestData.find("\r\n\r\n") == std::string::npos && 
-           requestData.size() < MAX_HEADER_SIZE) {
-        ssize_t bytesRead = recv(clientSocket, buffer, BUFFER_SIZE - 1, 0);
-        if (bytesRead <= 0) {
-            break;
-        }
-        buffer[bytesRead] = '\0';
-        requestData += buffer;
-    }
-    
-    if (requestData.empty()) {
-        return "";
+void HttpServer::adoptPending(EventLoop& loop) {
+    std::deque<PendingSocket> pending;
+    {
+        std::lock_guard<std::mutex> lock(loop.pendingMutex);
+        pending.swap(loop.pending);
     }
-    
-    // Parse request line
-    std::istringstream stream(requestData);
-    std::string requestLine;
-    std::getline(stream, requestLine);
-    
-    // Remove trailing \r if present
-    if (!requestLine.empty() && requestLine.back() == '\r') {
-        requestLine.pop_back();
+    if (pending.empty() && running_) {
+        // Nothing of our own queued; help out a backed-up sibling
+        stealPending(loop, pending);
     }
+    queuedConnections_ -= pending.size();
     
-    // Parse method and path
-    std::istringstream lineStream(requestLine);
-    std::string httpVersion;
-    lineStream >> method >> path >> httpVersion;
-    
-    // Parse headers
-    std::string headerLine;
-    while (std::getline(stream, headerLine)) {
-        if (!headerLine.empty() && headerLine.back() == '\r') {
-            headerLine.pop_back();
+    for (const PendingSocket& socket : pending) {
+        int fd = socket.fd;
+        if (!running_) {
+            close(fd);
+            activeConnections_--;
+            continue;
         }
-        if (headerLine.empty()) {
-            break;
+        
+        auto conn = std::make_unique<Connection>();
+        conn->fd = fd;
+        conn->lastActivityMs = nowMs();
+        conn->metrics = loop.metrics;
+#if FILESERVER_TRACING
+        conn->traceRing = loop.traceRing;
+        conn->trace.ns[RequestTrace::Accepted] = socket.acceptedNs;
+        conn->trace.mark(RequestTrace::Adopted);
+#endif
+        
+        // Per-client rate limits key on the address
+        struct sockaddr_storage peer;
+        socklen_t peerLength = sizeof(peer);
+        if (getpeername(fd, reinterpret_cast<struct sockaddr*>(&peer), &peerLength) == 0) {
+            char address[INET6_ADDRSTRLEN] = "";
+            if (peer.ss_family == AF_INET) {
+                inet_ntop(AF_INET, &reinterpret_cast<struct sockaddr_in*>(&peer)->sin_addr,
+                          address, sizeof(address));
+            } else if (peer.ss_family == AF_INET6) {
+                inet_ntop(AF_INET6, &reinterpret_cast<struct sockaddr_in6*>(&peer)->sin6_addr,
+                          address, sizeof(address));
+            }
+            conn->peerAddress = address;
         }
         
-        size_t colonPos = headerLine.find(':');
-        if (colonPos != std::string::npos) {
-            std::string key = headerLine.substr(0, colonPos);
-            std::string value = headerLine.substr(colonPos + 1);
-            
-            // Trim and lowercase key
-            key.erase(0, key.find_first_not_of(" \t"));
-            key.erase(key.find_last_not_of(" \t") + 1);
-            std::transform(key.begin(), key.end(), key.begin(), ::tolower);
-            
-            // Trim value
-            value.erase(0, value.find_first_not_of(" \t"));
-            value.erase(value.find_last_not_of(" \t") + 1);
-            
-            headers[key] = value;
+        // Edge-triggered for both directions; the state machine decides what to do
+        struct epoll_event ev;
+        memset(&ev, 0, sizeof(ev));
+        ev.events = EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET;
+        ev.data.fd = fd;
+        if (epoll_ctl(loop.epollFd, EPOLL_CTL_ADD, fd, &ev) < 0) {
+            LOGE("Failed to register client socket: %s", strerror(errno));
+            close(fd);
+            activeConnections_--;
+            continue;
+        }
+        
+        Connection& ref = *conn;
+        loop.connections[fd] = std::move(conn);
+        
+        // Data may already be waiting; the edge for it has passed
+        if (!driveConnection(loop, ref)) {
+            closeConnection(loop, fd);
         }
     }
-    
-    // Extract body if present
-    size_t bodyStart = requestData.find("\r\n\r\n");
-    if (bodyStart != std::string::npos) {
-        return requestData.substr(bodyStart + 4);
+}
+
+bool HttpServer::stealPending(EventLoop& thief, std::deque<PendingSocket>& out) {
+    for (auto& other : loops_) {
+        if (other.get() == &thief) {
+            continue;
+        }
+        // Never wait on a sibling's lock; it is either enqueueing or adopting
+        std::unique_lock<std::mutex> lock(other->pendingMutex, std::try_to_lock);
+        if (!lock.owns_lock() || other->pending.size() < 2) {
+            continue;
+        }
+        // Take the newest half; the owner keeps the oldest
+        size_t take = other->pending.size() / 2;
+        for (size_t i = 0; i < take; i++) {
+            out.push_back(other->pending.back());
+            other->pending.pop_back();
+        }
+        return true;
     }
-    
-    return "";
+    return false;
 }
 
-void HttpServer::sendResponse(int clientSocket, int statusCode, const std::string& statusText,
-                              const std::unordered_map<std::string, std::string>& headers,
-                              const std::string& body) {
-    std::ostringstream response;
-    response << "HTTP/1.1 " << statusCode << " " << statusText << "\r\n";
-    
-    // Add headers
-    for (const auto& header : headers) {
-        response << header.first << ": " << header.second << "\r\n";
+void HttpServer::resumeThrottled(EventLoop& loop, int64_t now) {
+    while (!loop.wakeups.empty() && loop.wakeups.top().first <= now) {
+        std::pair<int64_t, int> wakeup = loop.wakeups.top();
+        loop.wakeups.pop();
+        auto it = loop.connections.find(wakeup.second);
+        if (it == loop.connections.end() || it->second->wakeAtMs != wakeup.first) {
+            // Closed, finished or rescheduled since
+            continue;
+        }
+        if (!driveConnection(loop, *it->second)) {
+            closeConnection(loop, wakeup.second);
+        }
     }
-    
-    // Content-Length
-    response << "Content-Length: " << body.size() << "\r\n";
-    response << "Connection: close\r\n";
-    response << "\r\n";
-    response << body;
-    
-    std::string responseStr = response.str();
-    send(clientSocket, responseStr.c_str(), responseStr.size(), 0);
 }
 
-void HttpServer::sendFileResponse(int clientSocket, int fd, size_t fileSize, 
-                                   const std::string& mimeType) {
-    std::ostringstream headers;
-    headers << "HTTP/1.1 200 OK\r\n";
-    headers << "Content-Type: " << mimeType << "\r\n";
-    headers << "Content-Length: " << fileSize << "\r\n";
-    headers << "Connection: close\r\n";
-    headers << "\r\n";
-    
-    std::string headerStr = headers.str();
-    send(clientSocket, headerStr.c_str(), headerStr.size(), 0);
-    
-    // Send file content
-    char buffer[BUFFER_SIZE];
-    ssize_t bytesRead;
-    while ((bytesRead = read(fd, buffer, BUFFER_SIZE)) > 0) {
-        ssize_t totalSent = 0;
-        while (totalSent < bytesRead) {
-            ssize_t sent = send(clientSocket, buffer + totalSent, bytesRead - totalSent, 0);
-            if (sent <= 0) {
-                return;
-            }
-            totalSent += sent;
+void HttpServer::runBulkTurns(EventLoop& loop) {
+    // One turn for each transfer that was due when the round started;
+    // the ones that yield again go to the back for the next round
+    size_t turns = loop.bulkReady.size();
+    for (size_t i = 0; i < turns && !loop.bulkReady.empty(); i++) {
+        int fd = loop.bulkReady.front();
+        loop.bulkReady.pop_front();
+        auto it = loop.connections.find(fd);
+        if (it == loop.connections.end() || !it->second->bulkQueued) {
+            continue;
+        }
+        it->second->bulkQueued = false;
+        if (!driveConnection(loop, *it->second)) {
+            closeConnection(loop, fd);
         }
     }
 }
 
-std::string HttpServer::handleIndexPage() {
-    return WebFrontend::getIndexHtml();
+bool HttpServer::acquireBulkSlot(Connection& conn) {
+    int64_t active = activeBulkTransfers_.load();
+    do {
+        if (active >= maxBulkTransfers_.load()) {
+            return false;
+        }
+    } while (!activeBulkTransfers_.compare_exchange_weak(active, active + 1));
+    
+    // pfifo_fast and similar qdiscs put TC_PRIO_BULK in the lowest band, so
+    // interactive responses also get ahead of bulk packets on the uplink
+    int priority = TC_PRIO_BULK;
+    setsockopt(conn.fd, SOL_SOCKET, SO_PRIORITY, &priority, sizeof(priority));
+    conn.bulkSlot = true;
+    return true;
 }
 
-std::string HttpServer::handleApiFiles() {
-    if (!fileManager_) {
-        return "[]";
+void HttpServer::releaseBulkSlot(Connection& conn) {
+    if (!conn.bulkSlot) {
+        return;
     }
+    conn.bulkSlot = false;
+    int priority = TC_PRIO_BESTEFFORT;
+    setsockopt(conn.fd, SOL_SOCKET, SO_PRIORITY, &priority, sizeof(priority));
+    activeBulkTransfers_--;
     
-    auto files = fileManager_->getFiles();
-    
-    std::ostringstream json;
-    json << "[";
-    
-    bool first = true;
-    for (const auto& file : files) {
-        if (!first) json << ",";
-        first = false;
-        
-        // Escape JSON strings
-        std::string escapedName = file.displayName;
-        // Simple escape for quotes
-        size_t pos = 0;
-        while ((pos = escapedName.find('"', pos)) != std::string::npos) {
-            escapedName.replace(pos, 1, "\\\"");
-            pos += 2;
+    // Let loops with waiting transfers know a slot is free
+    for (auto& loop : loops_) {
+        if (loop->bulkWaitingCount > 0) {
+            uint64_t one = 1;
+            write(loop->wakeFd, &one, sizeof(one));
         }
-        
-        json << "{\"id\":\"" << file.id << "\","
-             << "\"name\":\"" << escapedName << "\","
-             << "\"size\":" << file.size << "}";
     }
-    
-    json << "]";
-    return json.str();
 }
 
-bool HttpServer::handleFileDownload(int clientSocket, const std::string& fileId) {
-    if (!fileManager_) {
-        return false;
+void HttpServer::admitBulkWaiting(EventLoop& loop) {
+    while (!loop.bulkWaiting.empty()) {
+        int fd = loop.bulkWaiting.front();
+        auto it = loop.connections.find(fd);
+        if (it == loop.connections.end() || !it->second->bulkParked) {
+            loop.bulkWaiting.pop_front();
+            continue;
+        }
+        Connection& conn = *it->second;
+        if (!acquireBulkSlot(conn)) {
+            return;
+        }
+        loop.bulkWaiting.pop_front();
+        conn.bulkParked = false;
+        loop.bulkWaitingCount--;
+        waitingBulkTransfers_--;
+        if (!driveConnection(loop, conn)) {
+            closeConnection(loop, fd);
+        }
     }
-    
-    int fd;
-    size_t size;
-    std::string name;
-    
-    if (!fileManager_->openFile(fileId, fd, size, name)) {
-        return false;
+}
+
+void HttpServer::recordQueueTime(Connection& conn) {
+    if (conn.requestReadyUs == 0) {
+        return;
     }
+    int64_t waitedUs = nowNs() / 1000 - conn.requestReadyUs;
+    conn.requestReadyUs = 0;
     
-    std::string mimeType = getMimeType(name);
-    
-    // Build response with Content-Disposition for download
-    std::ostringstream headers;
-    headers << "HTTP/1.1 200 OK\r\n";
-    headers << "Content-Type: " << mimeType << "\r\n";
-    headers << "Content-Length: " << size << "\r\n";
-    headers << "Content-Disposition: attachment; filename=\"" << name << "\"\r\n";
-    headers << "Connection: close\r\n";
-    headers << "\r\n";
+    bool bulk = conn.priority == Connection::Priority::Bulk;
+    (bulk ? bulkRequests_ : interactiveRequests_)++;
+    (bulk ? bulkQueueUs_ : interactiveQueueUs_) += waitedUs;
+    std::atomic<int64_t>& maxUs = bulk ? bulkQueueMaxUs_ : interactiveQueueMaxUs_;
+    int64_t previous = maxUs.load();
+    while (waitedUs > previous && !maxUs.compare_exchange_weak(previous, waitedUs)) {}
+}
+
+void HttpServer::noteStatus(Connection& conn, int statusCode) {
+    conn.metrics->countRequest(conn.route, statusCode);
+    conn.responseStatus = statusCode;
+    TRACE_DO(conn.trace.status = statusCode);
+}
+
+void HttpServer::noteSent(Connection& conn, size_t bytes) {
+    conn.metrics->bytesSent.add(bytes);
+    conn.responseBytes += bytes;
+    TRACE_DO(conn.trace.bytesSent += bytes);
+    TRACE_MARK_ONCE(conn.trace, FirstByte);
+    if (!conn.firstByteSent && conn.requestStartUs != 0) {
+        conn.firstByteSent = true;
+        conn.metrics->firstByte.record(nowNs() / 1000 - conn.requestStartUs);
+    }
+}
+
+void HttpServer::noteResponseDone(Connection& conn) {
+    int64_t nowUs = nowNs() / 1000;
+    if (conn.requestStartUs != 0) {
+        conn.metrics->total.record(nowUs - conn.requestStartUs);
+    }
+    if (conn.capture) {
+        captureRequest(conn, nowUs);
+    }
+    conn.requestStartUs = 0;
+    conn.sessionCookie.clear();
+    conn.responseStatus = 0;
+    conn.responseBytes = 0;
+    conn.firstByteSent = false;
+    conn.route = ServerMetrics::Route::Other;
+#if FILESERVER_TRACING
+    conn.trace.mark(RequestTrace::Done);
+    conn.traceRing->record(conn.trace);
+    conn.trace.clear();
+#endif
+}
+
+void HttpServer::captureRequest(Connection& conn, int64_t nowUs) {
+    std::unique_ptr<TrafficCapture::Record> record = std::move(conn.capture);
+    if (conn.captureGeneration != capture_.generation()) {
+        // First request on this connection since the capture (re)started
+        capture_.assignIds(conn.peerAddress, conn.captureClient, conn.captureConnection);
+        conn.captureGeneration = capture_.generation();
+    }
+    int64_t startUs = conn.requestStartUs - capture_.startNs() / 1000;
+    record->startUs = startUs > 0 ? startUs : 0;
+    record->durationUs = conn.requestStartUs != 0 ? nowUs - conn.requestStartUs : 0;
+    record->client = conn.captureClient;
+    record->connection = conn.captureConnection;
+    record->status = conn.responseStatus;
+    record->bytesSent = conn.responseBytes;
+    capture_.append(*record);
+}
+
+void HttpServer::closeConnection(EventLoop& loop, int fd) {
+    auto it = loop.connections.find(fd);
+    if (it == loop.connections.end()) {
+        return;
+    }
     
-    std::string headerStr = headers.str();
-    send(clientSocket, headerStr.c_str(), headerStr.size(), 0);
+    if (it->second->bulkParked) {
+        // Its queue entry goes stale and is skipped
+        loop.bulkWaitingCount--;
+        waitingBulkTransfers_--;
+    }
+#if FILESERVER_TRACING
+    if (it->second->trace.ns[RequestTrace::Parsed] != 0) {
+        // Cut short (client gone, error mid-transfer): keep what it got through
+        it->second->trace.mark(RequestTrace::Done);
+        loop.traceRing->record(it->second->trace);
+    }
+#endif
+    if (it->second->capture) {
+        // Cut short: captured with what it got through
+        captureRequest(*it->second, nowNs() / 1000);
+    }
+    finishBody(*it->second);
+    releaseRequestBuffer(loop, *it->second);
+    epoll_ctl(loop.epollFd, EPOLL_CTL_DEL, fd, nullptr);
+    close(fd);
+    loop.connections.erase(it);
+    activeConnections_--;
+}
+
+void HttpServer::sweepIdleConnections(EventLoop& loop, int64_t now) {
+    std::vector<int> expired;
+    for (const auto& pair : loop.connections) {
+        const Connection& conn = *pair.second;
+        if (conn.bulkParked) {
+            // Waiting on other transfers, not on the client
+            continue;
+        }
+        // Persistent connections waiting for their next request use the keep-alive timeout
+        bool betweenRequests = conn.state == Connection::State::ReadingRequest &&
+                               conn.inLen == 0 && conn.requestCount > 0;
+        int64_t timeout = betweenRequests ? keepAliveTimeoutMs_.load() : IDLE_TIMEOUT_MS;
+        if (now - conn.lastActivityMs > timeout) {
+            expired.push_back(pair.first);
+        }
+    }
+    for (int fd : expired) {
+        LOGI("Closing idle connection (fd: %d)", fd);
+        closeConnection(loop, fd);
+    }
+}
+
+bool HttpServer::driveConnection(EventLoop& loop, Connection& conn) {
+    conn.lastActivityMs = nowMs();
+    conn.wakeAtMs = 0;
+    if (conn.bulkParked) {
+        // Nothing to do until a bulk slot frees up
+        return true;
+    }
+    conn.turnBytes = BULK_TURN_BYTES;
     
-    // Send file content
-    char buffer[BUFFER_SIZE];
-    ssize_t bytesRead;
-    while ((bytesRead = read(fd, buffer, BUFFER_SIZE)) > 0) {
-        ssize_t totalSent = 0;
-        while (totalSent < bytesRead) {
-            ssize_t sent = send(clientSocket, buffer + totalSent, bytesRead - totalSent, 0);
-            if (sent <= 0) {
-                close(fd);
+    while (true) {
+        if (conn.state == Connection::State::ReadingRequest) {
+            if (!readRequest(loop, conn)) {
+                return false;
+            }
+            if (conn.state == Connection::State::ReadingRequest) {
+                // Need more bytes
+                return true;
+            }
+        }
+        
+        if (conn.state == Connection::State::ReadingBody) {
+            if (!readBody(loop, conn)) {
+                return false;
+            }
+            if (conn.state == Connection::State::ReadingBody) {
+                // Waiting on the client (or on room for the 100 Continue)
+                return true;
+            }
+        }
+        
+        if (conn.priority == Connection::Priority::Bulk && !conn.bulkSlot) {
+            // Queue behind transfers already waiting, even if a slot happens to be free
+            if (waitingBulkTransfers_ > 0 || !acquireBulkSlot(conn)) {
+                conn.bulkParked = true;
+                loop.bulkWaiting.push_back(conn.fd);
+                loop.bulkWaitingCount++;
+                waitingBulkTransfers_++;
+                admitBulkWaiting(loop);
                 return true;
             }
-            totalSent += sent;
         }
+        recordQueueTime(conn);
+        
+        if (!writeResponse(conn)) {
+            return false;
+        }
+        if (conn.wakeAtMs > 0) {
+            // Rate limited: nothing will come from epoll, so set a timer
+            loop.wakeups.emplace(conn.wakeAtMs, conn.fd);
+            return true;
+        }
+        if (conn.turnOver) {
+            // Turn used up: let interactive work in before the next one
+            conn.turnOver = false;
+            if (!conn.bulkQueued) {
+                conn.bulkQueued = true;
+                loop.bulkReady.push_back(conn.fd);
+            }
+            return true;
+        }
+        if (conn.state != Connection::State::ReadingRequest) {
+            // Socket buffer full; wait for EPOLLOUT
+            return true;
+        }
+        // Response done on a persistent connection: serve the next (possibly
+        // already pipelined) request
     }
-    
-    close(fd);
-    return true;
 }
 
-std::string HttpServer::getMimeType(const std::string& filename) {
-    // Extract extension
-    size_t dotPos = filename.rfind('.');
-    if (dotPos == std::string::npos) {
-        return "application/octet-stream";
-    }
-    
-    std::string ext = filename.substr(dotPos + 1);
-    std::transform(ext.begin(), ext.end(), ext.begin(), ::tolower);
-    
-    // Common MIME types
-    static const std::unordered_map<std::string, std::string> mimeTypes = {
-        {"html", "text/html"},
-        {"htm", "text/html"},
-        {"css", "text/css"},
-        {"js", "application/javascript"},
-        {"json", "application/json"},
-        {"xml", "application/xml"},
-        {"txt", "text/plain"},
-        {"pdf", "application/pdf"},
-        {"doc", "application/msword"},
-        {"docx", "application/vnd.openxmlformats-officedocument.wordprocessingml.document"},
-        {"xls", "application/vnd.ms-excel"},
-        {"xlsx", "application/vnd.openxmlformats-officedocument.spreadsheetml.sheet"},
-        {"ppt", "application/vnd.ms-powerpoint"},
-        {"pptx", "application/vnd.openxmlformats-officedocument.presentationml.presentation"},
-        {"jpg", "image/jpeg"},
-        {"jpeg", "image/jpeg"},
-        {"png", "image/png"},
-        {"gif", "image/gif"},
-        {"webp", "image/webp"},
-        {"svg", "image/svg+xml"},
-        {"ico", "image/x-icon"},
-        {"mp3", "audio/mpeg"},
-        {"wav", "audio/wav"},
-        {"ogg", "audio/ogg"},
-        {"mp4", "video/mp4"},
-        {"webm", "video/webm"},
-        {"avi", "video/x-msvideo"},
-        {"mkv", "video/x-matroska"},
-        {"mov", "video/quicktime"},
-        {"zip", "application/zip"},
-        {"rar", "application/x-rar-compressed"},
-        {"7z", "application/x-7z-compressed"},
-        {"tar", "application/x-tar"},
-        {"gz", "application/gzip"},
-        {"apk", "application/vnd.android.package-archive"},
-    };
+bool HttpServer::readRequest(EventLoop& loop, Connection& conn) {
+    while (true) {
+        if (conn.inLen > 0) {
+            // Resumes where the last call stopped; also picks up pipelined requests
+            TRACE_MARK_ONCE(conn.trace, ReadStart);
+            HttpRequest& request = conn.reqBuf->request;
+            HttpParser::Status status = conn.parser.parse(conn.reqBuf->data, conn.inLen, request);
+            
+            if (status == HttpParser::Status::Complete) {
+                TRACE_MARK(conn.trace, Parsed);
+                handleRequest(conn, request);
+                
+                // Drop the consumed head; anything after it is the next request
+                size_t consumed = request.headBytes;
+                memmove(conn.reqBuf->data, conn.reqBuf->data + consumed, conn.inLen - consumed);
+                conn.inLen -= consumed;
+                conn.parser.reset();
+                if (conn.inLen == 0) {
+                    releaseRequestBuffer(loop, conn);
+                }
+                return true;
+            }
+            
+            if (status == HttpParser::Status::BadRequest) {
+                conn.state = Connection::State::WritingHeaders;
+                conn.keepAlive = false;
+                std::unordered_map<std::string, std::string> respHeaders;
+                respHeaders["Content-Type"] = "text/html; charset=utf-8";
+                sendResponse(conn, 400, "Bad Request", respHeaders,
+                            "<html><body><h1>400 Bad Request</h1></body></html>");
+                return true;
+            }
+            
+            if (status == HttpParser::Status::TooLarge || conn.inLen >= MAX_HEADER_SIZE) {
+                conn.state = Connection::State::WritingHeaders;
+                conn.keepAlive = false;
+                std::unordered_map<std::string, std::string> respHeaders;
+                respHeaders["Content-Type"] = "text/html; charset=utf-8";
+                sendResponse(conn, 431, "Request Header Fields Too Large", respHeaders,
+                            "<html><body><h1>431 Request Header Fields Too Large</h1></body></html>");
+                return true;
+            }
+        }
+        
+        if (!conn.reqBuf) {
+            conn.reqBuf = acquireRequestBuffer(loop);
+        }
+        ssize_t bytesRead = recv(conn.fd, conn.reqBuf->data + conn.inLen,
+                                 MAX_HEADER_SIZE - conn.inLen, 0);
+        if (bytesRead < 0) {
+            if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                if (conn.inLen == 0) {
+                    // Idle between requests: hand the buffer back to the loop
+                    releaseRequestBuffer(loop, conn);
+                }
+                return true;
+            }
+            if (errno == EINTR) {
+                continue;
+            }
+            return false;
+        }
+        if (bytesRead == 0) {
+            // Peer closed before sending a complete request
+            return false;
+        }
+        conn.metrics->bytesReceived.add(bytesRead);
+        TRACE_MARK_ONCE(conn.trace, ReadStart);
+        conn.inLen += bytesRead;
+    }
+}
+
+bool HttpServer::readBody(EventLoop& loop, Connection& conn) {
+    Connection::Upload& upload = *conn.upload;
+    
+    // The interim 100 Continue has to be out before the client sends the body
+    while (conn.outOffset < conn.outBuf.size()) {
+        ssize_t sent = send(conn.fd, conn.outBuf.data() + conn.outOffset,
+                            conn.outBuf.size() - conn.outOffset, MSG_NOSIGNAL);
+        if (sent < 0) {
+            if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                return true;
+            }
+            if (errno == EINTR) {
+                continue;
+            }
+            return false;
+        }
+        conn.metrics->bytesSent.add(sent);
+        conn.outOffset += sent;
+    }
+    conn.outBuf.clear();
+    conn.outOffset = 0;
+    
+    // Body bytes that arrived together with the request head
+    if (conn.inLen > 0 && upload.received < upload.length) {
+        size_t take = std::min<off_t>(conn.inLen, upload.length - upload.received);
+        if (!UploadStore::writeAt(upload.fd, conn.reqBuf->data, take,
+                                  upload.baseOffset + upload.received)) {
+            failUpload(conn, errno == ENOSPC ? 507 : 500,
+                       errno == ENOSPC ? "Insufficient Storage" : "Internal Server Error");
+            return true;
+        }
+        upload.received += take;
+        // Whatever follows the body is the next pipelined request
+        memmove(conn.reqBuf->data, conn.reqBuf->data + take, conn.inLen - take);
+        conn.inLen -= take;
+        if (conn.inLen == 0) {
+            releaseRequestBuffer(loop, conn);
+        }
+    }
+    
+    // The rest streams through one fixed buffer per loop, so memory use doesn't
+    // depend on the upload size or on how many uploads are running
+    if (loop.uploadBuffer.empty()) {
+        loop.uploadBuffer.resize(UPLOAD_CHUNK);
+    }
+    while (upload.received < upload.length) {
+        size_t want = std::min<off_t>(loop.uploadBuffer.size(), upload.length - upload.received);
+        ssize_t bytesRead = recv(conn.fd, loop.uploadBuffer.data(), want, 0);
+        if (bytesRead < 0) {
+            if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                return true;
+            }
+            if (errno == EINTR) {
+                continue;
+            }
+            return false;
+        }
+        if (bytesRead == 0) {
+            // Client gave up; finishBody removes the partial file
+            LOGE("Upload of %s aborted after %lld of %lld bytes", upload.name.c_str(),
+                 static_cast<long long>(upload.received), static_cast<long long>(upload.length));
+            return false;
+        }
+        conn.metrics->bytesReceived.add(bytesRead);
+        if (!UploadStore::writeAt(upload.fd, loop.uploadBuffer.data(), bytesRead,
+                                  upload.baseOffset + upload.received)) {
+            failUpload(conn, errno == ENOSPC ? 507 : 500,
+                       errno == ENOSPC ? "Insufficient Storage" : "Internal Server Error");
+            return true;
+        }
+        upload.received += bytesRead;
+    }
+    
+    finishUpload(conn);
+    return true;
+}
+
+std::unique_ptr<HttpServer::RequestBuffer> HttpServer::acquireRequestBuffer(EventLoop& loop) {
+    if (loop.freeBuffers.empty()) {
+        return std::make_unique<RequestBuffer>();
+    }
+    std::unique_ptr<RequestBuffer> buffer = std::move(loop.freeBuffers.back());
+    loop.freeBuffers.pop_back();
+    return buffer;
+}
+
+void HttpServer::releaseRequestBuffer(EventLoop& loop, Connection& conn) {
+    if (!conn.reqBuf) {
+        return;
+    }
+    if (loop.freeBuffers.size() < MAX_POOLED_BUFFERS) {
+        loop.freeBuffers.push_back(std::move(conn.reqBuf));
+    }
+    conn.reqBuf.reset();
+    conn.inLen = 0;
+    conn.parser.reset();
+}
+
+bool HttpServer::writeResponse(Connection& conn) {
+    while (true) {
+        // Drain buffered bytes first; hint the kernel to coalesce headers with the body
+        int flags = MSG_NOSIGNAL;
+        if ((conn.bodyFd >= 0 && (conn.bodyRemaining > 0 || conn.nextPart < conn.bodyParts.size())) ||
+            (conn.archive && !conn.archive->done())) {
+            flags |= MSG_MORE;
+        }
+        while (conn.outOffset < conn.outBuf.size()) {
+            ssize_t sent = send(conn.fd, conn.outBuf.data() + conn.outOffset,
+                                conn.outBuf.size() - conn.outOffset, flags);
+            if (sent < 0) {
+                if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                    return true;
+                }
+                if (errno == EINTR) {
+                    continue;
+                }
+                return false;
+            }
+            noteSent(conn, sent);
+            conn.outOffset += sent;
+        }
+        conn.outBuf.clear();
+        conn.outOffset = 0;
+        
+        while (!conn.staticBody.empty()) {
+            ssize_t sent = send(conn.fd, conn.staticBody.data(), conn.staticBody.size(), flags);
+            if (sent < 0) {
+                if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                    return true;
+                }
+                if (errno == EINTR) {
+                    continue;
+                }
+                return false;
+            }
+            noteSent(conn, sent);
+            conn.staticBody.remove_prefix(sent);
+        }
+        
+        if (conn.state == Connection::State::WritingHeaders) {
+            conn.state = Connection::State::StreamingBody;
+            if (conn.bodyFd >= 0 || conn.archive) {
+                conn.metrics->transfersStarted.add(1);
+                conn.transferCounted = true;
+            }
+        }
+        
+        if (conn.bodyFd >= 0 && conn.bodyRemaining <= 0 && conn.pipeBytes == 0 &&
+            conn.nextPart < conn.bodyParts.size()) {
+            // Next multipart section: its boundary/headers, then its slice of the file
+            Connection::BodyPart& part = conn.bodyParts[conn.nextPart++];
+            conn.outBuf.swap(part.prefix);
+            conn.bodyOffset = part.offset;
+            conn.bodyRemaining = part.length;
+            continue;
+        }
+        
+        if (conn.archive && !conn.archive->done() && conn.bodyRemaining <= 0 && conn.pipeBytes == 0) {
+            // Next archive entry (or the trailer)
+            if (!nextArchiveSegment(conn)) {
+                return false;
+            }
+            continue;
+        }
+        
+        if (conn.bodyFd < 0 || (conn.bodyRemaining <= 0 && conn.pipeBytes == 0)) {
+            // Response complete
+            noteResponseDone(conn);
+            if (!conn.keepAlive) {
+                return false;
+            }
+            finishBody(conn);
+            std::string().swap(conn.outBuf);
+            conn.state = Connection::State::ReadingRequest;
+            return true;
+        }
+        
+        size_t budget = SIZE_MAX;
+        if (conn.bulkSlot) {
+            if (conn.turnBytes == 0) {
+                conn.turnOver = true;
+                return true;
+            }
+            budget = conn.turnBytes;
+        }
+        if (conn.pipeBytes == 0 && rateLimiter_.active()) {
+            size_t granted = acquireBudget(conn);
+            if (granted == 0) {
+                // Over a limit; the loop's timer resumes this transfer
+                return true;
+            }
+            budget = std::min(budget, granted);
+        }
+        
+        off_t remainingBefore = conn.bodyRemaining;
+        ssize_t moved = streamBody(conn, budget);
+        if (moved < 0) {
+            return false;
+        }
+        if (conn.rateGrant.ready > 0) {
+            // Only what was actually pulled from the file uses up the grant
+            conn.rateGrant.ready -= static_cast<size_t>(remainingBefore - conn.bodyRemaining);
+        }
+        if (conn.bulkSlot) {
+            conn.turnBytes -= std::min<size_t>(conn.turnBytes, moved);
+        }
+        if (moved == 0) {
+            // Socket buffer full; wait for EPOLLOUT
+            return true;
+        }
+    }
+}
+
+ssize_t HttpServer::streamBody(Connection& conn, size_t budget) {
+    using BodyMode = Connection::BodyMode;
+    
+    // Bytes that may be pulled from the file by this call
+    off_t available = budget < static_cast<size_t>(conn.bodyRemaining)
+        ? static_cast<off_t>(budget) : conn.bodyRemaining;
+    
+    if (conn.bodyMode == BodyMode::Unknown || conn.bodyMode == BodyMode::SendFile) {
+        size_t chunk = std::min<off_t>(available, SENDFILE_CHUNK);
+        ssize_t sent = sendfile(conn.fd, conn.bodyFd, &conn.bodyOffset, chunk);
+        if (sent > 0) {
+            if (conn.bodyMode == BodyMode::Unknown) {
+                conn.bodyMode = BodyMode::SendFile;
+                sendfileTransfers_++;
+            }
+            noteSent(conn, sent);
+            conn.bodyRemaining -= sent;
+            return sent;
+        }
+        if (sent < 0 && (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR)) {
+            return 0;
+        }
+        if (sent == 0 || conn.bodyMode == BodyMode::SendFile ||
+            (errno != EINVAL && errno != ESPIPE && errno != ENOSYS && errno != EOPNOTSUPP)) {
+            // Truncated file or a broken socket mid-transfer
+            return -1;
+        }
+        // This descriptor can't be sendfile'd (pipe, FUSE or provider-backed SAF fd).
+        // Seekable sources keep reading at our own cursor; only true streams use read().
+        conn.bodySeekable = lseek(conn.bodyFd, 0, SEEK_CUR) >= 0;
+        // The pipe stays blocking so filling it waits on the source like read() would;
+        // draining it into the socket is non-blocking.
+        if (pipe2(conn.pipeFds, O_CLOEXEC) < 0) {
+            LOGE("pipe2 failed: %s", strerror(errno));
+            conn.bodyMode = BodyMode::Copy;
+            copyTransfers_++;
+        } else {
+            conn.bodyMode = BodyMode::Splice;
+        }
+    }
+    
+    if (conn.bodyMode == BodyMode::Splice) {
+        if (conn.pipeBytes == 0) {
+            // Refill the pipe from the file
+            size_t chunk = std::min<off_t>(available, PIPE_CHUNK);
+            ssize_t filled = splice(conn.bodyFd, conn.bodySeekable ? &conn.bodyOffset : nullptr,
+                                    conn.pipeFds[1], nullptr, chunk, SPLICE_F_MOVE);
+            if (filled <= 0) {
+                if (filled < 0 && errno == EINVAL && !conn.spliceStarted) {
+                    // Not spliceable either; fall back to copying through user space
+                    conn.bodyMode = BodyMode::Copy;
+                    copyTransfers_++;
+                    return streamBody(conn, budget);
+                }
+                return -1;
+            }
+            if (!conn.spliceStarted) {
+                conn.spliceStarted = true;
+                spliceTransfers_++;
+            }
+            conn.pipeBytes = filled;
+            conn.bodyRemaining -= filled;
+        }
+        
+        ssize_t sent = splice(conn.pipeFds[0], nullptr, conn.fd, nullptr, conn.pipeBytes,
+                              SPLICE_F_MOVE | SPLICE_F_NONBLOCK |
+                              (conn.bodyRemaining > 0 ? SPLICE_F_MORE : 0));
+        if (sent < 0) {
+            return (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR) ? 0 : -1;
+        }
+        noteSent(conn, sent);
+        conn.pipeBytes -= sent;
+        return sent;
+    }
+    
+    // Copy fallback: refill outBuf from the file; writeResponse sends it
+    bool filtered = conn.archive || conn.encoder;
+    size_t chunk = std::min<off_t>(available, filtered ? FILTER_COPY_CHUNK : BUFFER_SIZE);
+    conn.outBuf.resize(chunk);
+    ssize_t bytesRead = conn.bodySeekable
+        ? pread(conn.bodyFd, &conn.outBuf[0], chunk, conn.bodyOffset)
+        : read(conn.bodyFd, &conn.outBuf[0], chunk);
+    if (bytesRead <= 0) {
+        conn.outBuf.clear();
+        return -1;
+    }
+    conn.outBuf.resize(bytesRead);
+    if (conn.archive) {
+        conn.archive->consume(conn.outBuf.data(), bytesRead);
+    }
+    conn.bodyOffset += bytesRead;
+    conn.bodyRemaining -= bytesRead;
+    if (conn.encoder && !encodeBody(conn)) {
+        return -1;
+    }
+    return bytesRead;
+}
+
+size_t HttpServer::acquireBudget(Connection& conn) {
+    // New limits, or a new response: pick up fresh buckets
+    uint32_t generation = rateLimiter_.generation();
+    if (conn.limitsGeneration != generation) {
+        conn.limitsGeneration = generation;
+        conn.rateGrant = RateLimiter::Grant();
+        conn.transferBucket.setRate(rateLimiter_.transferRate());
+        conn.clientBucket = rateLimiter_.clientBucket(conn.peerAddress);
+    }
+    
+    // A quantum at a time, so transfers sharing a bucket take turns
+    size_t want = std::min<off_t>(conn.bodyRemaining, RATE_QUANTUM);
+    int64_t waitNs = rateLimiter_.acquire(conn.rateGrant, conn.transferBucket,
+                                          conn.clientBucket.get(), want, nowNs());
+    if (waitNs > 0) {
+        conn.wakeAtMs = nowMs() + std::max<int64_t>(1, (waitNs + 999999) / 1000000);
+        return 0;
+    }
+    return std::min<size_t>(conn.rateGrant.ready, conn.bodyRemaining);
+}
+
+void HttpServer::finishBody(Connection& conn) {
+    if (conn.bodyFd >= 0) {
+        if (!conn.bodySource) {
+            close(conn.bodyFd);
+        }
+        conn.bodyFd = -1;
+    }
+    conn.bodySource.reset();
+    if (conn.pipeFds[0] >= 0) {
+        close(conn.pipeFds[0]);
+        close(conn.pipeFds[1]);
+        conn.pipeFds[0] = conn.pipeFds[1] = -1;
+    }
+    conn.bodyMode = Connection::BodyMode::Unknown;
+    conn.bodyOffset = 0;
+    conn.bodyRemaining = 0;
+    conn.pipeBytes = 0;
+    conn.bodySeekable = true;
+    conn.spliceStarted = false;
+    conn.bodyParts.clear();
+    conn.nextPart = 0;
+    conn.headRequest = false;
+    conn.staticOwner.reset();
+    conn.archive.reset();
+    if (conn.transferCounted) {
+        conn.metrics->transfersFinished.add(1);
+        conn.transferCounted = false;
+    }
+    releaseBulkSlot(conn);
+    conn.priority = Connection::Priority::Interactive;
+    if (conn.limitsGeneration == rateLimiter_.generation()) {
+        // Tokens booked for bytes that won't be sent go back to the shared buckets
+        rateLimiter_.release(conn.rateGrant, conn.transferBucket, conn.clientBucket.get());
+    }
+    conn.rateGrant = RateLimiter::Grant();
+    conn.limitsGeneration = 0;
+    conn.encoder.reset();
+    conn.cacheWriter.reset();
+    if (conn.upload) {
+        if (conn.upload->session) {
+            // Unfinished chunk: the session's file stays, the chunk is just missing again
+            uploadSessions_.endChunk(*conn.upload->session, conn.upload->chunkIndex, false);
+        } else {
+            // Unfinished upload: don't leave the partial file behind
+            close(conn.upload->fd);
+            unlink(conn.upload->tempPath.c_str());
+        }
+        conn.upload.reset();
+    }
+}
+
+bool HttpServer::nextArchiveSegment(Connection& conn) {
+    // Let go of the entry that just finished; each entry is a transfer of its own
+    if (conn.bodyFd >= 0 && !conn.bodySource) {
+        close(conn.bodyFd);
+    }
+    conn.bodyFd = -1;
+    conn.bodySource.reset();
+    if (conn.pipeFds[0] >= 0) {
+        close(conn.pipeFds[0]);
+        close(conn.pipeFds[1]);
+        conn.pipeFds[0] = conn.pipeFds[1] = -1;
+    }
+    conn.bodyMode = Connection::BodyMode::Unknown;
+    conn.bodySeekable = true;
+    conn.spliceStarted = false;
+    
+    ArchiveStream::Segment segment;
+    conn.archive->next(segment);
+    conn.outBuf = std::move(segment.bytes);
+    conn.outOffset = 0;
+    if (!segment.file || segment.length == 0) {
+        return true;
+    }
+    
+    int fd = -1;
+    bool owned = true;
+    if (!FileManager::openFile(*segment.file, fd, owned)) {
+        // Headers are already out; all we can do is cut the response short
+        LOGE("Archive entry %s unavailable", segment.file->displayName.c_str());
+        return false;
+    }
+    if (!owned) {
+        conn.bodySource = segment.file;
+    }
+    conn.bodyFd = fd;
+    conn.bodyOffset = 0;
+    conn.bodyRemaining = segment.length;
+    if (conn.archive->needsData()) {
+        // ZIP needs each entry's CRC-32, so its data goes through user space
+        conn.bodyMode = Connection::BodyMode::Copy;
+        conn.bodySeekable = segment.file->seekable;
+        copyTransfers_++;
+    }
+    return true;
+}
+
+void HttpServer::handleRequest(Connection& conn, const HttpRequest& request) {
+    conn.state = Connection::State::WritingHeaders;
+    conn.requestCount++;
+    conn.requestReadyUs = nowNs() / 1000;
+    conn.requestStartUs = conn.requestReadyUs;
+    TRACE_DO(conn.trace.setRequest(request.method, request.target));
+    
+    const std::string_view method = request.method;
+    const std::string_view path = request.path;
+    
+    if (capture_.active()) {
+        conn.capture = std::make_unique<TrafficCapture::Record>();
+        conn.capture->method = TrafficCapture::methodOf(method);
+        conn.capture->target = std::string(request.target);
+        if (request.hasHeader(HttpHeader::Range)) {
+            conn.capture->range = std::string(request.header(HttpHeader::Range));
+        }
+    }
+    
+    // HTTP/1.1 persists unless told otherwise; 1.0 only when asked. Requests with a
+    // body can only be reused if the handler reads the whole body (uploads).
+    std::string_view connectionValue = request.header(HttpHeader::Connection);
+    std::string_view contentLength = request.header(HttpHeader::ContentLength);
+    bool hasBody = request.hasHeader(HttpHeader::TransferEncoding) ||
+                   (!contentLength.empty() && contentLength != "0");
+    if (request.isHttp11()) {
+        conn.keepAlive = !headerHasToken(connectionValue, "close");
+    } else {
+        conn.keepAlive = headerHasToken(connectionValue, "keep-alive");
+    }
+    bool sessionRoute = path == "/upload-sessions" || path.substr(0, 17) == "/upload-sessions/";
+    bool uploadRoute = ((method == "PUT" || method == "POST") && path.substr(0, 8) == "/upload/") ||
+                       (method == "PUT" && sessionRoute);
+    if ((hasBody && !uploadRoute) || !running_ || conn.requestCount >= maxRequestsPerConnection_) {
+        conn.keepAlive = false;
+    }
+    conn.route = sessionRoute ? ServerMetrics::Route::UploadSession
+               : uploadRoute ? ServerMetrics::Route::Upload
+               : routeFor(path);
+    
+    LOGI("Request: %.*s %.*s", static_cast<int>(method.size()), method.data(),
+         static_cast<int>(request.target.size()), request.target.data());
+    
+    conn.headRequest = method == "HEAD";
+    
+    // Check authentication
+    if (authManager_ && authManager_->hasCredentials()) {
+        std::string_view authorization = request.header(HttpHeader::Authorization);
+        std::string_view cookies = request.header(HttpHeader::Cookie);
+        TRACE_MARK(conn.trace, AuthStart);
+        bool authorized = false;
+        if (!authorization.empty()) {
+            authorized = authManager_->validateCredentials(authorization);
+            // Also replaces a stale cookie: expired, or signed with a key rotated since
+            if (authorized && !authManager_->validateSession(cookies)) {
+                conn.sessionCookie = authManager_->issueSession();
+            }
+        } else if (!cookies.empty()) {
+            authorized = authManager_->validateSession(cookies);
+        }
+        TRACE_MARK(conn.trace, AuthEnd);
+        if (!authorized) {
+            // Send 401 Unauthorized; any body is left unread
+            if (hasBody) {
+                conn.keepAlive = false;
+            }
+            std::unordered_map<std::string, std::string> respHeaders;
+            respHeaders["WWW-Authenticate"] = "Basic realm=\"" + authManager_->getAuthRealm() + "\"";
+            respHeaders["Content-Type"] = "text/html; charset=utf-8";
+            conn.metrics->authFailures.add(1);
+            sendResponse(conn, 401, "Unauthorized", respHeaders,
+                        "<html><body><h1>401 Unauthorized</h1><p>Authentication required.</p></body></html>");
+            return;
+        }
+    }
+    
+    // Route request; HEAD takes the GET path and the senders drop the body
+    if (sessionRoute) {
+        handleUploadSession(conn, request, path.substr(16));
+    } else if (method == "GET" || method == "HEAD") {
+        if (path == "/" || path == "/index.html") {
+            handleIndexPage(conn, request);
+        }
+        else if (path == "/api/files") {
+            handleApiFiles(conn, request);
+        }
+        else if (path == "/api/archive") {
+            handleArchive(conn, request);
+        }
+        else if (path == "/metrics") {
+            handleMetrics(conn);
+        }
+#if FILESERVER_TRACING
+        else if (path == "/debug/trace") {
+            std::unordered_map<std::string, std::string> respHeaders;
+            respHeaders["Content-Type"] = "application/json";
+            respHeaders["Content-Disposition"] = "attachment; filename=\"trace.json\"";
+            respHeaders["Cache-Control"] = "no-store";
+            sendResponse(conn, 200, "OK", respHeaders, exportTrace());
+        }
+#endif
+        else if (path.substr(0, 10) == "/download/") {
+            std::string fileId(path.substr(10)); // Remove "/download/"
+            if (!handleFileDownload(conn, fileId, request)) {
+                std::unordered_map<std::string, std::string> respHeaders;
+                respHeaders["Content-Type"] = "text/html; charset=utf-8";
+                sendResponse(conn, 404, "Not Found", respHeaders,
+                            "<html><body><h1>404 Not Found</h1></body></html>");
+            }
+        }
+        else {
+            // 404
+            std::unordered_map<std::string, std::string> respHeaders;
+            respHeaders["Content-Type"] = "text/html; charset=utf-8";
+            sendResponse(conn, 404, "Not Found", respHeaders,
+                        "<html><body><h1>404 Not Found</h1></body></html>");
+        }
+    } else if (uploadRoute) {
+        handleUpload(conn, request, path.substr(8));
+    } else {
+        // Method not allowed
+        std::unordered_map<std::string, std::string> respHeaders;
+        respHeaders["Content-Type"] = "text/html; charset=utf-8";
+        respHeaders["Allow"] = path.substr(0, 8) == "/upload/" ? "PUT, POST" : "GET, HEAD";
+        sendResponse(conn, 405, "Method Not Allowed", respHeaders,
+                    "<html><body><h1>405 Method Not Allowed</h1></body></html>");
+    }
+}
+
+ServerMetrics::Route HttpServer::routeFor(std::string_view path) {
+    using Route = ServerMetrics::Route;
+    if (path == "/" || path == "/index.html") return Route::Index;
+    if (path == "/api/files") return Route::Files;
+    if (path == "/api/archive") return Route::Archive;
+    if (path.substr(0, 10) == "/download/") return Route::Download;
+    if (path == "/metrics") return Route::Metrics;
+    return Route::Other;
+}
+
+std::string HttpServer::connectionHeaders(const Connection& conn) const {
+    std::string headers;
+    if (!conn.sessionCookie.empty()) {
+        // Every sender ends its headers here, so this is where a new session goes out
+        headers = "Set-Cookie: " + std::string(AuthManager::SESSION_COOKIE) + "=" + conn.sessionCookie +
+                  "; Path=/; Max-Age=" + std::to_string(AuthManager::SESSION_LIFETIME_SECONDS) +
+                  "; HttpOnly; SameSite=Strict\r\n";
+    }
+    if (!conn.keepAlive) {
+        return headers + "Connection: close\r\n";
+    }
+    return headers + "Connection: keep-alive\r\nKeep-Alive: timeout=" +
+           std::to_string(keepAliveTimeoutMs_ / 1000) + ", max=" +
+           std::to_string(maxRequestsPerConnection_ - conn.requestCount) + "\r\n";
+}
+
+void HttpServer::sendResponse(Connection& conn, int statusCode, const std::string& statusText,
+                              const std::unordered_map<std::string, std::string>& headers,
+                              const std::string& body) {
+    noteStatus(conn, statusCode);
+    std::ostringstream response;
+    response << "HTTP/1.1 " << statusCode << " " << statusText << "\r\n";
+    
+    // Add headers
+    for (const auto& header : headers) {
+        response << header.first << ": " << header.second << "\r\n";
+    }
     
-    auto it = mimeTypes.find(ext);
-    if (it != mimeTypes.end()) {
-        return it->second;
+    // Content-Length
+    response << "Content-Length: " << body.size() << "\r\n";
+    response << connectionHeaders(conn);
+    response << "\r\n";
+    if (!conn.headRequest) {
+        response << body;
     }
     
-    return "application/octet-stream";
+    conn.outBuf = response.str();
+    conn.outOffset = 0;
+}
+
+void HttpServer::sendStaticResponse(Connection& conn, int statusCode, const std::string& statusText,
+                                    const std::unordered_map<std::string, std::string>& headers,
+                                    std::string_view body, std::shared_ptr<const void> owner) {
+    noteStatus(conn, statusCode);
+    std::ostringstream response;
+    response << "HTTP/1.1 " << statusCode << " " << statusText << "\r\n";
+    for (const auto& header : headers) {
+        response << header.first << ": " << header.second << "\r\n";
+    }
+    if (statusCode != 304 && statusCode != 204) {
+        // A 304 must not advertise a length other than the full representation's,
+        // and a 204 none at all
+        response << "Content-Length: " << body.size() << "\r\n";
+    }
+    response << connectionHeaders(conn);
+    response << "\r\n";
+    
+    // Only the headers are built per request; the body goes out from .rodata
+    conn.outBuf = response.str();
+    conn.outOffset = 0;
+    if (!conn.headRequest) {
+        conn.staticBody = body;
+        conn.staticOwner = std::move(owner);
+    }
+}
+
+void HttpServer::sendFileResponse(Connection& conn, int statusCode, const std::string& statusText,
+                                  int fd, off_t offset, off_t length,
+                                  const std::unordered_map<std::string, std::string>& headers) {
+    noteStatus(conn, statusCode);
+    std::ostringstream response;
+    response << "HTTP/1.1 " << statusCode << " " << statusText << "\r\n";
+    for (const auto& header : headers) {
+        response << header.first << ": " << header.second << "\r\n";
+    }
+    response << "Content-Length: " << length << "\r\n";
+    response << connectionHeaders(conn);
+    response << "\r\n";
+    
+    conn.outBuf = response.str();
+    conn.outOffset = 0;
+    
+    if (conn.headRequest) {
+        if (fd >= 0 && !conn.bodySource) {
+            close(fd);
+        }
+        conn.bodySource.reset();
+        return;
+    }
+    
+    // The event loop streams the file once the headers are out
+    conn.bodyFd = fd;
+    conn.bodyOffset = offset;
+    conn.bodyRemaining = length;
+    if (length >= BULK_THRESHOLD) {
+        conn.priority = Connection::Priority::Bulk;
+    }
+}
+
+void HttpServer::sendCompressedResponse(Connection& conn, int fd, off_t length, bool seekable,
+                                        const std::unordered_map<std::string, std::string>& headers,
+                                        const std::string& cacheKey) {
+    noteStatus(conn, 200);
+    std::ostringstream response;
+    response << "HTTP/1.1 200 OK\r\n";
+    for (const auto& header : headers) {
+        response << header.first << ": " << header.second << "\r\n";
+    }
+    response << "Transfer-Encoding: chunked\r\n";
+    response << connectionHeaders(conn);
+    response << "\r\n";
+    
+    conn.outBuf = response.str();
+    conn.outOffset = 0;
+    
+    if (conn.headRequest) {
+        if (fd >= 0 && !conn.bodySource) {
+            close(fd);
+        }
+        conn.bodySource.reset();
+        return;
+    }
+    
+    // The copy path reads the file and encodeBody turns each piece into a chunk;
+    // the same bytes fill the cache so the next request can use sendfile
+    conn.bodyFd = fd;
+    conn.bodyOffset = 0;
+    conn.bodyRemaining = length;
+    conn.bodyMode = Connection::BodyMode::Copy;
+    conn.bodySeekable = seekable;
+    if (length >= BULK_THRESHOLD) {
+        conn.priority = Connection::Priority::Bulk;
+    }
+    conn.encoder = std::make_unique<GzipEncoder>(COMPRESSION_LEVEL);
+    if (!cacheKey.empty()) {
+        conn.cacheWriter = compressionCache_.create(cacheKey);
+    }
+    copyTransfers_++;
+}
+
+bool HttpServer::encodeBody(Connection& conn) {
+    // outBuf holds the raw bytes just read; swap them for the next chunk of the encoded body
+    bool last = conn.bodyRemaining <= 0;
+    std::string_view encoded;
+    if (!conn.encoder->encode(conn.outBuf.data(), conn.outBuf.size(), last, encoded)) {
+        return false;
+    }
+    if (conn.cacheWriter && !conn.cacheWriter->write(encoded.data(), encoded.size())) {
+        conn.cacheWriter.reset();
+    }
+    
+    conn.outBuf.clear();
+    if (!encoded.empty()) {
+        char chunkSize[24];
+        snprintf(chunkSize, sizeof(chunkSize), "%zx\r\n", encoded.size());
+        conn.outBuf += chunkSize;
+        conn.outBuf.append(encoded.data(), encoded.size());
+        conn.outBuf += "\r\n";
+    }
+    if (last) {
+        conn.outBuf += "0\r\n\r\n";
+        if (conn.cacheWriter) {
+            compressionCache_.commit(std::move(conn.cacheWriter));
+        }
+    }
+    return true;
+}
+
+void HttpServer::handleIndexPage(Connection& conn, const HttpRequest& request) {
+    // Pick the smallest stored encoding the client accepts
+    std::string_view acceptEncoding = request.header(HttpHeader::AcceptEncoding);
+    size_t variantCount = 0;
+    const WebFrontend::Variant* variants = WebFrontend::indexHtmlVariants(variantCount);
+    const WebFrontend::Variant* chosen = &variants[variantCount - 1];
+    for (size_t i = 0; i + 1 < variantCount; i++) {
+        if (acceptsEncoding(acceptEncoding, variants[i].contentEncoding)) {
+            chosen = &variants[i];
+            break;
+        }
+    }
+    
+    std::unordered_map<std::string, std::string> respHeaders;
+    respHeaders["Content-Type"] = "text/html; charset=utf-8";
+    respHeaders["ETag"] = std::string(chosen->etag);
+    respHeaders["Vary"] = "Accept-Encoding";
+    // Cacheable, but revalidated each time so a new app build shows up at once
+    respHeaders["Cache-Control"] = "no-cache";
+    
+    if (isNotModified(request, respHeaders["ETag"], 0)) {
+        sendStaticResponse(conn, 304, "Not Modified", respHeaders, std::string_view());
+        return;
+    }
+    
+    if (!chosen->contentEncoding.empty()) {
+        respHeaders["Content-Encoding"] = std::string(chosen->contentEncoding);
+    }
+    sendStaticResponse(conn, 200, "OK", respHeaders, chosen->body);
+}
+
+void HttpServer::handleApiFiles(Connection& conn, const HttpRequest& request) {
+    std::unordered_map<std::string, std::string> respHeaders;
+    respHeaders["Content-Type"] = "application/json";
+    if (!fileManager_) {
+        sendResponse(conn, 200, "OK", respHeaders, "[]");
+        return;
+    }
+    
+    // Rendered once per catalog version; the response body points into it.
+    // The version changes with every add/remove, so polling clients get a 304
+    // until the list actually changes.
+    std::shared_ptr<const FileListing::Rendered> listing = fileListing_.get(*fileManager_);
+    // Only a gzip-accepting client pays for compressing a new rendering
+    bool useGzip = acceptsEncoding(request.header(HttpHeader::AcceptEncoding), "gzip") &&
+                   !listing->gzip().empty();
+    respHeaders["ETag"] = useGzip ? listing->gzipEtag : listing->etag;
+    respHeaders["Vary"] = "Accept-Encoding";
+    respHeaders["Cache-Control"] = "no-cache";
+    if (isNotModified(request, respHeaders["ETag"], 0)) {
+        sendStaticResponse(conn, 304, "Not Modified", respHeaders, std::string_view());
+        return;
+    }
+    
+    if (useGzip) {
+        respHeaders["Content-Encoding"] = "gzip";
+    }
+    const std::string& body = useGzip ? listing->gzip() : listing->json;
+    sendStaticResponse(conn, 200, "OK", respHeaders, body, listing);
+}
+
+void HttpServer::handleArchive(Connection& conn, const HttpRequest& request) {
+    std::unordered_map<std::string, std::string> respHeaders;
+    respHeaders["Content-Type"] = "text/html; charset=utf-8";
+    
+    std::string_view format = queryParameter(request.query, "format");
+    if (format.data() && format != "zip" && format != "tar") {
+        sendResponse(conn, 400, "Bad Request", respHeaders,
+                     "<html><body><h1>400 Bad Request</h1><p>Unknown archive format.</p></body></html>");
+        return;
+    }
+    bool tar = format == "tar";
+    
+    // One snapshot for the whole archive: later catalog changes don't affect it
+    std::vector<std::shared_ptr<const SharedFile>> files;
+    if (fileManager_) {
+        std::shared_ptr<const FileCatalog> catalog = fileManager_->snapshot();
+        std::string_view ids = queryParameter(request.query, "ids");
+        if (ids.empty() || ids == "all") {
+            for (const auto& file : catalog->files) {
+                files.push_back(file.second);
+            }
+            std::sort(files.begin(), files.end(), [](const auto& a, const auto& b) {
+                return a->displayName != b->displayName ? a->displayName < b->displayName
+                                                        : a->id < b->id;
+            });
+        } else {
+            while (!ids.empty()) {
+                size_t comma = ids.find(',');
+                std::string id(ids.substr(0, comma));
+                ids = comma == std::string_view::npos ? std::string_view() : ids.substr(comma + 1);
+                if (id.empty()) {
+                    continue;
+                }
+                auto it = catalog->files.find(id);
+                if (it == catalog->files.end()) {
+                    sendResponse(conn, 404, "Not Found", respHeaders,
+                                 "<html><body><h1>404 Not Found</h1></body></html>");
+                    return;
+                }
+                files.push_back(it->second);
+            }
+        }
+    }
+    
+    auto archive = std::make_unique<ArchiveStream>(
+        tar ? ArchiveStream::Format::Tar : ArchiveStream::Format::Zip, std::move(files));
+    
+    // The layout is fixed up front, so the length is exact even though nothing is buffered.
+    // No ranges: resuming would mean regenerating the stream up to an offset.
+    respHeaders["Content-Type"] = tar ? "application/x-tar" : "application/zip";
+    respHeaders["Content-Disposition"] = tar ? "attachment; filename=\"files.tar\""
+                                             : "attachment; filename=\"files.zip\"";
+    respHeaders["Accept-Ranges"] = "none";
+    respHeaders["Cache-Control"] = "no-store";
+    sendFileResponse(conn, 200, "OK", -1, 0, archive->totalLength(), respHeaders);
+    if (!conn.headRequest) {
+        // Segments are produced as writeResponse drains each one
+        conn.bodyRemaining = 0;
+        conn.archive = std::move(archive);
+        conn.priority = Connection::Priority::Bulk;
+    }
+}
+
+void HttpServer::handleMetrics(Connection& conn) {
+    std::unordered_map<std::string, std::string> respHeaders;
+    respHeaders["Content-Type"] = "text/plain; version=0.0.4; charset=utf-8";
+    respHeaders["Cache-Control"] = "no-store";
+    sendResponse(conn, 200, "OK", respHeaders, renderMetrics());
+}
+
+void HttpServer::rejectUpload(Connection& conn, int statusCode, const std::string& statusText,
+                              const std::string& allow) {
+    // The body is left unread, so the connection can't be reused
+    conn.keepAlive = false;
+    std::unordered_map<std::string, std::string> respHeaders;
+    respHeaders["Content-Type"] = "text/html; charset=utf-8";
+    if (!allow.empty()) {
+        respHeaders["Allow"] = allow;
+    }
+    sendResponse(conn, statusCode, statusText, respHeaders,
+                 "<html><body><h1>" + std::to_string(statusCode) + " " + statusText +
+                 "</h1></body></html>");
+}
+
+bool HttpServer::uploadBodyLength(Connection& conn, const HttpRequest& request, off_t& outLength) {
+    // Bodies are streamed to disk at known offsets, so the length must be known
+    if (request.hasHeader(HttpHeader::TransferEncoding) ||
+        !request.hasHeader(HttpHeader::ContentLength)) {
+        rejectUpload(conn, 411, "Length Required");
+        return false;
+    }
+    uint64_t length;
+    if (!parseDecimal(request.header(HttpHeader::ContentLength), length)) {
+        rejectUpload(conn, 400, "Bad Request");
+        return false;
+    }
+    outLength = static_cast<off_t>(length);
+    return true;
+}
+
+void HttpServer::beginUploadBody(Connection& conn, const HttpRequest& request,
+                                 std::unique_ptr<Connection::Upload> upload) {
+    off_t length = upload->length;
+    conn.upload = std::move(upload);
+    conn.state = Connection::State::ReadingBody;
+    
+    // Only ask for the body once we know it will be accepted
+    if (length > 0 && headerHasToken(request.header(HttpHeader::Expect), "100-continue")) {
+        conn.outBuf = "HTTP/1.1 100 Continue\r\n\r\n";
+        conn.outOffset = 0;
+    }
+}
+
+void HttpServer::handleUpload(Connection& conn, const HttpRequest& request,
+                              std::string_view rawName) {
+    std::shared_ptr<const std::string> directory = std::atomic_load(&uploadDirectory_);
+    if (directory->empty() || !fileManager_) {
+        rejectUpload(conn, 403, "Forbidden");
+        return;
+    }
+    
+    off_t length;
+    if (!uploadBodyLength(conn, request, length)) {
+        return;
+    }
+    
+    std::string name;
+    if (!UploadStore::sanitizeName(rawName, name)) {
+        rejectUpload(conn, 400, "Bad Request");
+        return;
+    }
+    
+    auto upload = std::make_unique<Connection::Upload>();
+    upload->fd = UploadStore::createTemp(*directory, name, length, upload->tempPath);
+    if (upload->fd < 0) {
+        LOGE("Cannot create upload file in %s: %s", directory->c_str(), strerror(errno));
+        if (errno == ENOSPC || errno == EDQUOT) {
+            rejectUpload(conn, 507, "Insufficient Storage");
+        } else {
+            rejectUpload(conn, 500, "Internal Server Error");
+        }
+        return;
+    }
+    upload->name = name;
+    upload->directory = *directory;
+    upload->length = length;
+    beginUploadBody(conn, request, std::move(upload));
+    LOGI("Receiving upload %s (%lld bytes)", name.c_str(), static_cast<long long>(length));
+}
+
+void HttpServer::handleUploadSession(Connection& conn, const HttpRequest& request,
+                                     std::string_view rest) {
+    const std::string_view method = request.method;
+    std::unordered_map<std::string, std::string> respHeaders;
+    respHeaders["Content-Type"] = "application/json";
+    respHeaders["Cache-Control"] = "no-store";
+    
+    std::shared_ptr<const std::string> directory = std::atomic_load(&uploadDirectory_);
+    if (directory->empty() || !fileManager_) {
+        rejectUpload(conn, 403, "Forbidden");
+        return;
+    }
+    
+    // POST /upload-sessions?name=<name>&size=<bytes>[&chunkSize=<bytes>]
+    if (rest.empty()) {
+        if (method != "POST") {
+            rejectUpload(conn, 405, "Method Not Allowed", "POST");
+            return;
+        }
+        std::string name;
+        uint64_t size;
+        uint64_t chunkSize = UploadSessions::DEFAULT_CHUNK_SIZE;
+        std::string_view chunkValue = queryParameter(request.query, "chunkSize");
+        if (!UploadStore::sanitizeName(queryParameter(request.query, "name"), name) ||
+            !parseDecimal(queryParameter(request.query, "size"), size) ||
+            (chunkValue.data() && !parseDecimal(chunkValue, chunkSize))) {
+            rejectUpload(conn, 400, "Bad Request");
+            return;
+        }
+        std::shared_ptr<UploadSession> session =
+            uploadSessions_.create(*directory, name, size, chunkSize);
+        if (!session) {
+            LOGE("Cannot create upload session in %s: %s", directory->c_str(), strerror(errno));
+            if (errno == EFBIG) {
+                rejectUpload(conn, 413, "Content Too Large");
+            } else if (errno == ENOSPC || errno == EDQUOT) {
+                rejectUpload(conn, 507, "Insufficient Storage");
+            } else {
+                rejectUpload(conn, 500, "Internal Server Error");
+            }
+            return;
+        }
+        respHeaders["Location"] = "/upload-sessions/" + session->id;
+        sendResponse(conn, 201, "Created", respHeaders, UploadSessions::statusJson(*session));
+        return;
+    }
+    
+    // "/<id>" or "/<id>/<chunk index | finalize>"
+    rest.remove_prefix(1);
+    size_t slash = rest.find('/');
+    std::string id(rest.substr(0, slash));
+    std::string_view action = slash == std::string_view::npos ? std::string_view() : rest.substr(slash + 1);
+    std::shared_ptr<UploadSession> session = uploadSessions_.find(id);
+    if (!session) {
+        rejectUpload(conn, 404, "Not Found");
+        return;
+    }
+    
+    if (action.empty()) {
+        if (method == "GET" || method == "HEAD") {
+            // What's missing, so a client can resume after a disconnect
+            sendResponse(conn, 200, "OK", respHeaders, UploadSessions::statusJson(*session));
+        } else if (method == "DELETE") {
+            uploadSessions_.cancel(session);
+            sendStaticResponse(conn, 204, "No Content", respHeaders, std::string_view());
+        } else {
+            rejectUpload(conn, 405, "Method Not Allowed", "GET, HEAD, DELETE");
+        }
+        return;
+    }
+    
+    if (action == "finalize") {
+        if (method != "POST") {
+            rejectUpload(conn, 405, "Method Not Allowed", "POST");
+            return;
+        }
+        std::string expected;
+        std::string_view sha256 = queryParameter(request.query, "sha256");
+        for (char c : sha256) {
+            expected.push_back(static_cast<char>(tolower(static_cast<unsigned char>(c))));
+        }
+        if (sha256.data() && (expected.size() != 64 ||
+                              expected.find_first_not_of("0123456789abcdef") != std::string::npos)) {
+            rejectUpload(conn, 400, "Bad Request");
+            return;
+        }
+        // Hashing runs in the background; the client polls the session for the outcome
+        std::string error;
+        if (!uploadSessions_.finalize(session, expected, error)) {
+            LOGI("Finalize of session %s refused: %s", id.c_str(), error.c_str());
+            sendResponse(conn, 409, "Conflict", respHeaders, UploadSessions::statusJson(*session));
+            return;
+        }
+        respHeaders["Location"] = "/upload-sessions/" + id;
+        sendResponse(conn, 202, "Accepted", respHeaders, UploadSessions::statusJson(*session));
+        return;
+    }
+    
+    // PUT /upload-sessions/<id>/<index>: one chunk, written at its own offset
+    uint64_t index;
+    if (!parseDecimal(action, index) || index > UINT32_MAX) {
+        rejectUpload(conn, 404, "Not Found");
+        return;
+    }
+    if (method != "PUT") {
+        rejectUpload(conn, 405, "Method Not Allowed", "PUT");
+        return;
+    }
+    off_t length;
+    if (!uploadBodyLength(conn, request, length)) {
+        return;
+    }
+    switch (uploadSessions_.beginChunk(*session, static_cast<uint32_t>(index), length)) {
+        case UploadSessions::ChunkResult::Ok:
+            break;
+        case UploadSessions::ChunkResult::NotFound:
+            rejectUpload(conn, 404, "Not Found");
+            return;
+        case UploadSessions::ChunkResult::WrongLength:
+            rejectUpload(conn, 400, "Bad Request");
+            return;
+        case UploadSessions::ChunkResult::Conflict:
+            rejectUpload(conn, 409, "Conflict");
+            return;
+    }
+    
+    auto upload = std::make_unique<Connection::Upload>();
+    upload->fd = session->fd;
+    upload->name = session->name;
+    upload->length = length;
+    upload->baseOffset = static_cast<off_t>(session->chunkOffset(static_cast<uint32_t>(index)));
+    upload->chunkIndex = static_cast<uint32_t>(index);
+    upload->session = std::move(session);
+    beginUploadBody(conn, request, std::move(upload));
+}
+
+void HttpServer::finishUpload(Connection& conn) {
+    std::unique_ptr<Connection::Upload> upload = std::move(conn.upload);
+    conn.state = Connection::State::WritingHeaders;
+    // Time spent receiving the body isn't queueing
+    conn.requestReadyUs = nowNs() / 1000;
+    
+    if (upload->session) {
+        uploadSessions_.endChunk(*upload->session, upload->chunkIndex, true);
+        std::unordered_map<std::string, std::string> respHeaders;
+        sendStaticResponse(conn, 204, "No Content", respHeaders, std::string_view());
+        return;
+    }
+    
+    close(upload->fd);
+    upload->fd = -1;
+    
+    std::string path;
+    std::string name;
+    if (!UploadStore::publish(upload->tempPath, upload->directory, upload->name, path, name)) {
+        LOGE("Cannot publish upload %s: %s", upload->name.c_str(), strerror(errno));
+        unlink(upload->tempPath.c_str());
+        std::unordered_map<std::string, std::string> respHeaders;
+        respHeaders["Content-Type"] = "text/html; charset=utf-8";
+        sendResponse(conn, 500, "Internal Server Error", respHeaders,
+                     "<html><body><h1>500 Internal Server Error</h1></body></html>");
+        return;
+    }
+    
+    char id[48];
+    snprintf(id, sizeof(id), "upload-%llx-%x", static_cast<unsigned long long>(nowMs()),
+             uploadSequence_.fetch_add(1));
+    fileManager_->addFile(id, name, path, upload->length);
+    LOGI("Upload complete: %s (%lld bytes)", path.c_str(), static_cast<long long>(upload->length));
+    
+    std::string json = "{\"id\":";
+    FileListing::appendJsonString(json, id);
+    json += ",\"name\":";
+    FileListing::appendJsonString(json, name);
+    json += ",\"size\":" + std::to_string(upload->length) + "}";
+    
+    std::unordered_map<std::string, std::string> respHeaders;
+    respHeaders["Content-Type"] = "application/json";
+    respHeaders["Location"] = std::string("/download/") + id;
+    sendResponse(conn, 201, "Created", respHeaders, json);
+}
+
+void HttpServer::failUpload(Connection& conn, int statusCode, const std::string& statusText) {
+    LOGE("Upload of %s failed: %s", conn.upload->name.c_str(), strerror(errno));
+    // finishBody deletes the partial file once the response is out
+    conn.state = Connection::State::WritingHeaders;
+    rejectUpload(conn, statusCode, statusText);
+}
+
+bool HttpServer::handleFileDownload(Connection& conn, const std::string& fileId,
+                                    const HttpRequest& request) {
+    if (!fileManager_) {
+        return false;
+    }
+    
+    // Validators and range support come from the catalog, so 304, 416 and HEAD
+    // are answered without opening the file
+    // The entry keeps its fd alive even if the share is removed mid-request
+    std::shared_ptr<const SharedFile> entry = fileManager_->findFile(fileId);
+    if (!entry) {
+        return false;
+    }
+    const SharedFile& file = *entry;
+    size_t size = file.size;
+    const std::string& name = file.displayName;
+    const std::string& mimeType = file.mimeType;
+    
+    std::unordered_map<std::string, std::string> respHeaders;
+    
+    // Text-like content goes out gzip'd to clients that take it: from the cache
+    // once it has been compressed before, otherwise compressed as it streams
+    // (chunked, so HTTP/1.1 only). Ranges are always served from the raw file.
+    bool compressible = isCompressible(mimeType) && size >= MIN_COMPRESS_SIZE;
+    bool compress = compressible && request.isHttp11() && !request.hasHeader(HttpHeader::Range) &&
+                    acceptsEncoding(request.header(HttpHeader::AcceptEncoding), "gzip");
+    if (compressible) {
+        respHeaders["Vary"] = "Accept-Encoding";
+    }
+    
+    // Ranges need positional reads; pipes and other streams only go front to back
+    bool seekable = file.seekable;
+    std::string etag;
+    std::string lastModified;
+    std::shared_ptr<const FileDigest> digest = std::atomic_load(&file.digest);
+    if (seekable) {
+        if (digest) {
+            // Content hash: the same bytes keep the same ETag across re-shares and
+            // restarts, so sync tools can tell they already have them
+            etag = "\"" + ContentHasher::treeHex(digest->tree) + "\"";
+        } else {
+            // Strong validator so clients can resume with If-Range; the table version
+            // changes it when an id is re-shared with different content
+            char buffer[96];
+            snprintf(buffer, sizeof(buffer), "\"%llx-%llx-%llx\"",
+                     static_cast<unsigned long long>(file.version),
+                     static_cast<unsigned long long>(size),
+                     static_cast<unsigned long long>(file.mtime));
+            etag = buffer;
+        }
+        if (compress) {
+            // Each encoding is a representation of its own
+            etag.insert(etag.size() - 1, "-gzip");
+        }
+        respHeaders["Accept-Ranges"] = "bytes";
+        respHeaders["ETag"] = etag;
+        if (digest && digest->hasSha256 && !compress) {
+            // Of the whole file (the selected representation), ranges included
+            std::string sha256 = Sha256::toBase64(digest->sha256);
+            respHeaders["Repr-Digest"] = "sha-256=:" + sha256 + ":";
+            respHeaders["Digest"] = "SHA-256=" + sha256;
+        }
+        if (file.mtime > 0) {
+            lastModified = httpDate(file.mtime);
+            respHeaders["Last-Modified"] = lastModified;
+        }
+        
+        if (isNotModified(request, etag, file.mtime)) {
+            sendStaticResponse(conn, 304, "Not Modified", respHeaders, std::string_view());
+            return true;
+        }
+    } else {
+        respHeaders["Accept-Ranges"] = "none";
+    }
+    respHeaders["Content-Disposition"] = contentDisposition(name);
+    
+    std::vector<HttpRange::ByteRange> ranges;
+    HttpRange::Result rangeResult = HttpRange::Result::None;
+    if (seekable && request.hasHeader(HttpHeader::Range)) {
+        rangeResult = HttpRange::parse(request.header(HttpHeader::Range), size, ranges);
+        
+        // If-Range: only honour the Range when the client's copy is still current
+        std::string_view ifRange = request.header(HttpHeader::IfRange);
+        if (request.hasHeader(HttpHeader::IfRange) && ifRange != etag &&
+            (lastModified.empty() || ifRange != lastModified)) {
+            rangeResult = HttpRange::Result::None;
+        }
+    }
+    
+    if (rangeResult == HttpRange::Result::Unsatisfiable) {
+        respHeaders.erase("Content-Disposition");
+        respHeaders["Content-Range"] = "bytes */" + std::to_string(size);
+        respHeaders["Content-Type"] = "text/html; charset=utf-8";
+        sendResponse(conn, 416, "Range Not Satisfiable", respHeaders,
+                     "<html><body><h1>416 Range Not Satisfiable</h1></body></html>");
+        return true;
+    }
+    
+    std::string cacheKey;
+    if (compress) {
+        respHeaders["Content-Type"] = mimeType;
+        respHeaders["Content-Encoding"] = "gzip";
+        cacheKey = CompressionCache::keyFor(file, "gz");
+        off_t cachedSize = 0;
+        int cachedFd = cacheKey.empty() ? -1 : compressionCache_.open(cacheKey, cachedSize);
+        if (cachedFd >= 0) {
+            sendFileResponse(conn, 200, "OK", cachedFd, 0, cachedSize, respHeaders);
+            return true;
+        }
+    }
+    
+    int fd = -1;
+    if (!conn.headRequest) {
+        bool owned = true;
+        TRACE_MARK(conn.trace, OpenStart);
+        bool opened = FileManager::openFile(file, fd, owned);
+        TRACE_MARK(conn.trace, OpenEnd);
+        if (!opened) {
+            return false;
+        }
+        if (!owned) {
+            // Holding the entry keeps the shared fd open until this transfer ends
+            conn.bodySource = entry;
+        }
+    }
+    
+    if (compress) {
+        sendCompressedResponse(conn, fd, size, seekable, respHeaders, cacheKey);
+        return true;
+    }
+    
+    if (rangeResult == HttpRange::Result::None) {
+        respHeaders["Content-Type"] = mimeType;
+        sendFileResponse(conn, 200, "OK", fd, 0, size, respHeaders);
+        return true;
+    }
+    
+    if (ranges.size() == 1) {
+        respHeaders["Content-Type"] = mimeType;
+        respHeaders["Content-Range"] = HttpRange::contentRange(ranges[0], size);
+        sendFileResponse(conn, 206, "Partial Content", fd, ranges[0].first,
+                         ranges[0].length(), respHeaders);
+        return true;
+    }
+    
+    // multipart/byteranges: every part is a boundary + headers, then a slice of the file
+    static std::atomic<uint32_t> boundarySeq(0);
+    char boundary[40];
+    snprintf(boundary, sizeof(boundary), "fileserver-%08x%08x",
+             static_cast<unsigned>(time(nullptr)), boundarySeq.fetch_add(1));
+    
+    std::vector<Connection::BodyPart> parts;
+    off_t totalLength = 0;
+    for (const auto& range : ranges) {
+        std::string prefix = std::string("\r\n--") + boundary + "\r\n" +
+                             "Content-Type: " + mimeType + "\r\n" +
+                             "Content-Range: " + HttpRange::contentRange(range, size) + "\r\n\r\n";
+        totalLength += prefix.size() + range.length();
+        parts.push_back({prefix, static_cast<off_t>(range.first), static_cast<off_t>(range.length())});
+    }
+    std::string epilogue = std::string("\r\n--") + boundary + "--\r\n";
+    totalLength += epilogue.size();
+    parts.push_back({epilogue, 0, 0});
+    
+    respHeaders["Content-Type"] = std::string("multipart/byteranges; boundary=") + boundary;
+    sendFileResponse(conn, 206, "Partial Content", fd, 0, totalLength, respHeaders);
+    if (conn.bodyFd >= 0) {
+        conn.bodyRemaining = 0;
+        conn.bodyParts = std::move(parts);
+    }
+    return true;
+}
+
+bool HttpServer::isCompressible(const std::string& mimeType) {
+    // Anything not listed (images, audio, video, zip/apk, office documents,
+    // unknown binaries) is already compressed or not worth trying
+    static const std::unordered_set<std::string> compressible = {
+        "application/json",
+        "application/javascript",
+        "application/xml",
+        "application/x-tar",
+        "image/svg+xml",
+    };
+    return mimeType.compare(0, 5, "text/") == 0 || compressible.count(mimeType) > 0;
 }
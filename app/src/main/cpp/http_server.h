@@ -2,17 +2,57 @@
 
 #include <string>
 #include <vector>
+#include <deque>
+#include <queue>
+#include <functional>
+#include <memory>
 #include <unordered_map>
 #include <mutex>
 #include <atomic>
 #include <thread>
-#include <jni.h>
+#include <cstdint>
+#include <sys/types.h>
+
+#include "http_parser.h"
+#include "file_listing.h"
+#include "upload_sessions.h"
+#include "archive_stream.h"
+#include "compression_cache.h"
+#include "rate_limiter.h"
+#include "server_metrics.h"
+#include "request_trace.h"
+#include "traffic_capture.h"
 
 class FileManager;
+struct SharedFile;
 class AuthManager;
+class GzipEncoder;
 
 class HttpServer {
 public:
+    struct Stats {
+        int64_t acceptedConnections;
+        int64_t rejectedConnections;
+        int64_t activeConnections;
+        int64_t queuedConnections;
+        int64_t sendfileTransfers;      // Downloads by path taken: zero-copy sendfile,
+        int64_t spliceTransfers;        // splice through a pipe,
+        int64_t copyTransfers;          // or the read/send fallback
+        int workerCount;
+        int queueDepth;
+        int maxConnections;
+        // Request classes: time from a request being read to its response starting
+        int64_t interactiveRequests;
+        int64_t interactiveQueueUs;     // Total
+        int64_t interactiveQueueMaxUs;
+        int64_t bulkRequests;
+        int64_t bulkQueueUs;            // Includes waiting for a bulk slot
+        int64_t bulkQueueMaxUs;
+        int64_t activeBulkTransfers;
+        int64_t waitingBulkTransfers;
+        int maxBulkTransfers;
+    };
+    
     HttpServer();
     ~HttpServer();
     
@@ -24,31 +64,322 @@ public:
     void setFileManager(FileManager* fm);
     void setAuthManager(AuthManager* am);
     
+    // Pool size, per-worker accept queue depth and connection cap.
+    // Values <= 0 keep the current setting; changes apply on the next start().
+    void setLimits(int workerCount, int queueDepth, int maxConnections);
+    Stats getStats() const;
+    
+    // Idle timeout between requests and request cap for persistent connections.
+    // Values <= 0 keep the current setting; applies to new requests immediately.
+    void setKeepAlive(int timeoutMs, int maxRequests);
+    
+    // How many bulk transfers (large downloads, archives) may stream at once;
+    // the rest wait their turn without holding up interactive requests.
+    // Values <= 0 keep the current setting; applies immediately.
+    void setBulkTransferLimit(int maxBulkTransfers);
+    
+    // Where PUT/POST /upload/<name> stores files; empty disables uploads
+    void setUploadDirectory(const std::string& directory);
+    
+    // Where compressed variants of shared files are kept; empty disables the
+    // cache (compression still happens). maxBytes <= 0 keeps the current budget.
+    void setCompressionCache(const std::string& directory, int64_t maxBytes);
+    
+    // Download bandwidth caps in bytes per second: all transfers together, all
+    // transfers of one client address, and each single transfer. Values <= 0
+    // lift that cap. Takes effect immediately, including for transfers in flight.
+    void setRateLimits(int64_t globalBytesPerSecond, int64_t perClientBytesPerSecond,
+                       int64_t perTransferBytesPerSecond);
+    
+    // Everything GET /metrics reports, in Prometheus text format
+    std::string renderMetrics() const;
+    
+    // Phase timings of the most recent requests as Chrome trace JSON; has no
+    // events unless built with FILESERVER_TRACING
+    std::string exportTrace() const;
+    
+    // Logs every request's metadata to 'path' for fileserver_loadgen --replay,
+    // replacing any running capture. stopCapture() (or stop()) flushes it.
+    bool startCapture(const std::string& path);
+    void stopCapture();
+    
 private:
+    static constexpr size_t MAX_HEADER_SIZE = 16384;
+    
+    // Receive buffer plus the parsed view of the request in it. Pooled per event
+    // loop and only attached to a connection while a request is being read.
+    struct RequestBuffer {
+        char data[MAX_HEADER_SIZE];
+        HttpRequest request;
+    };
+    
+    // A client connection owned by exactly one event loop. The loop drives it
+    // through the states below as the socket becomes readable/writable.
+    struct Connection {
+        enum class State {
+            ReadingRequest,
+            ReadingBody,        // Storing an upload; the response follows once it's complete
+            WritingHeaders,
+            StreamingBody,
+        };
+        
+        // How the body is moved from bodyFd to the socket; settled on the first chunk
+        enum class BodyMode {
+            Unknown,
+            SendFile,
+            Splice,
+            Copy,
+        };
+        
+        // Request body being written to disk
+        struct Upload {
+            int fd = -1;
+            std::string tempPath;
+            std::string name;       // Requested (sanitized) file name
+            std::string directory;
+            off_t received = 0;
+            off_t length = 0;       // Content-Length
+            // Chunk of a resumable session: written at baseOffset into the session's file
+            std::shared_ptr<UploadSession> session;
+            uint32_t chunkIndex = 0;
+            off_t baseOffset = 0;
+        };
+        
+        // Interactive responses go out as soon as they're ready; bulk ones are
+        // capped in number and streamed in turns behind interactive work
+        enum class Priority {
+            Interactive,
+            Bulk,
+        };
+        
+        // Multipart responses: a literal prefix followed by a slice of bodyFd
+        struct BodyPart {
+            std::string prefix;
+            off_t offset;
+            off_t length;
+        };
+        
+        int fd = -1;
+        std::string peerAddress;
+        State state = State::ReadingRequest;
+        std::unique_ptr<RequestBuffer> reqBuf;  // Request bytes received so far (may hold pipelined requests)
+        size_t inLen = 0;
+        HttpParser parser;
+        std::string outBuf;         // Pending response bytes (headers, small bodies, copied chunks)
+        size_t outOffset = 0;
+        std::string_view staticBody;    // Sent after outBuf without copying (embedded assets, cached listing)
+        std::shared_ptr<const void> staticOwner;    // Keeps staticBody's storage alive, if it isn't static
+        int bodyFd = -1;            // File streamed once the headers are out
+        std::shared_ptr<const SharedFile> bodySource;  // Set when bodyFd is borrowed from a SAF share
+        off_t bodyOffset = 0;       // Per-transfer cursor; the fd's own offset is never used for seekable files
+        off_t bodyRemaining = 0;
+        BodyMode bodyMode = BodyMode::Unknown;
+        int pipeFds[2] = {-1, -1};  // Only allocated for splice transfers
+        size_t pipeBytes = 0;       // Spliced into the pipe but not yet out to the socket
+        bool bodySeekable = true;
+        bool spliceStarted = false;
+        std::vector<BodyPart> bodyParts;
+        size_t nextPart = 0;
+        int64_t lastActivityMs = 0;
+        int requestCount = 0;
+        bool keepAlive = false;
+        bool headRequest = false;   // HEAD: send the headers a GET would get, no body
+        std::string sessionCookie;  // Issued by this request's Basic login; sent with its response
+        std::unique_ptr<Upload> upload;     // Only while a request body is being stored
+        std::unique_ptr<ArchiveStream> archive;     // Multi-file download; bodyFd is its current entry
+        std::unique_ptr<GzipEncoder> encoder;       // Body is compressed and sent chunked
+        std::unique_ptr<CompressionCache::Writer> cacheWriter;  // Keeps the compressed bytes for next time
+        RateBucket transferBucket;
+        std::shared_ptr<RateBucket> clientBucket;  // Shared by every connection from peerAddress
+        RateLimiter::Grant rateGrant;
+        uint32_t limitsGeneration = 0;      // RateLimiter generation the buckets above reflect
+        int64_t wakeAtMs = 0;       // Rate limited until then
+        Priority priority = Priority::Interactive;
+        bool bulkSlot = false;      // Holds one of the maxBulkTransfers_ slots
+        bool bulkParked = false;    // In the loop's bulkWaiting queue
+        bool bulkQueued = false;    // In the loop's bulkReady queue
+        bool turnOver = false;      // Bulk turn used up with the socket still writable
+        size_t turnBytes = 0;       // Left in the current bulk turn
+        int64_t requestReadyUs = 0; // When the current request was read; 0 once its response started
+        ServerMetrics::Shard* metrics = nullptr;    // The owning loop's shard
+        ServerMetrics::Route route = ServerMetrics::Route::Other;
+        int64_t requestStartUs = 0; // When the current request was read, for the latency histograms
+        bool firstByteSent = false;
+        bool transferCounted = false;   // Counted in transfersStarted, not yet finished
+        int responseStatus = 0;
+        uint64_t responseBytes = 0;
+        std::unique_ptr<TrafficCapture::Record> capture;   // Only while capturing
+        uint32_t captureGeneration = 0;     // Capture the ids below belong to
+        uint32_t captureClient = 0;
+        uint32_t captureConnection = 0;
+#if FILESERVER_TRACING
+        RequestTrace trace;
+        RequestTracer::Ring* traceRing = nullptr;
+#endif
+    };
+    
+    struct PendingSocket {
+        int fd;
+        int64_t acceptedNs;     // Only stamped when tracing
+    };
+    
+    struct EventLoop {
+        int epollFd = -1;
+        int wakeFd = -1;
+        std::thread thread;
+        std::mutex pendingMutex;
+        std::deque<PendingSocket> pending;  // Accepted sockets waiting to be adopted (bounded by queueDepth_)
+        std::unordered_map<int, std::unique_ptr<Connection>> connections;
+        std::vector<std::unique_ptr<RequestBuffer>> freeBuffers;
+        std::vector<char> uploadBuffer;     // recv() staging for every upload on this loop
+        // Rate-limited connections by the time they may send again (may hold stale entries)
+        std::priority_queue<std::pair<int64_t, int>, std::vector<std::pair<int64_t, int>>,
+                            std::greater<std::pair<int64_t, int>>> wakeups;
+        std::deque<int> bulkReady;      // Bulk transfers due another turn
+        std::deque<int> bulkWaiting;    // Bulk responses waiting for a slot (may hold stale fds)
+        std::atomic<int> bulkWaitingCount{0};
+        ServerMetrics::Shard* metrics = nullptr;
+#if FILESERVER_TRACING
+        RequestTracer::Ring* traceRing = nullptr;
+#endif
+    };
+    
     void acceptLoop();
-    void handleClient(int clientSocket);
+    bool enqueueConnection(int clientSocket);
+    void rejectConnection(int clientSocket);
+    void runEventLoop(EventLoop* loop);
+    void adoptPending(EventLoop& loop);
+    bool stealPending(EventLoop& thief, std::deque<PendingSocket>& out);
+    void closeConnection(EventLoop& loop, int fd);
+    void resumeThrottled(EventLoop& loop, int64_t now);
+    void runBulkTurns(EventLoop& loop);
+    void admitBulkWaiting(EventLoop& loop);
+    bool acquireBulkSlot(Connection& conn);
+    void releaseBulkSlot(Connection& conn);
+    void recordQueueTime(Connection& conn);
+    void noteStatus(Connection& conn, int statusCode);
+    void noteSent(Connection& conn, size_t bytes);
+    void noteResponseDone(Connection& conn);
+    void captureRequest(Connection& conn, int64_t nowUs);
+    void sweepIdleConnections(EventLoop& loop, int64_t now);
+    
+    bool driveConnection(EventLoop& loop, Connection& conn);
+    bool readRequest(EventLoop& loop, Connection& conn);
+    bool readBody(EventLoop& loop, Connection& conn);
+    std::unique_ptr<RequestBuffer> acquireRequestBuffer(EventLoop& loop);
+    void releaseRequestBuffer(EventLoop& loop, Connection& conn);
+    bool writeResponse(Connection& conn);
+    ssize_t streamBody(Connection& conn, size_t budget);
+    size_t acquireBudget(Connection& conn);
+    void finishBody(Connection& conn);
+    bool nextArchiveSegment(Connection& conn);
+    bool encodeBody(Connection& conn);
+    void handleRequest(Connection& conn, const HttpRequest& request);
     
-    std::string parseRequest(int clientSocket, std::string& method, std::string& path, 
-                             std::unordered_map<std::string, std::string>& headers);
-    void sendResponse(int clientSocket, int statusCode, const std::string& statusText,
+    std::string connectionHeaders(const Connection& conn) const;
+    void sendResponse(Connection& conn, int statusCode, const std::string& statusText,
                       const std::unordered_map<std::string, std::string>& headers,
                       const std::string& body);
-    void sendFileResponse(int clientSocket, int fd, size_t fileSize, const std::string& mimeType);
+    void sendStaticResponse(Connection& conn, int statusCode, const std::string& statusText,
+                            const std::unordered_map<std::string, std::string>& headers,
+                            std::string_view body, std::shared_ptr<const void> owner = nullptr);
+    void sendFileResponse(Connection& conn, int statusCode, const std::string& statusText,
+                          int fd, off_t offset, off_t length,
+                          const std::unordered_map<std::string, std::string>& headers);
+    void sendCompressedResponse(Connection& conn, int fd, off_t length, bool seekable,
+                                const std::unordered_map<std::string, std::string>& headers,
+                                const std::string& cacheKey);
     
-    std::string handleIndexPage();
-    std::string handleApiFiles();
-    bool handleFileDownload(int clientSocket, const std::string& fileId);
+    void handleIndexPage(Connection& conn, const HttpRequest& request);
+    void handleApiFiles(Connection& conn, const HttpRequest& request);
+    void handleArchive(Connection& conn, const HttpRequest& request);
+    void handleMetrics(Connection& conn);
+    void handleUpload(Connection& conn, const HttpRequest& request, std::string_view rawName);
+    void handleUploadSession(Connection& conn, const HttpRequest& request, std::string_view rest);
+    bool uploadBodyLength(Connection& conn, const HttpRequest& request, off_t& outLength);
+    void beginUploadBody(Connection& conn, const HttpRequest& request,
+                         std::unique_ptr<Connection::Upload> upload);
+    void rejectUpload(Connection& conn, int statusCode, const std::string& statusText,
+                      const std::string& allow = std::string());
+    void finishUpload(Connection& conn);
+    void failUpload(Connection& conn, int statusCode, const std::string& statusText);
+    bool handleFileDownload(Connection& conn, const std::string& fileId,
+                            const HttpRequest& request);
     
-    std::string getMimeType(const std::string& filename);
+    static bool isCompressible(const std::string& mimeType);
+    static ServerMetrics::Route routeFor(std::string_view path);
+    
+    static int64_t nowMs();
+    static int64_t nowNs();
+    static std::string httpDate(time_t t);
+    static bool parseHttpDate(std::string_view value, time_t& out);
+    // "attachment; filename=..." that no name can break out of (RFC 6266)
+    static std::string contentDisposition(std::string_view filename);
+    // RFC 9110 13.2.2: If-None-Match wins; If-Modified-Since only without it.
+    // lastModified of 0 means the resource has no date validator.
+    static bool isNotModified(const HttpRequest& request, const std::string& etag,
+                              time_t lastModified);
     
     int serverSocket_;
     std::atomic<bool> running_;
     std::atomic<int> port_;
     std::thread acceptThread_;
+    std::vector<std::unique_ptr<EventLoop>> loops_;
+    size_t nextLoop_;
+    std::atomic<int64_t> drainDeadlineMs_;
+    
+    int workerCount_;
+    int queueDepth_;
+    int maxConnections_;
+    std::atomic<int64_t> acceptedCount_;
+    std::atomic<int64_t> rejectedCount_;
+    std::atomic<int64_t> activeConnections_;
+    std::atomic<int64_t> queuedConnections_;
+    std::atomic<int64_t> sendfileTransfers_;
+    std::atomic<int64_t> spliceTransfers_;
+    std::atomic<int64_t> copyTransfers_;
+    std::atomic<int> maxBulkTransfers_;
+    std::atomic<int64_t> activeBulkTransfers_;
+    std::atomic<int64_t> waitingBulkTransfers_;
+    std::atomic<int64_t> interactiveRequests_;
+    std::atomic<int64_t> interactiveQueueUs_;
+    std::atomic<int64_t> interactiveQueueMaxUs_;
+    std::atomic<int64_t> bulkRequests_;
+    std::atomic<int64_t> bulkQueueUs_;
+    std::atomic<int64_t> bulkQueueMaxUs_;
+    std::atomic<int> keepAliveTimeoutMs_;
+    std::atomic<int> maxRequestsPerConnection_;
+    std::shared_ptr<const std::string> uploadDirectory_;    // Accessed with std::atomic_load/store
+    std::atomic<uint32_t> uploadSequence_;
     
     FileManager* fileManager_;
     AuthManager* authManager_;
+    FileListing fileListing_;
+    UploadSessions uploadSessions_;
+    CompressionCache compressionCache_;
+    RateLimiter rateLimiter_;
+    ServerMetrics metrics_;
+    RequestTracer tracer_;
+    TrafficCapture capture_;
     
     static constexpr int BUFFER_SIZE = 8192;
-    static constexpr int MAX_HEADER_SIZE = 16384;
+    static constexpr size_t SENDFILE_CHUNK = 1 << 20;
+    static constexpr size_t PIPE_CHUNK = 1 << 16;
+    static constexpr size_t UPLOAD_CHUNK = 1 << 18;
+    static constexpr size_t FILTER_COPY_CHUNK = 1 << 16;     // Copy reads that are also CRC'd or compressed
+    static constexpr size_t MIN_COMPRESS_SIZE = 1024;
+    static constexpr int COMPRESSION_LEVEL = 5;     // Runs on the event loop; favour speed
+    static constexpr size_t RATE_QUANTUM = 1 << 16;  // Largest grant per send when rate limited
+    static constexpr off_t BULK_THRESHOLD = 1 << 20;    // Bodies this large are bulk transfers
+    static constexpr size_t BULK_TURN_BYTES = 1 << 18;  // Sent per bulk turn before yielding the loop
+    static constexpr int DEFAULT_MAX_BULK_TRANSFERS = 4;
+    static constexpr size_t MAX_POOLED_BUFFERS = 32;
+    static constexpr int MAX_EVENTS = 64;
+    static constexpr int64_t IDLE_TIMEOUT_MS = 30000;
+    static constexpr int64_t DRAIN_TIMEOUT_MS = 2000;
+    static constexpr int DEFAULT_KEEP_ALIVE_TIMEOUT_MS = 15000;
+    static constexpr int DEFAULT_MAX_REQUESTS_PER_CONNECTION = 100;
+    static constexpr int DEFAULT_QUEUE_DEPTH = 64;
+    static constexpr int DEFAULT_MAX_CONNECTIONS = 1024;
+    static constexpr int RETRY_AFTER_SECONDS = 1;
 };
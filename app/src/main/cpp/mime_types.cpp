@@ -0,0 +1,202 @@
+#include "mime_types.h"
+
+#include <unistd.h>
+#include <cerrno>
+#include <cstring>
+
+namespace {
+
+struct MimeEntry {
+    std::string_view extension;     // Lower case
+    std::string_view type;
+};
+
+constexpr MimeEntry kMimeEntries[] = {
+    {"html", "text/html"},
+    {"htm", "text/html"},
+    {"css", "text/css"},
+    {"js", "application/javascript"},
+    {"json", "application/json"},
+    {"xml", "application/xml"},
+    {"txt", "text/plain"},
+    {"log", "text/plain"},
+    {"md", "text/markdown"},
+    {"csv", "text/csv"},
+    {"pdf", "application/pdf"},
+    {"doc", "application/msword"},
+    {"docx", "application/vnd.openxmlformats-officedocument.wordprocessingml.document"},
+    {"xls", "application/vnd.ms-excel"},
+    {"xlsx", "application/vnd.openxmlformats-officedocument.spreadsheetml.sheet"},
+    {"ppt", "application/vnd.ms-powerpoint"},
+    {"pptx", "application/vnd.openxmlformats-officedocument.presentationml.presentation"},
+    {"jpg", "image/jpeg"},
+    {"jpeg", "image/jpeg"},
+    {"png", "image/png"},
+    {"gif", "image/gif"},
+    {"webp", "image/webp"},
+    {"svg", "image/svg+xml"},
+    {"ico", "image/x-icon"},
+    {"heic", "image/heic"},
+    {"mp3", "audio/mpeg"},
+    {"wav", "audio/wav"},
+    {"ogg", "audio/ogg"},
+    {"m4a", "audio/mp4"},
+    {"flac", "audio/flac"},
+    {"mp4", "video/mp4"},
+    {"webm", "video/webm"},
+    {"avi", "video/x-msvideo"},
+    {"mkv", "video/x-matroska"},
+    {"mov", "video/quicktime"},
+    {"3gp", "video/3gpp"},
+    {"zip", "application/zip"},
+    {"rar", "application/x-rar-compressed"},
+    {"7z", "application/x-7z-compressed"},
+    {"tar", "application/x-tar"},
+    {"gz", "application/gzip"},
+    {"apk", "application/vnd.android.package-archive"},
+};
+
+constexpr size_t kEntryCount = sizeof(kMimeEntries) / sizeof(kMimeEntries[0]);
+constexpr size_t kSlotCount = 256;      // Power of two, and sparse enough for a seed to come quickly
+constexpr uint8_t kEmptySlot = 0xff;
+static_assert(kEntryCount < kEmptySlot, "slot indices are bytes");
+
+constexpr size_t longestExtension() {
+    size_t longest = 0;
+    for (const MimeEntry& entry : kMimeEntries) {
+        longest = entry.extension.size() > longest ? entry.extension.size() : longest;
+    }
+    return longest;
+}
+
+constexpr size_t kLongestExtension = longestExtension();
+
+constexpr char toLower(char c) {
+    return c >= 'A' && c <= 'Z' ? static_cast<char>(c - 'A' + 'a') : c;
+}
+
+// FNV-1a over the lower-cased extension, with the seed as the offset basis
+constexpr uint32_t extensionHash(std::string_view extension, uint32_t seed) {
+    uint32_t hash = seed;
+    for (char c : extension) {
+        hash = (hash ^ static_cast<uint8_t>(toLower(c))) * 16777619u;
+    }
+    return hash;
+}
+
+struct SlotTable {
+    uint32_t seed = 0;
+    uint8_t slots[kSlotCount] = {};     // Index into kMimeEntries, or kEmptySlot
+};
+
+// Tries seeds until every extension lands in its own slot
+constexpr SlotTable buildSlotTable() {
+    for (uint32_t seed = 2166136261u; seed < 2166136261u + 10000; seed++) {
+        SlotTable table;
+        table.seed = seed;
+        for (uint8_t& slot : table.slots) {
+            slot = kEmptySlot;
+        }
+        bool collided = false;
+        for (size_t i = 0; i < kEntryCount && !collided; i++) {
+            uint8_t& slot = table.slots[extensionHash(kMimeEntries[i].extension, seed) & (kSlotCount - 1)];
+            collided = slot != kEmptySlot;
+            slot = static_cast<uint8_t>(i);
+        }
+        if (!collided) {
+            return table;
+        }
+    }
+    return SlotTable();
+}
+
+constexpr SlotTable kSlotTable = buildSlotTable();
+static_assert(kSlotTable.seed != 0, "no collision-free seed for the MIME table; grow kSlotCount");
+
+bool matches(const uint8_t* data, size_t length, size_t offset, std::string_view magic) {
+    return length >= offset + magic.size() && memcmp(data + offset, magic.data(), magic.size()) == 0;
+}
+
+} // namespace
+
+std::string_view MimeTypes::forName(std::string_view filename) {
+    size_t dotPos = filename.rfind('.');
+    if (dotPos == std::string_view::npos) {
+        return DEFAULT_TYPE;
+    }
+    std::string_view extension = filename.substr(dotPos + 1);
+    if (extension.empty() || extension.size() > kLongestExtension) {
+        return DEFAULT_TYPE;
+    }
+    
+    uint8_t index = kSlotTable.slots[extensionHash(extension, kSlotTable.seed) & (kSlotCount - 1)];
+    if (index == kEmptySlot) {
+        return DEFAULT_TYPE;
+    }
+    const MimeEntry& entry = kMimeEntries[index];
+    if (entry.extension.size() != extension.size()) {
+        return DEFAULT_TYPE;
+    }
+    for (size_t i = 0; i < extension.size(); i++) {
+        if (toLower(extension[i]) != entry.extension[i]) {
+            return DEFAULT_TYPE;
+        }
+    }
+    return entry.type;
+}
+
+std::string_view MimeTypes::sniff(const uint8_t* data, size_t length) {
+    using namespace std::string_view_literals;
+    
+    if (matches(data, length, 0, "\xFF\xD8\xFF"sv)) return "image/jpeg";
+    if (matches(data, length, 0, "\x89PNG\r\n\x1A\n"sv)) return "image/png";
+    if (matches(data, length, 0, "GIF87a"sv) || matches(data, length, 0, "GIF89a"sv)) return "image/gif";
+    if (matches(data, length, 0, "%PDF-"sv)) return "application/pdf";
+    if (matches(data, length, 0, "RIFF"sv)) {
+        if (matches(data, length, 8, "WEBP"sv)) return "image/webp";
+        if (matches(data, length, 8, "WAVE"sv)) return "audio/wav";
+        if (matches(data, length, 8, "AVI "sv)) return "video/x-msvideo";
+        return std::string_view();
+    }
+    if (matches(data, length, 4, "ftyp"sv)) {
+        // ISO base media: the major brand says what kind
+        if (matches(data, length, 8, "qt  "sv)) return "video/quicktime";
+        if (matches(data, length, 8, "M4A "sv)) return "audio/mp4";
+        if (matches(data, length, 8, "3gp"sv)) return "video/3gpp";
+        if (matches(data, length, 8, "heic"sv) || matches(data, length, 8, "heix"sv) ||
+            matches(data, length, 8, "mif1"sv)) {
+            return "image/heic";
+        }
+        return "video/mp4";
+    }
+    if (matches(data, length, 0, "\x1A\x45\xDF\xA3"sv)) {
+        // EBML; the DocType near the start tells WebM from other Matroska
+        std::string_view head(reinterpret_cast<const char*>(data), length < 64 ? length : 64);
+        return head.find("webm") != std::string_view::npos ? "video/webm" : "video/x-matroska";
+    }
+    if (matches(data, length, 0, "ID3"sv)) return "audio/mpeg";
+    if (length >= 2 && data[0] == 0xFF && (data[1] & 0xE6) == 0xE2) {
+        // MPEG audio frame sync, layer III
+        return "audio/mpeg";
+    }
+    if (matches(data, length, 0, "OggS"sv)) return "audio/ogg";
+    if (matches(data, length, 0, "fLaC"sv)) return "audio/flac";
+    if (matches(data, length, 0, "PK\x03\x04"sv)) return "application/zip";
+    if (matches(data, length, 0, "\x1F\x8B"sv)) return "application/gzip";
+    if (matches(data, length, 0, "7z\xBC\xAF\x27\x1C"sv)) return "application/x-7z-compressed";
+    if (matches(data, length, 0, "Rar!\x1A\x07"sv)) return "application/x-rar-compressed";
+    if (matches(data, length, 257, "ustar"sv)) return "application/x-tar";
+    return std::string_view();
+}
+
+std::string_view MimeTypes::sniffFile(int fd) {
+    uint8_t head[SNIFF_BYTES];
+    ssize_t n;
+    do {
+        n = pread(fd, head, sizeof(head), 0);
+    } while (n < 0 && errno == EINTR);
+    if (n <= 0) {
+        return std::string_view();
+    }
+    return sniff(head, static_cast<size_t>(n));
+}
@@ -0,0 +1,24 @@
+#pragma once
+
+#include <string_view>
+#include <cstddef>
+#include <cstdint>
+
+// Content types for shared files. The extension table is a perfect hash built
+// at compile time, so a lookup is one hash and one compare with no allocation;
+// sniff() covers names without a known extension (SAF display names often have
+// none) by looking at the first bytes of the file.
+class MimeTypes {
+public:
+    static constexpr std::string_view DEFAULT_TYPE = "application/octet-stream";
+    // Bytes sniff() wants to see; tar's magic is the furthest in
+    static constexpr size_t SNIFF_BYTES = 512;
+    
+    // By extension, case-insensitively; DEFAULT_TYPE if unknown
+    static std::string_view forName(std::string_view filename);
+    // By magic bytes; empty if nothing matches. Only recognizes binary formats,
+    // never text, so a file can't be sniffed into being served as HTML.
+    static std::string_view sniff(const uint8_t* data, size_t length);
+    // Reads the head of a seekable fd with pread (leaving its offset alone) and sniffs it
+    static std::string_view sniffFile(int fd);
+};
@@ -57,6 +57,107 @@ jint getServerPort(JNIEnv* env, jobject /* this */) {
     return 0;
 }
 
+void setServerLimits(JNIEnv* env, jobject /* this */, jint workerCount, jint queueDepth,
+                                                      jint maxConnections) {
+    ensureInitialized();
+    g_server->setLimits(workerCount, queueDepth, maxConnections);
+}
+
+void setKeepAlive(JNIEnv* env, jobject /* this */, jint timeoutSeconds, jint maxRequests) {
+    ensureInitialized();
+    g_server->setKeepAlive(timeoutSeconds > 0 ? timeoutSeconds * 1000 : 0, maxRequests);
+}
+
+void setUploadDirectory(JNIEnv* env, jobject /* this */, jstring directory) {
+    ensureInitialized();
+    
+    const char* directoryChars = env->GetStringUTFChars(directory, nullptr);
+    g_server->setUploadDirectory(directoryChars);
+    env->ReleaseStringUTFChars(directory, directoryChars);
+}
+
+void setCompressionCache(JNIEnv* env, jobject /* this */, jstring directory, jlong maxBytes) {
+    ensureInitialized();
+    
+    const char* directoryChars = env->GetStringUTFChars(directory, nullptr);
+    g_server->setCompressionCache(directoryChars, maxBytes);
+    env->ReleaseStringUTFChars(directory, directoryChars);
+}
+
+void setRateLimits(JNIEnv* env, jobject /* this */, jlong globalBytesPerSecond,
+                   jlong perClientBytesPerSecond, jlong perTransferBytesPerSecond) {
+    ensureInitialized();
+    g_server->setRateLimits(globalBytesPerSecond, perClientBytesPerSecond, perTransferBytesPerSecond);
+}
+
+void setBulkTransferLimit(JNIEnv* env, jobject /* this */, jint maxBulkTransfers) {
+    ensureInitialized();
+    g_server->setBulkTransferLimit(maxBulkTransfers);
+}
+
+// [accepted, rejected, active, queued, workers, queueDepth, maxConnections,
+//  sendfileTransfers, spliceTransfers, copyTransfers,
+//  interactiveRequests, interactiveQueueUs, interactiveQueueMaxUs,
+//  bulkRequests, bulkQueueUs, bulkQueueMaxUs,
+//  activeBulkTransfers, waitingBulkTransfers, maxBulkTransfers]
+jlongArray getServerStats(JNIEnv* env, jobject /* this */) {
+    ensureInitialized();
+    HttpServer::Stats stats = g_server->getStats();
+    
+    jlong values[] = {
+        stats.acceptedConnections,
+        stats.rejectedConnections,
+        stats.activeConnections,
+        stats.queuedConnections,
+        stats.workerCount,
+        stats.queueDepth,
+        stats.maxConnections,
+        stats.sendfileTransfers,
+        stats.spliceTransfers,
+        stats.copyTransfers,
+        stats.interactiveRequests,
+        stats.interactiveQueueUs,
+        stats.interactiveQueueMaxUs,
+        stats.bulkRequests,
+        stats.bulkQueueUs,
+        stats.bulkQueueMaxUs,
+        stats.activeBulkTransfers,
+        stats.waitingBulkTransfers,
+        stats.maxBulkTransfers,
+    };
+    jsize count = sizeof(values) / sizeof(values[0]);
+    jlongArray result = env->NewLongArray(count);
+    if (result) {
+        env->SetLongArrayRegion(result, 0, count, values);
+    }
+    return result;
+}
+
+jstring getMetrics(JNIEnv* env, jobject /* this */) {
+    ensureInitialized();
+    return env->NewStringUTF(g_server->renderMetrics().c_str());
+}
+
+jstring getRequestTrace(JNIEnv* env, jobject /* this */) {
+    ensureInitialized();
+    return env->NewStringUTF(g_server->exportTrace().c_str());
+}
+
+jboolean startCapture(JNIEnv* env, jobject /* this */, jstring path) {
+    ensureInitialized();
+    
+    const char* pathChars = env->GetStringUTFChars(path, nullptr);
+    bool started = g_server->startCapture(pathChars);
+    env->ReleaseStringUTFChars(path, pathChars);
+    return started ? JNI_TRUE : JNI_FALSE;
+}
+
+void stopCapture(JNIEnv* env, jobject /* this */) {
+    if (g_server) {
+        g_server->stopCapture();
+    }
+}
+
 void setCredentials(JNIEnv* env, jobject /* this */, jstring username, jstring password) {
     ensureInitialized();
     
@@ -113,16 +214,43 @@ void clearFiles(JNIEnv* env, jobject /* this */) {
     }
 }
 
+void setContentSniffing(JNIEnv* env, jobject /* this */, jboolean enabled) {
+    ensureInitialized();
+    g_fileManager->setContentSniffing(enabled == JNI_TRUE);
+}
+
+void setContentHashing(JNIEnv* env, jobject /* this */, jboolean enabled, jboolean sha256,
+                       jstring cacheDirectory) {
+    ensureInitialized();
+    
+    const char* directoryChars = env->GetStringUTFChars(cacheDirectory, nullptr);
+    g_fileManager->setContentHashing(enabled == JNI_TRUE, sha256 == JNI_TRUE, directoryChars);
+    env->ReleaseStringUTFChars(cacheDirectory, directoryChars);
+}
+
 static const JNINativeMethod gMethods[] = {
     {"startServer", "(I)Z", (void *) startServer},
     {"stopServer",          "()V",                                (void *) stopServer},
     {"isServerRunning", "()Z",               (void *) isServerRunning},
     {"getServerPort",          "()I",               (void *) getServerPort},
+    {"setServerLimits", "(III)V", (void *) setServerLimits},
+    {"getServerStats", "()[J", (void *) getServerStats},
+    {"getMetrics", "()Ljava/lang/String;", (void *) getMetrics},
+    {"getRequestTrace", "()Ljava/lang/String;", (void *) getRequestTrace},
+    {"startCapture", "(Ljava/lang/String;)Z", (void *) startCapture},
+    {"stopCapture", "()V", (void *) stopCapture},
+    {"setKeepAlive", "(II)V", (void *) setKeepAlive},
+    {"setBulkTransferLimit", "(I)V", (void *) setBulkTransferLimit},
+    {"setUploadDirectory", "(Ljava/lang/String;)V", (void *) setUploadDirectory},
+    {"setCompressionCache", "(Ljava/lang/String;J)V", (void *) setCompressionCache},
+    {"setRateLimits", "(JJJ)V", (void *) setRateLimits},
     {"setCredentials", "(Ljava/lang/String;Ljava/lang/String;)V", (void *) setCredentials},
     {"addFile", "(Ljava/lang/String;Ljava/lang/String;Ljava/lang/String;J)V", (void *) addFile},
     {"addFileDescriptor", "(Ljava/lang/String;Ljava/lang/String;IJ)V", (void *) addFileDescriptor},
     {"removeFile", "(Ljava/lang/String;)V", (void *) removeFile},
     {"clearFiles", "()V", (void *) clearFiles},
+    {"setContentSniffing", "(Z)V", (void *) setContentSniffing},
+    {"setContentHashing", "(ZZLjava/lang/String;)V", (void *) setContentHashing},
 };
 
 jint JNI_OnLoad(JavaVM *vm, void *) {
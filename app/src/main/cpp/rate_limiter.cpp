@@ -0,0 +1,138 @@
+#include "rate_limiter.h"
+
+#include <algorithm>
+
+namespace {
+
+constexpr int64_t NS_PER_SECOND = 1000000000;
+// A bucket holds this much time worth of tokens, but never less than MIN_BURST
+constexpr int64_t BURST_NS = 50000000;
+constexpr int64_t MIN_BURST = 16 * 1024;
+
+int64_t costNs(size_t bytes, int64_t rate) {
+    return static_cast<int64_t>(static_cast<double>(bytes) * NS_PER_SECOND / rate);
+}
+
+int64_t burstNs(int64_t rate) {
+    return std::max(BURST_NS, costNs(MIN_BURST, rate));
+}
+
+} // namespace
+
+void RateBucket::setRate(int64_t bytesPerSecond) {
+    rate_.store(std::max<int64_t>(bytesPerSecond, 0), std::memory_order_relaxed);
+    fullAtNs_.store(0, std::memory_order_relaxed);
+}
+
+size_t RateBucket::burstBytes() const {
+    int64_t rate = rate_.load(std::memory_order_relaxed);
+    if (rate <= 0) {
+        return SIZE_MAX;
+    }
+    return static_cast<size_t>(static_cast<double>(burstNs(rate)) * rate / NS_PER_SECOND);
+}
+
+int64_t RateBucket::reserve(size_t bytes, int64_t nowNs) {
+    int64_t rate = rate_.load(std::memory_order_relaxed);
+    if (rate <= 0) {
+        return 0;
+    }
+    
+    int64_t fullAt = fullAtNs_.load(std::memory_order_relaxed);
+    int64_t newFullAt;
+    do {
+        newFullAt = std::max(fullAt, nowNs) + costNs(bytes, rate);
+    } while (!fullAtNs_.compare_exchange_weak(fullAt, newFullAt, std::memory_order_relaxed));
+    // Whatever fits in the burst allowance can go right away
+    return std::max<int64_t>(0, newFullAt - burstNs(rate) - nowNs);
+}
+
+void RateBucket::giveBack(size_t bytes) {
+    int64_t rate = rate_.load(std::memory_order_relaxed);
+    if (rate > 0 && bytes > 0) {
+        fullAtNs_.fetch_sub(costNs(bytes, rate), std::memory_order_relaxed);
+    }
+}
+
+void RateLimiter::setLimits(int64_t global, int64_t perClient, int64_t perTransfer) {
+    global_.setRate(global);
+    perClient_.store(std::max<int64_t>(perClient, 0), std::memory_order_relaxed);
+    perTransfer_.store(std::max<int64_t>(perTransfer, 0), std::memory_order_relaxed);
+    active_.store(global > 0 || perClient > 0 || perTransfer > 0, std::memory_order_relaxed);
+    {
+        // Existing client buckets pick up the new rate now; new ones get it when created
+        std::lock_guard<std::mutex> lock(clientsMutex_);
+        for (auto& client : clients_) {
+            if (auto bucket = client.second.lock()) {
+                bucket->setRate(perClient);
+            }
+        }
+    }
+    generation_.fetch_add(1, std::memory_order_release);
+}
+
+std::shared_ptr<RateBucket> RateLimiter::clientBucket(const std::string& address) {
+    int64_t rate = perClient_.load(std::memory_order_relaxed);
+    if (rate <= 0) {
+        return nullptr;
+    }
+    
+    std::lock_guard<std::mutex> lock(clientsMutex_);
+    std::weak_ptr<RateBucket>& slot = clients_[address];
+    std::shared_ptr<RateBucket> bucket = slot.lock();
+    if (!bucket) {
+        bucket = std::make_shared<RateBucket>();
+        bucket->setRate(rate);
+        slot = bucket;
+    }
+    if (clients_.size() > MAX_IDLE_CLIENTS) {
+        // Forget clients that have no connection left
+        for (auto it = clients_.begin(); it != clients_.end();) {
+            it = it->second.expired() ? clients_.erase(it) : std::next(it);
+        }
+    }
+    return bucket;
+}
+
+int64_t RateLimiter::acquire(Grant& grant, RateBucket& transfer, RateBucket* client, size_t want,
+                             int64_t nowNs) {
+    if (grant.ready > 0) {
+        return 0;
+    }
+    
+    RateBucket* levels[] = {&transfer, client, &global_};
+    if (grant.pending == 0) {
+        // No more than any bucket can pass at once, so turns stay short
+        grant.pending = want;
+        for (RateBucket* bucket : levels) {
+            if (bucket) {
+                grant.pending = std::min(grant.pending, bucket->burstBytes());
+            }
+        }
+        grant.level = 0;
+    }
+    
+    // Narrowest level first: waiting on it doesn't hold capacity at the wider ones
+    while (grant.level < 3) {
+        RateBucket* bucket = levels[grant.level++];
+        int64_t waitNs = bucket ? bucket->reserve(grant.pending, nowNs) : 0;
+        if (waitNs > 0) {
+            return waitNs;
+        }
+    }
+    grant.ready = grant.pending;
+    grant.pending = 0;
+    grant.level = 0;
+    return 0;
+}
+
+void RateLimiter::release(Grant& grant, RateBucket& transfer, RateBucket* client) {
+    RateBucket* levels[] = {&transfer, client, &global_};
+    for (int level = 0; level < 3; level++) {
+        size_t booked = grant.ready + (level < grant.level ? grant.pending : 0);
+        if (levels[level] && booked > 0) {
+            levels[level]->giveBack(booked);
+        }
+    }
+    grant = Grant();
+}
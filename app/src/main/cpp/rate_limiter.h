@@ -0,0 +1,73 @@
+#pragma once
+
+#include <string>
+#include <unordered_map>
+#include <memory>
+#include <mutex>
+#include <atomic>
+#include <cstdint>
+#include <cstddef>
+
+// Token bucket kept as virtual time (GCRA): the bucket stores the instant at
+// which it would be full again. Reserving tokens is a single CAS with no lock,
+// and reservations queue up in arrival order, so transfers sharing a bucket
+// take turns instead of racing for whatever has trickled in.
+class RateBucket {
+public:
+    // Bytes per second; <= 0 means unlimited. Also refills the bucket.
+    void setRate(int64_t bytesPerSecond);
+    bool limited() const { return rate_.load(std::memory_order_relaxed) > 0; }
+    // Largest reservation that can go out at once from a full bucket
+    size_t burstBytes() const;
+    
+    // Books 'bytes'; returns how long to wait before sending them (0 = now)
+    int64_t reserve(size_t bytes, int64_t nowNs);
+    // Returns booked tokens that won't be used
+    void giveBack(size_t bytes);
+    
+private:
+    std::atomic<int64_t> rate_{0};
+    std::atomic<int64_t> fullAtNs_{0};
+};
+
+// Global, per-client and per-transfer limits applied together. Client buckets
+// are shared by every connection from the same address, across event loops.
+class RateLimiter {
+public:
+    // A transfer's reservation as it works through the levels
+    struct Grant {
+        size_t ready = 0;       // Booked at every level; may be sent now
+        size_t pending = 0;     // Being booked
+        int level = 0;          // Levels [0, level) already hold 'pending'
+    };
+    
+    // Bytes per second; <= 0 lifts that limit. Applies to transfers in flight.
+    void setLimits(int64_t global, int64_t perClient, int64_t perTransfer);
+    
+    bool active() const { return active_.load(std::memory_order_relaxed); }
+    // Changes whenever the limits do, so connections know to refresh their buckets
+    uint32_t generation() const { return generation_.load(std::memory_order_acquire); }
+    int64_t transferRate() const { return perTransfer_.load(std::memory_order_relaxed); }
+    
+    // The shared bucket for a client address; nullptr without a per-client limit
+    std::shared_ptr<RateBucket> clientBucket(const std::string& address);
+    
+    // Books up to 'want' bytes at each level in turn. Returns 0 once grant.ready
+    // is available, otherwise how long to wait before calling again.
+    int64_t acquire(Grant& grant, RateBucket& transfer, RateBucket* client, size_t want,
+                    int64_t nowNs);
+    // Hands back whatever the grant still holds
+    void release(Grant& grant, RateBucket& transfer, RateBucket* client);
+    
+private:
+    RateBucket global_;
+    std::atomic<bool> active_{false};
+    std::atomic<uint32_t> generation_{1};
+    std::atomic<int64_t> perClient_{0};
+    std::atomic<int64_t> perTransfer_{0};
+    
+    std::mutex clientsMutex_;
+    std::unordered_map<std::string, std::weak_ptr<RateBucket>> clients_;
+    
+    static constexpr size_t MAX_IDLE_CLIENTS = 256;
+};
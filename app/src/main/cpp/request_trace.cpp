@@ -0,0 +1,139 @@
+#include "request_trace.h"
+#include "file_listing.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+
+static_assert(std::is_trivially_copyable<RequestTrace>::value, "ring slots copy traces as words");
+
+void RequestTrace::clear() {
+    memset(this, 0, sizeof(*this));
+}
+
+void RequestTrace::setRequest(std::string_view requestMethod, std::string_view requestTarget) {
+    size_t methodLength = std::min(requestMethod.size(), sizeof(method) - 1);
+    memcpy(method, requestMethod.data(), methodLength);
+    method[methodLength] = '\0';
+    size_t targetLength = std::min(requestTarget.size(), sizeof(target) - 1);
+    memcpy(target, requestTarget.data(), targetLength);
+    target[targetLength] = '\0';
+}
+
+int64_t RequestTrace::now() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+void RequestTracer::Ring::record(const RequestTrace& trace) {
+    uint64_t words[WORDS] = {};
+    memcpy(words, &trace, sizeof(trace));
+    
+    Slot& slot = slots_[next_.load(std::memory_order_relaxed) % RING_SIZE];
+    uint32_t sequence = slot.sequence.load(std::memory_order_relaxed);
+    slot.sequence.store(sequence + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    for (size_t i = 0; i < WORDS; i++) {
+        slot.words[i].store(words[i], std::memory_order_relaxed);
+    }
+    slot.sequence.store(sequence + 2, std::memory_order_release);
+    next_.store(next_.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+}
+
+void RequestTracer::Ring::snapshot(std::vector<RequestTrace>& out) const {
+    uint64_t end = next_.load(std::memory_order_acquire);
+    uint64_t begin = end > RING_SIZE ? end - RING_SIZE : 0;
+    for (uint64_t index = begin; index < end; index++) {
+        const Slot& slot = slots_[index % RING_SIZE];
+        uint32_t before = slot.sequence.load(std::memory_order_acquire);
+        if (before == 0 || (before & 1)) {
+            continue;
+        }
+        uint64_t words[WORDS];
+        for (size_t i = 0; i < WORDS; i++) {
+            words[i] = slot.words[i].load(std::memory_order_relaxed);
+        }
+        std::atomic_thread_fence(std::memory_order_acquire);
+        if (slot.sequence.load(std::memory_order_relaxed) != before) {
+            // Overwritten while we copied it; the newer record is read on its own turn
+            continue;
+        }
+        RequestTrace trace;
+        memcpy(&trace, words, sizeof(trace));
+        out.push_back(trace);
+    }
+}
+
+RequestTracer::Ring* RequestTracer::ring(size_t index) {
+    std::lock_guard<std::mutex> lock(ringsMutex_);
+    while (rings_.size() <= index) {
+        rings_.push_back(std::make_unique<Ring>());
+    }
+    return rings_[index].get();
+}
+
+namespace {
+
+// One complete ("X") event between two stamps, skipped if either is missing
+void appendSpan(std::string& out, bool& first, const char* name, size_t track,
+                int64_t startNs, int64_t endNs, const std::string& args = std::string()) {
+    if (startNs == 0 || endNs == 0 || endNs < startNs) {
+        return;
+    }
+    char event[192];
+    snprintf(event, sizeof(event),
+             "%s{\"name\":\"%s\",\"ph\":\"X\",\"pid\":1,\"tid\":%zu,\"ts\":%.3f,\"dur\":%.3f",
+             first ? "" : ",\n", name, track, startNs / 1e3, (endNs - startNs) / 1e3);
+    first = false;
+    out += event;
+    out += args;
+    out += "}";
+}
+
+} // namespace
+
+std::string RequestTracer::exportJson() const {
+    std::vector<Ring*> rings;
+    {
+        std::lock_guard<std::mutex> lock(ringsMutex_);
+        for (const auto& ring : rings_) {
+            rings.push_back(ring.get());
+        }
+    }
+    
+    std::string out = "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n";
+    bool first = true;
+    std::vector<RequestTrace> traces;
+    for (size_t track = 0; track < rings.size(); track++) {
+        traces.clear();
+        rings[track]->snapshot(traces);
+        for (const RequestTrace& trace : traces) {
+            const int64_t* ns = trace.ns;
+            int64_t start = ns[RequestTrace::Accepted] ? ns[RequestTrace::Accepted]
+                                                       : ns[RequestTrace::ReadStart];
+            
+            // The whole request, then its phases nested inside it
+            std::string args = ",\"args\":{\"target\":";
+            FileListing::appendJsonString(args, trace.target);
+            args += ",\"status\":" + std::to_string(trace.status) +
+                    ",\"bytes\":" + std::to_string(trace.bytesSent) + "}";
+            std::string name = std::string(trace.method) + " request";
+            appendSpan(out, first, name.c_str(), track, start, ns[RequestTrace::Done], args);
+            appendSpan(out, first, "accept queue", track,
+                       ns[RequestTrace::Accepted], ns[RequestTrace::Adopted]);
+            appendSpan(out, first, "read request", track,
+                       ns[RequestTrace::ReadStart], ns[RequestTrace::Parsed]);
+            appendSpan(out, first, "auth", track,
+                       ns[RequestTrace::AuthStart], ns[RequestTrace::AuthEnd]);
+            appendSpan(out, first, "open file", track,
+                       ns[RequestTrace::OpenStart], ns[RequestTrace::OpenEnd]);
+            appendSpan(out, first, "first byte", track,
+                       ns[RequestTrace::Parsed], ns[RequestTrace::FirstByte]);
+            appendSpan(out, first, "transfer", track,
+                       ns[RequestTrace::FirstByte], ns[RequestTrace::Done]);
+        }
+    }
+    out += "\n]}\n";
+    return out;
+}
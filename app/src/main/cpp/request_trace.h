@@ -0,0 +1,95 @@
+#pragma once
+
+#include <string>
+#include <string_view>
+#include <vector>
+#include <memory>
+#include <mutex>
+#include <atomic>
+#include <cstdint>
+
+// Per-request phase tracing. Builds with FILESERVER_TRACING=1 stamp each phase of
+// a request with the monotonic clock and keep the last requests of every event
+// loop in a ring, exported as Chrome trace JSON (chrome://tracing, Perfetto).
+// Otherwise the TRACE_* macros expand to nothing and connections carry no trace.
+#ifndef FILESERVER_TRACING
+#define FILESERVER_TRACING 0
+#endif
+
+// One request's timestamps while it is in flight, and as stored in the ring
+struct RequestTrace {
+    enum Stamp {
+        Accepted,       // accept() returned
+        Adopted,        // An event loop took the socket off its queue
+        ReadStart,      // First bytes of the request head arrived
+        Parsed,
+        AuthStart,
+        AuthEnd,
+        OpenStart,      // Opening the file (or SAF descriptor) to send
+        OpenEnd,
+        FirstByte,      // First response byte written to the socket
+        Done,
+        STAMP_COUNT,
+    };
+    
+    static constexpr size_t TARGET_SIZE = 64;
+    
+    int64_t ns[STAMP_COUNT];    // Monotonic; 0 when the phase never happened
+    int64_t bytesSent;
+    int32_t status;
+    char method[8];
+    char target[TARGET_SIZE];   // Truncated; NUL-terminated
+    
+    RequestTrace() { clear(); }
+    void clear();
+    void mark(Stamp stamp) { ns[stamp] = now(); }
+    void markOnce(Stamp stamp) { if (ns[stamp] == 0) ns[stamp] = now(); }
+    void setRequest(std::string_view requestMethod, std::string_view requestTarget);
+    
+    static int64_t now();
+};
+
+class RequestTracer {
+public:
+    static constexpr size_t RING_SIZE = 256;    // Requests kept per event loop
+    
+    // Single-writer ring: only the owning loop records, any thread may read.
+    // Each slot is a seqlock, so a reader skips a slot caught mid-write.
+    class Ring {
+    public:
+        void record(const RequestTrace& trace);
+        // Appends the complete records, oldest first
+        void snapshot(std::vector<RequestTrace>& out) const;
+    
+    private:
+        static constexpr size_t WORDS = (sizeof(RequestTrace) + 7) / 8;
+        
+        struct Slot {
+            std::atomic<uint32_t> sequence{0};      // Odd while being written
+            std::atomic<uint64_t> words[WORDS] = {};
+        };
+        
+        Slot slots_[RING_SIZE];
+        std::atomic<uint64_t> next_{0};
+    };
+    
+    // Ring 'index', created on first use; rings live as long as this object
+    Ring* ring(size_t index);
+    
+    // Chrome trace JSON ("traceEvents") for every stored request, one track per loop
+    std::string exportJson() const;
+    
+private:
+    mutable std::mutex ringsMutex_;
+    std::vector<std::unique_ptr<Ring>> rings_;
+};
+
+#if FILESERVER_TRACING
+#define TRACE_MARK(trace, stamp) (trace).mark(RequestTrace::stamp)
+#define TRACE_MARK_ONCE(trace, stamp) (trace).markOnce(RequestTrace::stamp)
+#define TRACE_DO(statement) statement
+#else
+#define TRACE_MARK(trace, stamp) ((void)0)
+#define TRACE_MARK_ONCE(trace, stamp) ((void)0)
+#define TRACE_DO(statement) ((void)0)
+#endif
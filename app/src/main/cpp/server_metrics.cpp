@@ -0,0 +1,152 @@
+#include "server_metrics.h"
+
+#include <cstdio>
+
+namespace {
+
+// Statuses the server sends, each with its own series; anything else is "other"
+const int kStatuses[] = {200, 201, 202, 204, 206, 304, 400, 401, 403, 404, 405, 409,
+                         411, 413, 416, 431, 500, 503, 507};
+constexpr int STATUS_SLOTS = sizeof(kStatuses) / sizeof(kStatuses[0]);
+constexpr int OTHER_STATUS = STATUS_SLOTS;
+
+const char* const kRouteNames[] = {
+    "index", "files", "download", "archive", "upload", "upload_session", "metrics", "other",
+};
+
+int statusSlot(int status) {
+    for (int i = 0; i < STATUS_SLOTS; i++) {
+        if (kStatuses[i] == status) return i;
+    }
+    return OTHER_STATUS;
+}
+
+void appendHistogram(std::string& out, const char* name, const char* help,
+                     const std::vector<ServerMetrics::Shard*>& shards,
+                     ServerMetrics::Histogram ServerMetrics::Shard::*member) {
+    using Histogram = ServerMetrics::Histogram;
+    out += std::string("# HELP ") + name + " " + help + "\n";
+    out += std::string("# TYPE ") + name + " histogram\n";
+    
+    uint64_t cumulative = 0;
+    uint64_t sumMicros = 0;
+    char line[160];
+    for (int bucket = 0; bucket < Histogram::BUCKETS; bucket++) {
+        for (const ServerMetrics::Shard* shard : shards) {
+            cumulative += (shard->*member).counts[bucket].get();
+        }
+        snprintf(line, sizeof(line), "%s_bucket{le=\"%.6f\"} %llu\n", name,
+                 Histogram::upperBound(bucket) / 1e6, static_cast<unsigned long long>(cumulative));
+        out += line;
+    }
+    for (const ServerMetrics::Shard* shard : shards) {
+        sumMicros += (shard->*member).sumMicros.get();
+    }
+    snprintf(line, sizeof(line), "%s_bucket{le=\"+Inf\"} %llu\n%s_sum %.6f\n%s_count %llu\n",
+             name, static_cast<unsigned long long>(cumulative), name, sumMicros / 1e6, name,
+             static_cast<unsigned long long>(cumulative));
+    out += line;
+}
+
+} // namespace
+
+static_assert(STATUS_SLOTS + 1 <= 24, "Shard::requests has a slot per status plus one");
+static_assert(sizeof(kRouteNames) / sizeof(kRouteNames[0]) ==
+              static_cast<size_t>(ServerMetrics::Route::Count), "a name for every route");
+
+int ServerMetrics::Histogram::bucketOf(uint64_t micros) {
+    if (micros < SUB_BUCKETS) {
+        return static_cast<int>(micros);
+    }
+    int exponent = 63 - __builtin_clzll(micros);
+    if (exponent >= MAX_EXPONENT) {
+        return BUCKETS - 1;
+    }
+    int sub = static_cast<int>((micros >> (exponent - SUB_BUCKET_BITS)) & (SUB_BUCKETS - 1));
+    return (exponent - SUB_BUCKET_BITS + 1) * SUB_BUCKETS + sub;
+}
+
+uint64_t ServerMetrics::Histogram::upperBound(int bucket) {
+    if (bucket < SUB_BUCKETS) {
+        return bucket;
+    }
+    int exponent = bucket / SUB_BUCKETS + SUB_BUCKET_BITS - 1;
+    uint64_t sub = bucket % SUB_BUCKETS;
+    return ((SUB_BUCKETS + sub + 1) << (exponent - SUB_BUCKET_BITS)) - 1;
+}
+
+void ServerMetrics::Histogram::record(uint64_t micros) {
+    counts[bucketOf(micros)].add(1);
+    sumMicros.add(micros);
+}
+
+void ServerMetrics::Shard::countRequest(Route route, int status) {
+    requests[static_cast<int>(route)][statusSlot(status)].add(1);
+}
+
+ServerMetrics::Shard* ServerMetrics::shard(size_t index) {
+    std::lock_guard<std::mutex> lock(shardsMutex_);
+    while (shards_.size() <= index) {
+        shards_.push_back(std::make_unique<Shard>());
+    }
+    return shards_[index].get();
+}
+
+void ServerMetrics::appendMetric(std::string& out, const char* name, const char* type,
+                                 const char* help, int64_t value) {
+    out += std::string("# HELP ") + name + " " + help + "\n";
+    out += std::string("# TYPE ") + name + " " + type + "\n";
+    out += std::string(name) + " " + std::to_string(value) + "\n";
+}
+
+void ServerMetrics::render(std::string& out) const {
+    std::vector<Shard*> shards;
+    {
+        std::lock_guard<std::mutex> lock(shardsMutex_);
+        for (const auto& shard : shards_) {
+            shards.push_back(shard.get());
+        }
+    }
+    
+    auto sum = [&shards](Counter Shard::*member) {
+        uint64_t total = 0;
+        for (const Shard* shard : shards) {
+            total += (shard->*member).get();
+        }
+        return static_cast<int64_t>(total);
+    };
+    
+    out += "# HELP fileserver_requests_total Responses sent, by route and status.\n";
+    out += "# TYPE fileserver_requests_total counter\n";
+    for (int route = 0; route < static_cast<int>(Route::Count); route++) {
+        for (int slot = 0; slot <= STATUS_SLOTS; slot++) {
+            uint64_t count = 0;
+            for (const Shard* shard : shards) {
+                count += shard->requests[route][slot].get();
+            }
+            if (count == 0) {
+                continue;
+            }
+            std::string status = slot == OTHER_STATUS ? "other" : std::to_string(kStatuses[slot]);
+            out += std::string("fileserver_requests_total{route=\"") + kRouteNames[route] +
+                   "\",status=\"" + status + "\"} " + std::to_string(count) + "\n";
+        }
+    }
+    
+    appendMetric(out, "fileserver_sent_bytes_total", "counter",
+                 "Bytes written to client sockets.", sum(&Shard::bytesSent));
+    appendMetric(out, "fileserver_received_bytes_total", "counter",
+                 "Bytes read from client sockets.", sum(&Shard::bytesReceived));
+    appendMetric(out, "fileserver_auth_failures_total", "counter",
+                 "Requests rejected for missing or wrong credentials.", sum(&Shard::authFailures));
+    appendMetric(out, "fileserver_active_transfers", "gauge",
+                 "File and archive bodies being streamed.",
+                 sum(&Shard::transfersStarted) - sum(&Shard::transfersFinished));
+    
+    appendHistogram(out, "fileserver_first_byte_seconds",
+                    "Time from a request being read to the first response byte.",
+                    shards, &Shard::firstByte);
+    appendHistogram(out, "fileserver_request_duration_seconds",
+                    "Time from a request being read to the last response byte.",
+                    shards, &Shard::total);
+}
@@ -0,0 +1,84 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <memory>
+#include <mutex>
+#include <atomic>
+#include <cstdint>
+
+// Request counters and latency histograms for /metrics. Every event loop
+// writes only its own shard, so recording is a relaxed load and store on a
+// cache line no other thread writes; a scrape sums the shards.
+class ServerMetrics {
+public:
+    enum class Route {
+        Index,
+        Files,
+        Download,
+        Archive,
+        Upload,
+        UploadSession,
+        Metrics,
+        Other,
+        Count,
+    };
+    
+    // Monotonic counter with a single writing thread
+    class Counter {
+    public:
+        void add(uint64_t n) {
+            value_.store(value_.load(std::memory_order_relaxed) + n, std::memory_order_relaxed);
+        }
+        uint64_t get() const { return value_.load(std::memory_order_relaxed); }
+    
+    private:
+        std::atomic<uint64_t> value_{0};
+    };
+    
+    // HDR-style log-linear buckets over microseconds: each power of two is split
+    // into SUB_BUCKETS linear steps, so a bucket is never wider than 25% of its value
+    class Histogram {
+    public:
+        static constexpr int SUB_BUCKET_BITS = 2;
+        static constexpr int SUB_BUCKETS = 1 << SUB_BUCKET_BITS;
+        static constexpr int MAX_EXPONENT = 32;     // 2^32 us, about 71 minutes
+        static constexpr int BUCKETS = (MAX_EXPONENT - SUB_BUCKET_BITS + 1) * SUB_BUCKETS;
+        
+        void record(uint64_t micros);
+        
+        static int bucketOf(uint64_t micros);
+        // Largest value (in microseconds) that lands in 'bucket'
+        static uint64_t upperBound(int bucket);
+        
+        Counter counts[BUCKETS];
+        Counter sumMicros;
+    };
+    
+    struct alignas(64) Shard {
+        void countRequest(Route route, int status);
+        
+        Counter requests[static_cast<int>(Route::Count)][24];
+        Counter bytesSent;
+        Counter bytesReceived;
+        Counter authFailures;
+        Counter transfersStarted;
+        Counter transfersFinished;
+        Histogram firstByte;    // Request read -> first response byte sent
+        Histogram total;        // Request read -> last response byte sent
+    };
+    
+    // Shard 'index', created on first use; shards live as long as this object
+    Shard* shard(size_t index);
+    
+    // Appends the sharded metrics in Prometheus text format
+    void render(std::string& out) const;
+    
+    // One sample of a server-level counter or gauge in the same format
+    static void appendMetric(std::string& out, const char* name, const char* type,
+                             const char* help, int64_t value);
+    
+private:
+    mutable std::mutex shardsMutex_;
+    std::vector<std::unique_ptr<Shard>> shards_;
+};
@@ -0,0 +1,178 @@
+#include "sha256.h"
+
+#include <cstring>
+#include <algorithm>
+
+namespace {
+
+constexpr uint32_t kRoundConstants[64] = {
+    0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+    0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+    0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+    0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+    0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+    0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+    0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+    0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2,
+};
+
+inline uint32_t rotr(uint32_t x, int n) {
+    return (x >> n) | (x << (32 - n));
+}
+
+} // namespace
+
+Sha256::Sha256() : state_{0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a,
+                          0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19} {
+}
+
+void Sha256::update(const void* data, size_t length) {
+    const uint8_t* bytes = static_cast<const uint8_t*>(data);
+    totalLength_ += length;
+    
+    if (bufferLength_ > 0) {
+        size_t take = std::min(length, sizeof(buffer_) - bufferLength_);
+        memcpy(buffer_ + bufferLength_, bytes, take);
+        bufferLength_ += take;
+        bytes += take;
+        length -= take;
+        if (bufferLength_ < sizeof(buffer_)) {
+            return;
+        }
+        compress(buffer_);
+        bufferLength_ = 0;
+    }
+    // Whole blocks straight from the input
+    while (length >= sizeof(buffer_)) {
+        compress(bytes);
+        bytes += sizeof(buffer_);
+        length -= sizeof(buffer_);
+    }
+    memcpy(buffer_, bytes, length);
+    bufferLength_ = length;
+}
+
+Sha256::Digest Sha256::finish() {
+    uint64_t bitLength = totalLength_ * 8;
+    uint8_t padding[72] = {0x80};
+    size_t padLength = (bufferLength_ < 56 ? 56 : 120) - bufferLength_;
+    for (int i = 0; i < 8; i++) {
+        padding[padLength + i] = static_cast<uint8_t>(bitLength >> (56 - 8 * i));
+    }
+    update(padding, padLength + 8);
+    
+    Digest digest;
+    for (int i = 0; i < 8; i++) {
+        digest[4 * i] = static_cast<uint8_t>(state_[i] >> 24);
+        digest[4 * i + 1] = static_cast<uint8_t>(state_[i] >> 16);
+        digest[4 * i + 2] = static_cast<uint8_t>(state_[i] >> 8);
+        digest[4 * i + 3] = static_cast<uint8_t>(state_[i]);
+    }
+    return digest;
+}
+
+Sha256::Digest Sha256::hash(std::string_view data) {
+    Sha256 sha;
+    sha.update(data);
+    return sha.finish();
+}
+
+Sha256::Digest Sha256::hmac(std::string_view key, std::string_view message) {
+    uint8_t block[64] = {};
+    if (key.size() > sizeof(block)) {
+        Digest hashed = hash(key);
+        memcpy(block, hashed.data(), hashed.size());
+    } else {
+        memcpy(block, key.data(), key.size());
+    }
+    
+    uint8_t pad[64];
+    for (size_t i = 0; i < sizeof(pad); i++) {
+        pad[i] = block[i] ^ 0x36;
+    }
+    Sha256 inner;
+    inner.update(pad, sizeof(pad));
+    inner.update(message);
+    Digest innerDigest = inner.finish();
+    
+    for (size_t i = 0; i < sizeof(pad); i++) {
+        pad[i] = block[i] ^ 0x5c;
+    }
+    Sha256 outer;
+    outer.update(pad, sizeof(pad));
+    outer.update(innerDigest.data(), innerDigest.size());
+    return outer.finish();
+}
+
+std::string Sha256::toHex(const Digest& digest) {
+    static const char hex[] = "0123456789abcdef";
+    std::string out;
+    out.reserve(digest.size() * 2);
+    for (uint8_t b : digest) {
+        out.push_back(hex[b >> 4]);
+        out.push_back(hex[b & 0xf]);
+    }
+    return out;
+}
+
+std::string Sha256::toBase64(const Digest& digest) {
+    static const char alphabet[] =
+        "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+    std::string out;
+    out.reserve(44);
+    size_t i = 0;
+    for (; i + 2 < digest.size(); i += 3) {
+        uint32_t n = (uint32_t(digest[i]) << 16) | (uint32_t(digest[i + 1]) << 8) | digest[i + 2];
+        out.push_back(alphabet[n >> 18]);
+        out.push_back(alphabet[(n >> 12) & 63]);
+        out.push_back(alphabet[(n >> 6) & 63]);
+        out.push_back(alphabet[n & 63]);
+    }
+    // 32 bytes leave two over
+    uint32_t n = (uint32_t(digest[i]) << 16) | (uint32_t(digest[i + 1]) << 8);
+    out.push_back(alphabet[n >> 18]);
+    out.push_back(alphabet[(n >> 12) & 63]);
+    out.push_back(alphabet[(n >> 6) & 63]);
+    out.push_back('=');
+    return out;
+}
+
+void Sha256::compress(const uint8_t* block) {
+    uint32_t w[64];
+    for (int i = 0; i < 16; i++) {
+        w[i] = (uint32_t(block[4 * i]) << 24) | (uint32_t(block[4 * i + 1]) << 16) |
+               (uint32_t(block[4 * i + 2]) << 8) | uint32_t(block[4 * i + 3]);
+    }
+    for (int i = 16; i < 64; i++) {
+        uint32_t s0 = rotr(w[i - 15], 7) ^ rotr(w[i - 15], 18) ^ (w[i - 15] >> 3);
+        uint32_t s1 = rotr(w[i - 2], 17) ^ rotr(w[i - 2], 19) ^ (w[i - 2] >> 10);
+        w[i] = w[i - 16] + s0 + w[i - 7] + s1;
+    }
+    
+    uint32_t a = state_[0], b = state_[1], c = state_[2], d = state_[3];
+    uint32_t e = state_[4], f = state_[5], g = state_[6], h = state_[7];
+    for (int i = 0; i < 64; i++) {
+        uint32_t s1 = rotr(e, 6) ^ rotr(e, 11) ^ rotr(e, 25);
+        uint32_t ch = (e & f) ^ (~e & g);
+        uint32_t t1 = h + s1 + ch + kRoundConstants[i] + w[i];
+        uint32_t s0 = rotr(a, 2) ^ rotr(a, 13) ^ rotr(a, 22);
+        uint32_t maj = (a & b) ^ (a & c) ^ (b & c);
+        uint32_t t2 = s0 + maj;
+        h = g;
+        g = f;
+        f = e;
+        e = d + t1;
+        d = c;
+        c = b;
+        b = a;
+        a = t1 + t2;
+    }
+    state_[0] += a;
+    state_[1] += b;
+    state_[2] += c;
+    state_[3] += d;
+    state_[4] += e;
+    state_[5] += f;
+    state_[6] += g;
+    state_[7] += h;
+}
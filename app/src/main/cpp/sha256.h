@@ -0,0 +1,34 @@
+#pragma once
+
+#include <array>
+#include <string>
+#include <string_view>
+#include <cstddef>
+#include <cstdint>
+
+// Incremental SHA-256 (FIPS 180-4)
+class Sha256 {
+public:
+    using Digest = std::array<uint8_t, 32>;
+    
+    Sha256();
+    
+    void update(const void* data, size_t length);
+    void update(std::string_view data) { update(data.data(), data.size()); }
+    Digest finish();
+    
+    static Digest hash(std::string_view data);
+    // HMAC-SHA256 (RFC 2104)
+    static Digest hmac(std::string_view key, std::string_view message);
+    static std::string toHex(const Digest& digest);
+    // Standard alphabet, padded, as Digest and Repr-Digest headers carry it
+    static std::string toBase64(const Digest& digest);
+    
+private:
+    void compress(const uint8_t* block);
+    
+    uint32_t state_[8];
+    uint8_t buffer_[64];
+    size_t bufferLength_ = 0;
+    uint64_t totalLength_ = 0;
+};
@@ -0,0 +1,212 @@
+#include "traffic_capture.h"
+
+#include <unistd.h>
+#include <fcntl.h>
+#include <cerrno>
+#include <cstring>
+#include <algorithm>
+#include <chrono>
+#include <android/log.h>
+
+#define LOG_TAG "TrafficCapture"
+#define LOGI(...) __android_log_print(ANDROID_LOG_INFO, LOG_TAG, __VA_ARGS__)
+#define LOGE(...) __android_log_print(ANDROID_LOG_ERROR, LOG_TAG, __VA_ARGS__)
+
+namespace {
+
+void putVarint(std::string& out, uint64_t value) {
+    while (value >= 0x80) {
+        out.push_back(static_cast<char>(value | 0x80));
+        value >>= 7;
+    }
+    out.push_back(static_cast<char>(value));
+}
+
+void putString(std::string& out, const std::string& value) {
+    putVarint(out, value.size());
+    out += value;
+}
+
+bool getVarint(const uint8_t*& p, const uint8_t* end, uint64_t& out) {
+    out = 0;
+    for (int shift = 0; shift < 64 && p < end; shift += 7) {
+        uint8_t byte = *p++;
+        out |= static_cast<uint64_t>(byte & 0x7f) << shift;
+        if (!(byte & 0x80)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+bool getString(const uint8_t*& p, const uint8_t* end, std::string& out) {
+    uint64_t length;
+    if (!getVarint(p, end, length) || length > static_cast<uint64_t>(end - p)) {
+        return false;
+    }
+    out.assign(reinterpret_cast<const char*>(p), length);
+    p += length;
+    return true;
+}
+
+int64_t nowNs() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+} // namespace
+
+constexpr char TrafficCapture::MAGIC[8];
+
+TrafficCapture::TrafficCapture() = default;
+
+TrafficCapture::~TrafficCapture() {
+    stop();
+}
+
+bool TrafficCapture::start(const std::string& path) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (fd_ >= 0) {
+        flushLocked();
+        close(fd_);
+        fd_ = -1;
+    }
+    active_ = false;
+    
+    int fd = open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd < 0) {
+        LOGE("Cannot capture to %s: %s", path.c_str(), strerror(errno));
+        return false;
+    }
+    fd_ = fd;
+    buffer_.assign(MAGIC, sizeof(MAGIC));
+    clients_.clear();
+    nextConnection_ = 0;
+    startNs_ = nowNs();
+    generation_++;
+    active_ = true;
+    LOGI("Capturing traffic to %s", path.c_str());
+    return true;
+}
+
+void TrafficCapture::stop() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    active_ = false;
+    if (fd_ < 0) {
+        return;
+    }
+    flushLocked();
+    close(fd_);
+    fd_ = -1;
+    LOGI("Traffic capture stopped");
+}
+
+void TrafficCapture::assignIds(const std::string& address, uint32_t& client, uint32_t& connection) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    client = clients_.emplace(address, static_cast<uint32_t>(clients_.size())).first->second;
+    connection = nextConnection_++;
+}
+
+void TrafficCapture::append(const Record& record) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (fd_ < 0) {
+        return;
+    }
+    encode(record, buffer_);
+    if (buffer_.size() >= FLUSH_BYTES) {
+        flushLocked();
+    }
+}
+
+void TrafficCapture::flush() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    flushLocked();
+}
+
+void TrafficCapture::flushLocked() {
+    size_t written = 0;
+    while (fd_ >= 0 && written < buffer_.size()) {
+        ssize_t n = write(fd_, buffer_.data() + written, buffer_.size() - written);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            // Disk full or similar: give up on the capture rather than on requests
+            LOGE("Traffic capture write failed: %s", strerror(errno));
+            close(fd_);
+            fd_ = -1;
+            active_ = false;
+            break;
+        }
+        written += n;
+    }
+    buffer_.clear();
+}
+
+TrafficCapture::Method TrafficCapture::methodOf(std::string_view method) {
+    if (method == "GET") return Method::Get;
+    if (method == "HEAD") return Method::Head;
+    if (method == "PUT") return Method::Put;
+    if (method == "POST") return Method::Post;
+    return Method::Other;
+}
+
+const char* TrafficCapture::methodName(Method method) {
+    switch (method) {
+        case Method::Get: return "GET";
+        case Method::Head: return "HEAD";
+        case Method::Put: return "PUT";
+        case Method::Post: return "POST";
+        default: return "OTHER";
+    }
+}
+
+void TrafficCapture::encode(const Record& record, std::string& out) {
+    putVarint(out, record.startUs);
+    putVarint(out, record.durationUs);
+    putVarint(out, record.client);
+    putVarint(out, record.connection);
+    putVarint(out, record.status);
+    putVarint(out, record.bytesSent);
+    out.push_back(static_cast<char>(record.method));
+    putString(out, record.target);
+    putString(out, record.range);
+}
+
+bool TrafficCapture::read(const std::string& path, std::vector<Record>& out) {
+    int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        return false;
+    }
+    std::string data;
+    char chunk[1 << 16];
+    ssize_t n;
+    while ((n = ::read(fd, chunk, sizeof(chunk))) > 0) {
+        data.append(chunk, n);
+    }
+    close(fd);
+    if (n < 0 || data.size() < sizeof(MAGIC) || memcmp(data.data(), MAGIC, sizeof(MAGIC)) != 0) {
+        return false;
+    }
+    
+    const uint8_t* p = reinterpret_cast<const uint8_t*>(data.data()) + sizeof(MAGIC);
+    const uint8_t* end = reinterpret_cast<const uint8_t*>(data.data()) + data.size();
+    while (p < end) {
+        Record record;
+        uint64_t client, connection, status;
+        if (!getVarint(p, end, record.startUs) || !getVarint(p, end, record.durationUs) ||
+            !getVarint(p, end, client) || !getVarint(p, end, connection) ||
+            !getVarint(p, end, status) || !getVarint(p, end, record.bytesSent) || p >= end) {
+            return false;
+        }
+        record.method = static_cast<Method>(std::min<uint8_t>(*p++, static_cast<uint8_t>(Method::Other)));
+        if (!getString(p, end, record.target) || !getString(p, end, record.range)) {
+            return false;
+        }
+        record.client = static_cast<uint32_t>(client);
+        record.connection = static_cast<uint32_t>(connection);
+        record.status = static_cast<uint32_t>(status);
+        out.push_back(std::move(record));
+    }
+    return true;
+}
@@ -0,0 +1,78 @@
+#pragma once
+
+#include <string>
+#include <string_view>
+#include <vector>
+#include <unordered_map>
+#include <mutex>
+#include <atomic>
+#include <cstdint>
+
+// Request log for replaying real traffic against other builds. While a capture
+// is running, every finished request appends one compact record: when it
+// started, how long it took, who sent it, what it asked for and what it got.
+// Bodies and credentials are never recorded.
+//
+// File format: the 8-byte magic, then records of LEB128 varints and
+// length-prefixed strings (see encode()). Records are in completion order.
+class TrafficCapture {
+public:
+    enum class Method : uint8_t {
+        Get,
+        Head,
+        Put,
+        Post,
+        Other,
+    };
+    
+    struct Record {
+        uint64_t startUs = 0;       // Since the capture started
+        uint64_t durationUs = 0;    // Request read -> last response byte
+        uint32_t client = 0;        // Per-capture index of the client address
+        uint32_t connection = 0;    // Per-capture index of the connection
+        uint32_t status = 0;
+        uint64_t bytesSent = 0;     // Headers and body
+        Method method = Method::Other;
+        std::string target;
+        std::string range;          // Range header as sent, empty if none
+    };
+    
+    TrafficCapture();
+    ~TrafficCapture();
+    
+    // Starts a new capture into 'path' (truncated), ending any running one
+    bool start(const std::string& path);
+    void stop();
+    bool active() const { return active_.load(std::memory_order_relaxed); }
+    // Bumped by every start(), so connections notice their ids are stale
+    uint32_t generation() const { return generation_.load(std::memory_order_relaxed); }
+    int64_t startNs() const { return startNs_.load(std::memory_order_relaxed); }
+    
+    // Ids for a new connection from 'address' within the current capture
+    void assignIds(const std::string& address, uint32_t& client, uint32_t& connection);
+    
+    void append(const Record& record);
+    // Writes out buffered records
+    void flush();
+    
+    static Method methodOf(std::string_view method);
+    static const char* methodName(Method method);
+    static void encode(const Record& record, std::string& out);
+    // Whole file; false if it isn't a capture or is truncated mid-record
+    static bool read(const std::string& path, std::vector<Record>& out);
+    
+private:
+    static constexpr char MAGIC[8] = {'F', 'S', 'C', 'A', 'P', '0', '1', '\n'};
+    static constexpr size_t FLUSH_BYTES = 1 << 16;
+    
+    void flushLocked();
+    
+    std::mutex mutex_;
+    int fd_ = -1;
+    std::string buffer_;
+    std::unordered_map<std::string, uint32_t> clients_;
+    uint32_t nextConnection_ = 0;
+    std::atomic<bool> active_{false};
+    std::atomic<uint32_t> generation_{0};
+    std::atomic<int64_t> startNs_{0};
+};
@@ -0,0 +1,305 @@
+#include "upload_sessions.h"
+#include "upload_store.h"
+#include "file_manager.h"
+#include "file_listing.h"
+#include "sha256.h"
+
+#include <unistd.h>
+#include <cerrno>
+#include <cstring>
+#include <chrono>
+#include <android/log.h>
+
+#define LOG_TAG "UploadSessions"
+#define LOGI(...) __android_log_print(ANDROID_LOG_INFO, LOG_TAG, __VA_ARGS__)
+#define LOGE(...) __android_log_print(ANDROID_LOG_ERROR, LOG_TAG, __VA_ARGS__)
+
+namespace {
+
+constexpr size_t HASH_READ_SIZE = 1 << 20;
+
+int64_t nowMs() {
+    return std::chrono::duration_cast<std::chrono::milliseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+const char* stateName(UploadSession::State state) {
+    switch (state) {
+        case UploadSession::State::Open: return "open";
+        case UploadSession::State::Finalizing: return "finalizing";
+        case UploadSession::State::Complete: return "complete";
+        case UploadSession::State::Failed: return "failed";
+    }
+    return "unknown";
+}
+
+} // namespace
+
+UploadSession::~UploadSession() {
+    if (fd >= 0) {
+        close(fd);
+    }
+}
+
+UploadSessions::UploadSessions() {
+}
+
+UploadSessions::~UploadSessions() {
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        stopping_ = true;
+    }
+    jobsReady_.notify_all();
+    if (hashThread_.joinable()) {
+        hashThread_.join();
+    }
+    for (auto& entry : sessions_) {
+        discard(*entry.second);
+    }
+}
+
+std::shared_ptr<UploadSession> UploadSessions::create(const std::string& directory,
+                                                      const std::string& name,
+                                                      uint64_t size, uint64_t chunkSize) {
+    chunkSize = std::max(chunkSize, MIN_CHUNK_SIZE);
+    uint64_t chunkCount = size == 0 ? 0 : (size + chunkSize - 1) / chunkSize;
+    if (chunkCount > MAX_CHUNKS) {
+        errno = EFBIG;
+        return nullptr;
+    }
+    
+    auto session = std::make_shared<UploadSession>();
+    session->fd = UploadStore::createTemp(directory, name, size, session->tempPath);
+    if (session->fd < 0) {
+        return nullptr;
+    }
+    session->name = name;
+    session->directory = directory;
+    session->size = size;
+    session->chunkSize = chunkSize;
+    session->chunks.assign(chunkCount, UploadSession::ChunkState::Missing);
+    session->lastActivityMs = nowMs();
+    
+    std::lock_guard<std::mutex> lock(mutex_);
+    expireIdle(session->lastActivityMs);
+    char id[40];
+    snprintf(id, sizeof(id), "%llx-%x", static_cast<unsigned long long>(session->lastActivityMs),
+             sequence_++);
+    session->id = id;
+    sessions_[session->id] = session;
+    LOGI("Session %s: %s, %llu bytes in %llu chunks", id, name.c_str(),
+         static_cast<unsigned long long>(size), static_cast<unsigned long long>(chunkCount));
+    return session;
+}
+
+std::shared_ptr<UploadSession> UploadSessions::find(const std::string& id) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto it = sessions_.find(id);
+    return it == sessions_.end() ? nullptr : it->second;
+}
+
+UploadSessions::ChunkResult UploadSessions::beginChunk(UploadSession& session, uint32_t index,
+                                                       uint64_t length) {
+    std::lock_guard<std::mutex> lock(session.mutex);
+    if (index >= session.chunkCount()) {
+        return ChunkResult::NotFound;
+    }
+    if (length != session.chunkLength(index)) {
+        return ChunkResult::WrongLength;
+    }
+    if (session.state != UploadSession::State::Open ||
+        session.chunks[index] == UploadSession::ChunkState::Writing) {
+        return ChunkResult::Conflict;
+    }
+    // Re-sending a finished chunk is allowed; it just stops counting until done again
+    if (session.chunks[index] == UploadSession::ChunkState::Done) {
+        session.doneChunks--;
+    }
+    session.chunks[index] = UploadSession::ChunkState::Writing;
+    session.lastActivityMs = nowMs();
+    return ChunkResult::Ok;
+}
+
+void UploadSessions::endChunk(UploadSession& session, uint32_t index, bool success) {
+    std::lock_guard<std::mutex> lock(session.mutex);
+    if (success) {
+        session.chunks[index] = UploadSession::ChunkState::Done;
+        session.doneChunks++;
+    } else {
+        // Partial chunks are simply sent again; there is nothing to roll back
+        session.chunks[index] = UploadSession::ChunkState::Missing;
+    }
+    session.lastActivityMs = nowMs();
+}
+
+bool UploadSessions::finalize(const std::shared_ptr<UploadSession>& session,
+                              const std::string& sha256Hex, std::string& outError) {
+    {
+        std::lock_guard<std::mutex> lock(session->mutex);
+        if (session->state != UploadSession::State::Open) {
+            outError = std::string("session is ") + stateName(session->state);
+            return false;
+        }
+        if (session->doneChunks != session->chunkCount()) {
+            outError = "chunks missing";
+            return false;
+        }
+        session->state = UploadSession::State::Finalizing;
+        session->expectedSha256 = sha256Hex;
+        session->lastActivityMs = nowMs();
+    }
+    
+    std::lock_guard<std::mutex> lock(mutex_);
+    jobs_.push_back(session);
+    if (!hashThread_.joinable()) {
+        hashThread_ = std::thread(&UploadSessions::hashLoop, this);
+    }
+    jobsReady_.notify_one();
+    return true;
+}
+
+void UploadSessions::cancel(const std::shared_ptr<UploadSession>& session) {
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        sessions_.erase(session->id);
+    }
+    std::lock_guard<std::mutex> lock(session->mutex);
+    if (session->state == UploadSession::State::Open) {
+        // Chunk writers still in flight finish into the unlinked file
+        discard(*session);
+        session->state = UploadSession::State::Failed;
+        session->error = "cancelled";
+    }
+}
+
+std::string UploadSessions::statusJson(const UploadSession& session) {
+    std::lock_guard<std::mutex> lock(session.mutex);
+    
+    std::string json = "{\"id\":";
+    FileListing::appendJsonString(json, session.id);
+    json += ",\"name\":";
+    FileListing::appendJsonString(json, session.name);
+    json += ",\"size\":" + std::to_string(session.size);
+    json += ",\"chunkSize\":" + std::to_string(session.chunkSize);
+    json += ",\"chunkCount\":" + std::to_string(session.chunkCount());
+    json += ",\"state\":\"" + std::string(stateName(session.state)) + "\"";
+    if (!session.fileId.empty()) {
+        json += ",\"fileId\":";
+        FileListing::appendJsonString(json, session.fileId);
+    }
+    if (!session.error.empty()) {
+        json += ",\"error\":";
+        FileListing::appendJsonString(json, session.error);
+    }
+    json += ",\"missing\":[";
+    bool first = true;
+    for (uint32_t i = 0; i < session.chunkCount(); i++) {
+        if (session.chunks[i] != UploadSession::ChunkState::Done) {
+            if (!first) json.push_back(',');
+            first = false;
+            json += std::to_string(i);
+        }
+    }
+    json += "]}";
+    return json;
+}
+
+void UploadSessions::hashLoop() {
+    while (true) {
+        std::shared_ptr<UploadSession> session;
+        {
+            std::unique_lock<std::mutex> lock(mutex_);
+            jobsReady_.wait(lock, [this] { return stopping_ || !jobs_.empty(); });
+            if (stopping_) {
+                return;
+            }
+            session = std::move(jobs_.front());
+            jobs_.pop_front();
+        }
+        verifyAndPublish(*session);
+    }
+}
+
+void UploadSessions::verifyAndPublish(UploadSession& session) {
+    // No chunk writers remain once a session is Finalizing, so the file is stable
+    std::string error;
+    if (!session.expectedSha256.empty()) {
+        Sha256 sha;
+        std::vector<char> buffer(HASH_READ_SIZE);
+        uint64_t offset = 0;
+        while (offset < session.size) {
+            ssize_t bytesRead = pread(session.fd, buffer.data(), buffer.size(), offset);
+            if (bytesRead < 0 && errno == EINTR) {
+                continue;
+            }
+            if (bytesRead <= 0) {
+                error = std::string("read failed: ") + strerror(errno);
+                break;
+            }
+            sha.update(buffer.data(), bytesRead);
+            offset += bytesRead;
+        }
+        if (error.empty()) {
+            std::string actual = Sha256::toHex(sha.finish());
+            if (actual != session.expectedSha256) {
+                error = "sha256 mismatch: got " + actual;
+            }
+        }
+    }
+    
+    std::string path;
+    std::string name;
+    if (error.empty()) {
+        if (UploadStore::publish(session.tempPath, session.directory, session.name, path, name)) {
+            session.tempPath.clear();
+        } else {
+            error = std::string("publish failed: ") + strerror(errno);
+        }
+    }
+    
+    std::string fileId = "upload-" + session.id;
+    if (error.empty() && fileManager_) {
+        fileManager_->addFile(fileId, name, path, session.size);
+    }
+    
+    std::lock_guard<std::mutex> lock(session.mutex);
+    if (error.empty()) {
+        session.state = UploadSession::State::Complete;
+        session.fileId = fileId;
+        LOGI("Session %s complete: %s", session.id.c_str(), path.c_str());
+    } else {
+        // The data may be fine but can't be trusted; the client starts over
+        discard(session);
+        session.state = UploadSession::State::Failed;
+        session.error = error;
+        LOGE("Session %s failed: %s", session.id.c_str(), error.c_str());
+    }
+    session.lastActivityMs = nowMs();
+}
+
+void UploadSessions::expireIdle(int64_t now) {
+    // Called with mutex_ held. Finished sessions stay around for status polls
+    // until they expire too.
+    for (auto it = sessions_.begin(); it != sessions_.end();) {
+        UploadSession& session = *it->second;
+        std::lock_guard<std::mutex> lock(session.mutex);
+        bool busy = session.state == UploadSession::State::Finalizing ||
+                    std::find(session.chunks.begin(), session.chunks.end(),
+                              UploadSession::ChunkState::Writing) != session.chunks.end();
+        if (!busy && now - session.lastActivityMs > SESSION_TTL_MS) {
+            LOGI("Session %s expired", session.id.c_str());
+            discard(session);
+            it = sessions_.erase(it);
+        } else {
+            ++it;
+        }
+    }
+}
+
+void UploadSessions::discard(UploadSession& session) {
+    // Only the name goes; the fd stays valid for anyone still holding the session
+    if (!session.tempPath.empty()) {
+        unlink(session.tempPath.c_str());
+        session.tempPath.clear();
+    }
+}
@@ -0,0 +1,116 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <deque>
+#include <unordered_map>
+#include <memory>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+#include <algorithm>
+#include <cstdint>
+
+class FileManager;
+
+// One resumable upload: a preallocated temp file filled chunk by chunk, in any
+// order and over any number of connections.
+struct UploadSession {
+    enum class State {
+        Open,           // Accepting chunks
+        Finalizing,     // All chunks in; checksum being verified
+        Complete,       // Published into FileManager as fileId
+        Failed,         // Checksum mismatch or I/O error; see error
+    };
+    
+    enum class ChunkState : uint8_t {
+        Missing,
+        Writing,        // A connection is streaming it right now
+        Done,
+    };
+    
+    std::string id;
+    std::string name;
+    std::string directory;
+    std::string tempPath;   // Cleared once published or discarded
+    int fd = -1;            // Closed with the last reference, so chunk writers never see it reused
+    uint64_t size = 0;
+    uint64_t chunkSize = 0;
+    
+    // Everything below is guarded by mutex
+    mutable std::mutex mutex;
+    std::vector<ChunkState> chunks;
+    uint32_t doneChunks = 0;
+    State state = State::Open;
+    std::string expectedSha256;
+    std::string fileId;
+    std::string error;
+    int64_t lastActivityMs = 0;
+    
+    ~UploadSession();
+    
+    uint32_t chunkCount() const { return static_cast<uint32_t>(chunks.size()); }
+    uint64_t chunkOffset(uint32_t index) const { return index * chunkSize; }
+    uint64_t chunkLength(uint32_t index) const {
+        return std::min<uint64_t>(chunkSize, size - chunkOffset(index));
+    }
+};
+
+// Registry of upload sessions shared by every event loop. Checksums are
+// verified on a background thread so finalizing a large file never stalls a loop.
+class UploadSessions {
+public:
+    enum class ChunkResult {
+        Ok,
+        NotFound,       // No such chunk index
+        WrongLength,    // Content-Length doesn't match the chunk
+        Conflict,       // Session not open, or chunk already being written
+    };
+    
+    UploadSessions();
+    ~UploadSessions();
+    
+    void setFileManager(FileManager* fileManager) { fileManager_ = fileManager; }
+    
+    // Creates the session and its preallocated temp file; nullptr with errno set on failure
+    std::shared_ptr<UploadSession> create(const std::string& directory, const std::string& name,
+                                          uint64_t size, uint64_t chunkSize);
+    std::shared_ptr<UploadSession> find(const std::string& id);
+    
+    // A connection claims a chunk before streaming it and reports back after
+    ChunkResult beginChunk(UploadSession& session, uint32_t index, uint64_t length);
+    void endChunk(UploadSession& session, uint32_t index, bool success);
+    
+    // Queues checksum verification and publication. False (with a reason) if
+    // chunks are missing or the session isn't open.
+    bool finalize(const std::shared_ptr<UploadSession>& session, const std::string& sha256Hex,
+                  std::string& outError);
+    void cancel(const std::shared_ptr<UploadSession>& session);
+    
+    // {"id":..,"name":..,"size":..,"chunkSize":..,"chunkCount":..,"state":..,"missing":[..]}
+    static std::string statusJson(const UploadSession& session);
+    
+    static constexpr uint64_t DEFAULT_CHUNK_SIZE = 8 << 20;
+    static constexpr uint64_t MIN_CHUNK_SIZE = 64 << 10;
+    static constexpr uint32_t MAX_CHUNKS = 1 << 20;
+    
+private:
+    void hashLoop();
+    void verifyAndPublish(UploadSession& session);
+    void expireIdle(int64_t now);
+    static void discard(UploadSession& session);
+    
+    FileManager* fileManager_ = nullptr;
+    
+    std::mutex mutex_;
+    std::unordered_map<std::string, std::shared_ptr<UploadSession>> sessions_;
+    uint32_t sequence_ = 0;
+    
+    // Finalize jobs, run one at a time off the event loops
+    std::deque<std::shared_ptr<UploadSession>> jobs_;
+    std::condition_variable jobsReady_;
+    std::thread hashThread_;
+    bool stopping_ = false;
+    
+    static constexpr int64_t SESSION_TTL_MS = 24LL * 60 * 60 * 1000;
+};
@@ -0,0 +1,134 @@
+#include "upload_store.h"
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <ctime>
+#include <atomic>
+#include <algorithm>
+
+namespace UploadStore {
+
+namespace {
+
+constexpr int MAX_NAME_ATTEMPTS = 1000;
+constexpr size_t MAX_NAME_LENGTH = 255;     // NAME_MAX on every file system we write to
+
+int hexValue(char c) {
+    if (c >= '0' && c <= '9') return c - '0';
+    if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+    if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+    return -1;
+}
+
+// "name (n).ext", keeping the extension at the end
+std::string numberedName(const std::string& name, int n) {
+    size_t dot = name.rfind('.');
+    if (dot == std::string::npos || dot == 0) {
+        return name + " (" + std::to_string(n) + ")";
+    }
+    return name.substr(0, dot) + " (" + std::to_string(n) + ")" + name.substr(dot);
+}
+
+} // namespace
+
+bool sanitizeName(std::string_view raw, std::string& outName) {
+    outName.clear();
+    for (size_t i = 0; i < raw.size(); i++) {
+        char c = raw[i];
+        if (c == '%') {
+            int high = i + 2 < raw.size() ? hexValue(raw[i + 1]) : -1;
+            int low = high >= 0 ? hexValue(raw[i + 2]) : -1;
+            if (low < 0) {
+                return false;
+            }
+            c = static_cast<char>(high * 16 + low);
+            i += 2;
+        }
+        // Controls and quotes would end up in response headers via the display name
+        unsigned char byte = static_cast<unsigned char>(c);
+        if (c == '/' || c == '\\' || c == '"' || byte < 0x20 || byte == 0x7f) {
+            return false;
+        }
+        outName.push_back(c);
+    }
+    return !outName.empty() && outName != "." && outName != ".." && outName.size() <= MAX_NAME_LENGTH;
+}
+
+int createTemp(const std::string& dir, const std::string& name, off_t length,
+               std::string& outPath) {
+    static std::atomic<uint32_t> sequence(0);
+    
+    char suffix[32];
+    snprintf(suffix, sizeof(suffix), ".%08x%04x.part",
+             static_cast<unsigned>(time(nullptr)), sequence.fetch_add(1) & 0xffff);
+    // Only the final name has to be exact; cut this one short (on a UTF-8
+    // boundary) so the dot and suffix still fit in NAME_MAX
+    size_t keep = std::min(name.size(), MAX_NAME_LENGTH - 1 - strlen(suffix));
+    while (keep > 0 && keep < name.size() && (static_cast<unsigned char>(name[keep]) & 0xc0) == 0x80) {
+        keep--;
+    }
+    outPath = dir + "/." + name.substr(0, keep) + suffix;
+    
+    int fd = open(outPath.c_str(), O_RDWR | O_CREAT | O_EXCL | O_CLOEXEC, 0644);
+    if (fd < 0) {
+        return -1;
+    }
+    
+    // Reserve the space up front: fails fast on a full disk and avoids
+    // fragmenting the file as it grows. Not every file system can do it.
+    if (length > 0 && fallocate(fd, 0, 0, length) < 0 &&
+        errno != EOPNOTSUPP && errno != ENOSYS) {
+        int savedErrno = errno;
+        close(fd);
+        unlink(outPath.c_str());
+        errno = savedErrno;
+        return -1;
+    }
+    return fd;
+}
+
+bool writeAt(int fd, const char* data, size_t length, off_t offset) {
+    while (length > 0) {
+        ssize_t written = pwrite(fd, data, length, offset);
+        if (written < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return false;
+        }
+        data += written;
+        length -= written;
+        offset += written;
+    }
+    return true;
+}
+
+bool publish(const std::string& tempPath, const std::string& dir, const std::string& name,
+             std::string& outPath, std::string& outName) {
+    // link() fails with EEXIST instead of replacing, unlike rename()
+    for (int attempt = 0; attempt < MAX_NAME_ATTEMPTS; attempt++) {
+        outName = attempt == 0 ? name : numberedName(name, attempt);
+        outPath = dir + "/" + outName;
+        if (link(tempPath.c_str(), outPath.c_str()) == 0) {
+            unlink(tempPath.c_str());
+            return true;
+        }
+        if (errno == EPERM || errno == EOPNOTSUPP || errno == ENOSYS) {
+            // Shared storage (FUSE/sdcardfs) may not do hard links: check, then rename
+            if (access(outPath.c_str(), F_OK) == 0) {
+                continue;
+            }
+            return rename(tempPath.c_str(), outPath.c_str()) == 0;
+        }
+        if (errno != EEXIST) {
+            return false;
+        }
+    }
+    errno = EEXIST;
+    return false;
+}
+
+} // namespace UploadStore
@@ -0,0 +1,30 @@
+#pragma once
+
+#include <string>
+#include <string_view>
+#include <sys/types.h>
+
+// File-system side of uploads: bodies land in a hidden temporary file in the
+// upload directory and are moved to their final name once complete.
+// Functions that fail leave errno set for the caller to map to a status.
+namespace UploadStore {
+
+// Percent-decodes a client-supplied file name and rejects anything that could
+// escape the upload directory ("", ".", "..", slashes, NUL) or a header
+// (control characters, DEL, double quotes)
+bool sanitizeName(std::string_view raw, std::string& outName);
+
+// Creates "<dir>/.<name>.<random>.part" (name shortened to fit) read-write (so it can be verified) and
+// preallocates 'length' bytes when the file system supports it. Returns the fd, or -1.
+int createTemp(const std::string& dir, const std::string& name, off_t length,
+               std::string& outPath);
+
+// Writes all of 'data' at 'offset'
+bool writeAt(int fd, const char* data, size_t length, off_t offset);
+
+// Moves a finished temp file to <dir>/<name> without replacing an existing
+// file; on a clash it tries "name (1).ext", "name (2).ext", ...
+bool publish(const std::string& tempPath, const std::string& dir, const std::string& name,
+             std::string& outPath, std::string& outName);
+
+} // namespace UploadStore
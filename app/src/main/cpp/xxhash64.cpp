@@ -0,0 +1,117 @@
+#include "xxhash64.h"
+
+#include <cstring>
+
+namespace {
+
+constexpr uint64_t kPrime1 = 0x9E3779B185EBCA87ULL;
+constexpr uint64_t kPrime2 = 0xC2B2AE3D27D4EB4FULL;
+constexpr uint64_t kPrime3 = 0x165667B19E3779F9ULL;
+constexpr uint64_t kPrime4 = 0x85EBCA77C2B2AE63ULL;
+constexpr uint64_t kPrime5 = 0x27D4EB2F165667C5ULL;
+
+inline uint64_t rotl(uint64_t x, int n) {
+    return (x << n) | (x >> (64 - n));
+}
+
+// Little-endian loads regardless of host order or alignment
+inline uint64_t read64(const uint8_t* p) {
+    uint64_t v = 0;
+    for (int i = 7; i >= 0; i--) {
+        v = (v << 8) | p[i];
+    }
+    return v;
+}
+
+inline uint32_t read32(const uint8_t* p) {
+    return uint32_t(p[0]) | (uint32_t(p[1]) << 8) | (uint32_t(p[2]) << 16) | (uint32_t(p[3]) << 24);
+}
+
+inline uint64_t round(uint64_t lane, uint64_t input) {
+    lane += input * kPrime2;
+    lane = rotl(lane, 31);
+    return lane * kPrime1;
+}
+
+inline uint64_t mergeRound(uint64_t hash, uint64_t lane) {
+    hash ^= round(0, lane);
+    return hash * kPrime1 + kPrime4;
+}
+
+} // namespace
+
+Xxh64::Xxh64(uint64_t seed)
+    : seed_(seed), lanes_{seed + kPrime1 + kPrime2, seed + kPrime2, seed, seed - kPrime1} {
+}
+
+void Xxh64::update(const void* data, size_t length) {
+    const uint8_t* bytes = static_cast<const uint8_t*>(data);
+    totalLength_ += length;
+    
+    if (bufferLength_ > 0) {
+        size_t take = length < sizeof(buffer_) - bufferLength_ ? length : sizeof(buffer_) - bufferLength_;
+        memcpy(buffer_ + bufferLength_, bytes, take);
+        bufferLength_ += take;
+        bytes += take;
+        length -= take;
+        if (bufferLength_ < sizeof(buffer_)) {
+            return;
+        }
+        for (int i = 0; i < 4; i++) {
+            lanes_[i] = round(lanes_[i], read64(buffer_ + 8 * i));
+        }
+        bufferLength_ = 0;
+    }
+    // Whole stripes straight from the input
+    while (length >= sizeof(buffer_)) {
+        for (int i = 0; i < 4; i++) {
+            lanes_[i] = round(lanes_[i], read64(bytes + 8 * i));
+        }
+        bytes += sizeof(buffer_);
+        length -= sizeof(buffer_);
+    }
+    memcpy(buffer_, bytes, length);
+    bufferLength_ = length;
+}
+
+uint64_t Xxh64::finish() const {
+    uint64_t hash;
+    if (totalLength_ >= sizeof(buffer_)) {
+        hash = rotl(lanes_[0], 1) + rotl(lanes_[1], 7) + rotl(lanes_[2], 12) + rotl(lanes_[3], 18);
+        for (int i = 0; i < 4; i++) {
+            hash = mergeRound(hash, lanes_[i]);
+        }
+    } else {
+        hash = seed_ + kPrime5;
+    }
+    hash += totalLength_;
+    
+    const uint8_t* p = buffer_;
+    const uint8_t* end = buffer_ + bufferLength_;
+    for (; p + 8 <= end; p += 8) {
+        hash ^= round(0, read64(p));
+        hash = rotl(hash, 27) * kPrime1 + kPrime4;
+    }
+    if (p + 4 <= end) {
+        hash ^= uint64_t(read32(p)) * kPrime1;
+        hash = rotl(hash, 23) * kPrime2 + kPrime3;
+        p += 4;
+    }
+    for (; p < end; p++) {
+        hash ^= uint64_t(*p) * kPrime5;
+        hash = rotl(hash, 11) * kPrime1;
+    }
+    
+    hash ^= hash >> 33;
+    hash *= kPrime2;
+    hash ^= hash >> 29;
+    hash *= kPrime3;
+    hash ^= hash >> 32;
+    return hash;
+}
+
+uint64_t Xxh64::hash(const void* data, size_t length, uint64_t seed) {
+    Xxh64 xxh(seed);
+    xxh.update(data, length);
+    return xxh.finish();
+}
@@ -0,0 +1,24 @@
+#pragma once
+
+#include <string_view>
+#include <cstddef>
+#include <cstdint>
+
+// Incremental XXH64 (the reference algorithm, same output as xxhsum -H1)
+class Xxh64 {
+public:
+    explicit Xxh64(uint64_t seed = 0);
+    
+    void update(const void* data, size_t length);
+    void update(std::string_view data) { update(data.data(), data.size()); }
+    uint64_t finish() const;
+    
+    static uint64_t hash(const void* data, size_t length, uint64_t seed = 0);
+    
+private:
+    uint64_t seed_;
+    uint64_t lanes_[4];
+    uint8_t buffer_[32];
+    size_t bufferLength_ = 0;
+    uint64_t totalLength_ = 0;
+};
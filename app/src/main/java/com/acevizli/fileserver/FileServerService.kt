@@ -13,6 +13,7 @@ import android.os.IBinder
 import android.os.ParcelFileDescriptor
 import android.util.Log
 import androidx.core.app.NotificationCompat
+import java.io.File
 import java.util.UUID
 
 class FileServerService : Service() {
@@ -97,6 +98,8 @@ class FileServerService : Service() {
         }
         
         serverPort = port
+        NativeServer.setCompressionCache(File(cacheDir, "compressed").path, 0)
+        NativeServer.setContentHashing(true, true, File(filesDir, "hashes").path)
         
         // Add all files to native server
         for (file in sharedFiles) {
@@ -14,10 +14,69 @@ object NativeServer {
     external fun isServerRunning(): Boolean
     external fun getServerPort(): Int
     
+    /** Worker pool size, per-worker accept queue depth and connection cap; <= 0 keeps the current value. */
+    external fun setServerLimits(workerCount: Int, queueDepth: Int, maxConnections: Int)
+    /**
+     * [accepted, rejected, active, queued, workers, queueDepth, maxConnections,
+     *  sendfileTransfers, spliceTransfers, copyTransfers,
+     *  interactiveRequests, interactiveQueueUs, interactiveQueueMaxUs,
+     *  bulkRequests, bulkQueueUs, bulkQueueMaxUs,
+     *  activeBulkTransfers, waitingBulkTransfers, maxBulkTransfers]
+     *
+     * Queue times run from a request being read to its response starting.
+     */
+    external fun getServerStats(): LongArray
+    /** The same text GET /metrics serves: Prometheus exposition format. */
+    external fun getMetrics(): String
+    /**
+     * Phase timings of the most recent requests as Chrome trace JSON (load it in
+     * Perfetto or chrome://tracing). Empty unless the native code was built with tracing.
+     */
+    external fun getRequestTrace(): String
+    /**
+     * Records every served request (timing, target, range, status; no bodies or
+     * credentials) into path, replacing any running capture. Replay the file against
+     * the host build with fileserver_loadgen --replay.
+     */
+    external fun startCapture(path: String): Boolean
+    /** Ends the running capture and flushes it to disk. */
+    external fun stopCapture()
+    /** Idle timeout and request cap for persistent connections; <= 0 keeps the current value. */
+    external fun setKeepAlive(timeoutSeconds: Int, maxRequests: Int)
+    /** How many bulk transfers (large downloads, archives) stream at once; <= 0 keeps the current value. */
+    external fun setBulkTransferLimit(maxBulkTransfers: Int)
+    /**
+     * Directory that PUT/POST /upload/<name> writes into; finished uploads are shared
+     * automatically. An empty string disables uploads.
+     */
+    external fun setUploadDirectory(directory: String)
+    /**
+     * Directory for cached gzip variants of text-like shares, bounded to maxBytes
+     * (<= 0 keeps the current budget). An empty string disables the cache.
+     */
+    external fun setCompressionCache(directory: String, maxBytes: Long)
+    /**
+     * Download bandwidth caps in bytes per second: all transfers together, per client
+     * address, and per transfer. Values <= 0 lift a cap; applies to transfers in flight.
+     */
+    external fun setRateLimits(globalBytesPerSecond: Long, perClientBytesPerSecond: Long,
+                               perTransferBytesPerSecond: Long)
+    
     external fun setCredentials(username: String, password: String)
     
     external fun addFile(id: String, displayName: String, path: String, size: Long)
     external fun addFileDescriptor(id: String, displayName: String, fd: Int, size: Long)
     external fun removeFile(id: String)
     external fun clearFiles()
+    /**
+     * Whether files added from now on whose names have no known extension get their
+     * Content-Type from their first bytes. On by default.
+     */
+    external fun setContentSniffing(enabled: Boolean)
+    /**
+     * Hashes shared files in the background for /api/files, strong ETags and, with
+     * [sha256], Repr-Digest headers. Results are kept in [cacheDirectory] so files
+     * that haven't changed are not read again. Off by default.
+     */
+    external fun setContentHashing(enabled: Boolean, sha256: Boolean, cacheDirectory: String)
 }